@@ -1,15 +1,13 @@
 #version 460 core
 
 in vec2 f_tex_coords;
-in flat int f_instance_id;
+flat in vec3 f_color;
 out vec4 out_color;
 
-uniform sampler2DArray u_text_sampler_array;
-uniform unsigned int u_charmap[128];
-uniform vec3 u_text_color;
+uniform sampler2D u_glyph_cache;
 
 void main()
 {
-    vec4 sampled = vec4(1.0f, 1.0f, 1.0f, texture(u_text_sampler_array, vec3(f_tex_coords.xy, u_charmap[f_instance_id])).r);
-    out_color = vec4(u_text_color, 1.0f) * sampled;
+    vec4 sampled = vec4(1.0f, 1.0f, 1.0f, texture(u_glyph_cache, f_tex_coords).r);
+    out_color = vec4(f_color, 1.0f) * sampled;
 }
@@ -1,17 +1,22 @@
 #version 460 core
 
 layout (location = 0) in vec2 v_vertex; // vec2 pos
+layout (location = 1) in vec3 v_color; // per instance
 
 out vec2 f_tex_coords;
-out flat int f_instance_id;
+flat out vec3 f_color;
 
 uniform mat4 u_transforms[128];
+uniform vec4 u_glyph_rects[128]; // glyph position and size in cache texels
 uniform mat4 u_projection;
+uniform sampler2D u_glyph_cache;
 
 void main()
 {
     gl_Position = u_projection * u_transforms[gl_InstanceID] * vec4(v_vertex.xy, 0.0f, 1.0f);
-    f_tex_coords = v_vertex.xy;
-    f_tex_coords.y = 1.0f - v_vertex.y; // vertical flip
-    f_instance_id = gl_InstanceID;
+    
+    const vec4 rect = u_glyph_rects[gl_InstanceID];
+    const vec2 uv = vec2(v_vertex.x, 1.0f - v_vertex.y); // vertical flip
+    f_tex_coords = (rect.xy + uv * rect.zw) / vec2(textureSize(u_glyph_cache, 0));
+    f_color = v_color;
 }
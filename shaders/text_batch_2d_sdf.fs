@@ -0,0 +1,18 @@
+#version 460 core
+
+in vec2 f_tex_coords;
+flat in vec3 f_color;
+out vec4 out_color;
+
+uniform sampler2D u_glyph_cache;
+
+const float EDGE_VALUE = 128.0f / 255.0f; // SDF_ONEDGE_VALUE from font.h
+
+void main()
+{
+    // Blend over about one screen pixel, so edges stay sharp at any scale.
+    const float distance = texture(u_glyph_cache, f_tex_coords).r;
+    const float width = fwidth(distance) * 0.5f;
+    const float alpha = smoothstep(EDGE_VALUE - width, EDGE_VALUE + width, distance);
+    out_color = vec4(f_color, alpha);
+}
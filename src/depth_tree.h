@@ -0,0 +1,103 @@
+#pragma once
+
+// Nesting depth change over range of text and lowest depth inside it relative to range
+// start, start itself included, so min is never positive.
+struct Depth_Summary
+{
+    s32 net;
+    s32 min;
+};
+
+inline Depth_Summary combine_depth(Depth_Summary a, Depth_Summary b)
+{
+    return { a.net + b.net, min(a.min, a.net + b.min) };
+}
+
+// Segment tree of depth summaries, prefix depth and first or last range where depth drops
+// to given one are found in log time. Tree is 1-based, leaves are tree[capacity..2 * capacity),
+// capacity must be power of two.
+
+// Update ancestors of leaves [first, end) after they were set, level by level. Cost is of
+// range size plus tree height, whole tree is built with range of all leaves.
+inline void build_depth_tree(Depth_Summary* tree, s32 capacity, s32 first, s32 end)
+{
+    if (first >= end) return;
+    
+    for (s32 lo = (first + capacity) / 2, hi = (end - 1 + capacity) / 2; lo > 0; lo /= 2, hi /= 2)
+        for (s32 i = lo; i <= hi; ++i)
+            tree[i] = combine_depth(tree[2 * i], tree[2 * i + 1]);
+}
+
+// Set value with given 0-based index.
+inline void set_depth_tree_value(Depth_Summary* tree, s32 capacity, s32 idx, Depth_Summary value)
+{
+    s32 i = idx + capacity;
+    tree[i] = value;
+    
+    for (i /= 2; i > 0; i /= 2)
+        tree[i] = combine_depth(tree[2 * i], tree[2 * i + 1]);
+}
+
+// Depth at start of value with given index.
+inline s32 depth_before(const Depth_Summary* tree, s32 capacity, s32 idx)
+{
+    s32 depth = 0;
+    for (s32 i = idx + capacity; i > 1; i /= 2)
+        if (i & 1) depth += tree[i - 1].net;
+    
+    return depth;
+}
+
+// First value from given index where depth goes down to target, depth is one at start of
+// that index. INVALID_INDEX if there is none.
+inline s32 find_depth_drop_after(const Depth_Summary* tree, s32 capacity, s32 idx, s32 depth, s32 target)
+{
+    s32 i = idx + capacity;
+    while (depth + tree[i].min > target)
+    {
+        // Go to subtree right of this one.
+        depth += tree[i].net;
+        while (i & 1) i /= 2;
+        if (i == 0) return INVALID_INDEX;
+        i++;
+    }
+
+    while (i < capacity)
+    {
+        i *= 2;
+        if (depth + tree[i].min > target)
+        {
+            depth += tree[i].net;
+            i++;
+        }
+    }
+
+    return i - capacity;
+}
+
+// Last value till given index where depth goes down to target, depth is one at end of
+// that index. INVALID_INDEX if there is none.
+inline s32 find_depth_drop_before(const Depth_Summary* tree, s32 capacity, s32 idx, s32 depth, s32 target)
+{
+    s32 i = idx + capacity;
+    while (depth - tree[i].net + tree[i].min > target)
+    {
+        // Go to subtree left of this one.
+        depth -= tree[i].net;
+        while (!(i & 1)) i /= 2;
+        if (i == 1) return INVALID_INDEX;
+        i--;
+    }
+
+    while (i < capacity)
+    {
+        i = 2 * i + 1;
+        if (depth - tree[i].net + tree[i].min > target)
+        {
+            depth -= tree[i].net;
+            i--;
+        }
+    }
+
+    return i - capacity;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// Fenwick tree gives prefix sums of array values and updates them in log time.
+// Tree is 1-based, node idx keeps sum of values in (idx - lowest set bit of idx, idx].
+
+// Turn values in tree[valid_count + 1..count] into tree in place, nodes till valid_count
+// cover only values before it and are kept. Cost is of rebuilt part only.
+inline void build_fenwick_tree(s32* tree, s32 count, s32 valid_count)
+{
+    // Kept nodes whose parents are rebuilt are the ones prefix sum of valid_count walks.
+    for (s32 i = valid_count; i > 0; i -= i & -i)
+    {
+        const s32 parent = i + (i & -i);
+        if (parent <= count) tree[parent] += tree[i];
+    }
+    
+    for (s32 i = valid_count + 1; i <= count; ++i)
+    {
+        const s32 parent = i + (i & -i);
+        if (parent <= count) tree[parent] += tree[i];
+    }
+}
+
+// Add delta to value with given 0-based index.
+inline void add_fenwick_value(s32* tree, s32 count, s32 idx, s32 delta)
+{
+    for (s32 i = idx + 1; i <= count; i += i & -i)
+        tree[i] += delta;
+}
+
+// Sum of first count values.
+inline s32 fenwick_prefix_sum(const s32* tree, s32 count)
+{
+    s32 sum = 0;
+    for (s32 i = count; i > 0; i -= i & -i)
+        sum += tree[i];
+    return sum;
+}
+
+// Amount of leading values whose sum does not exceed given one, sum is reduced by theirs.
+// Values must not be negative.
+inline s32 fenwick_lower_bound(const s32* tree, s32 count, s32* sum)
+{
+    s32 step = 1;
+    while (step * 2 <= count) step *= 2;
+
+    s32 idx = 0;
+    for (; step > 0; step /= 2)
+    {
+        if (idx + step <= count && tree[idx + step] <= *sum)
+        {
+            idx += step;
+            *sum -= tree[idx];
+        }
+    }
+
+    return idx;
+}
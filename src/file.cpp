@@ -2,6 +2,7 @@
 #include "file.h"
 #include "arena.h"
 #include <stdio.h>
+#include <windows.h>
 #include <glfw/glfw3.h>
 
 u8* read_entire_file(Arena* arena, const char* path, s32* size_pushed)
@@ -41,3 +42,47 @@ void overwrite_file(const char* path, const u8* data, s32 size)
         fclose(file);
     }
 }
+
+bool map_file(Mapped_File* mapped_file, const char* path)
+{
+    *mapped_file = {};
+    
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, null, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, null);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    
+    HANDLE mapping = CreateFileMappingA(file, null, PAGE_READONLY, 0, 0, null);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mapped_file->file = file;
+    mapped_file->mapping = mapping;
+    mapped_file->data = (const u8*)data;
+    mapped_file->size = size.QuadPart;
+    return true;
+}
+
+void unmap_file(Mapped_File* mapped_file)
+{
+    if (mapped_file->data) UnmapViewOfFile(mapped_file->data);
+    if (mapped_file->mapping) CloseHandle(mapped_file->mapping);
+    if (mapped_file->file) CloseHandle(mapped_file->file);
+    *mapped_file = {};
+}
@@ -2,5 +2,16 @@
 
 struct Arena;
 
+// Read only view of whole file contents.
+struct Mapped_File
+{
+    void* file;
+    void* mapping;
+    const u8* data;
+    u64 size;
+};
+
 u8* read_entire_file(Arena* arena, const char* path, s32* size_pushed = null);
 void overwrite_file(const char* path, const u8* data, s32 size);
+bool map_file(Mapped_File* mapped_file, const char* path);
+void unmap_file(Mapped_File* mapped_file);
@@ -1,37 +1,203 @@
 #include "pch.h"
 #include "font.h"
 #include "gl.h"
+#include "job.h"
 #include "file.h"
+#include "hash.h"
+#include "utf8.h"
 #include "arena.h"
 #include "matrix.h"
 #include "gap_buffer.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <glad/glad.h>
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include <vendor/stb_truetype.h>
 
-void init_font(Font* font, Arena* arena, const char* path)
-{    
-    s32 data_size = 0;
-    u8* data = read_entire_file(arena, path, &data_size);
+// Monospace fonts are detected by ascii glyphs only, other glyphs may be wider.
+static s32 get_monospace_advance(const stbtt_fontinfo* info)
+{
+    s32 advance = 0;
+    for (s32 c = ' '; c <= '~'; ++c)
+    {
+        const s32 glyph_index = stbtt_FindGlyphIndex(info, c);
+        if (!glyph_index) return 0;
 
-    font->info = push_struct(arena, stbtt_fontinfo);
-    stbtt_InitFont(font->info, data, stbtt_GetFontOffsetForIndex(data, 0));
+        s32 glyph_advance;
+        stbtt_GetGlyphHMetrics(info, glyph_index, &glyph_advance, 0);
+        
+        if (c == ' ') advance = glyph_advance;
+        else if (glyph_advance != advance) return 0;
+    }
 
+    return advance;
+}
+
+static bool load_font_file(Font* font)
+{
+    font->loaded = true;
+    
+    if (!map_file(&font->file, font->path))
+    {
+        printf("Failed to map font file %s\n", font->path);
+        font->missing = true;
+        return false;
+    }
+
+    const u8* data = font->file.data;
+    const s32 offset = stbtt_GetFontOffsetForIndex(data, 0);
+    if (offset < 0 || !stbtt_InitFont(font->info, data, offset))
+    {
+        printf("Failed to parse font file %s\n", font->path);
+        unmap_file(&font->file);
+        font->missing = true;
+        return false;
+    }
+    
     stbtt_GetFontVMetrics(font->info, &font->ascent, &font->descent, &font->line_gap);
+    font->monospace_advance = get_monospace_advance(font->info);
+
+    // Hashing whole file would touch every page of it, file size and checksum
+    // adjustment of head table identify font contents well enough.
+    const u64 identity[] = { font->file.size, ttULONG((u8*)data + font->info->head + 8) };
+    font->hash = hash_bytes((const u8*)identity, sizeof(identity));
+    
+    return true;
 }
 
-void init_font_render_context(Font_Render_Context* ctx, Arena* arena, s32 win_w, s32 win_h)
+bool init_font(Font* font, Arena* arena, const char* path)
 {
-    ctx->program = gl_load_program(arena, DIR_SHADERS "text_batch_2d.vs", DIR_SHADERS "text_batch_2d.fs");
+    *font = {0};
+    font->path = path;
+    font->info = push_struct(arena, stbtt_fontinfo);
+    font->fallbacks = push_array(arena, MAX_FALLBACK_FONTS, Font);
+    
+    // All bits set is not valid codepoint, so it marks empty entry.
+    font->charmap_cache = push_array(arena, FONT_CHARMAP_CACHE_SIZE, Font_Charmap_Entry);
+    memset(font->charmap_cache, 0xFF, FONT_CHARMAP_CACHE_SIZE * sizeof(Font_Charmap_Entry));
+
+    return load_font_file(font);
+}
+
+void add_fallback_font(Font* font, Arena* arena, const char* path)
+{
+    if (font->fallback_count == MAX_FALLBACK_FONTS)
+    {
+        printf("Too many fallback fonts, %s is ignored\n", path);
+        return;
+    }
+
+    auto* fallback = font->fallbacks + font->fallback_count++;
+    *fallback = {0};
+    fallback->path = path;
+    fallback->info = push_struct(arena, stbtt_fontinfo);
+
+    // Baked atlases may contain fallback glyphs, so chain is part of font identity.
+    font->hash = hash_bytes((const u8*)path, strlen(path), font->hash);
+    
+    // Codepoints cached as missing could be found in new fallback.
+    memset(font->charmap_cache, 0xFF, FONT_CHARMAP_CACHE_SIZE * sizeof(Font_Charmap_Entry));
+}
+
+static bool is_control_codepoint(u32 codepoint)
+{
+    return codepoint < 0x20 || (codepoint >= 0x7F && codepoint < 0xA0);
+}
+
+static u32 find_glyph_id(Font* font, u32 codepoint)
+{
+    const u32 glyph_index = stbtt_FindGlyphIndex(font->info, codepoint);
+    
+    // Control characters are missing in most fonts, so they would load whole chain.
+    if (glyph_index || is_control_codepoint(codepoint)) return glyph_index;
+
+    for (s32 i = 0; i < font->fallback_count; ++i)
+    {
+        auto* fallback = font->fallbacks + i;
+        if (!fallback->loaded) load_font_file(fallback);
+        if (fallback->missing) continue;
+        
+        const u32 fallback_glyph_index = stbtt_FindGlyphIndex(fallback->info, codepoint);
+        if (fallback_glyph_index)
+            return ((u32)(i + 1) << FONT_GLYPH_INDEX_BITS) | fallback_glyph_index;
+    }
+
+    return 0;
+}
 
-    ctx->u_charmap = glGetUniformLocation(ctx->program, "u_charmap");
+u32 get_glyph_index(Font* font, u32 codepoint)
+{
+    auto* entry = font->charmap_cache + (codepoint & (FONT_CHARMAP_CACHE_SIZE - 1));
+    if (entry->codepoint != codepoint)
+    {
+        entry->codepoint = codepoint;
+        entry->glyph_index = find_glyph_id(font, codepoint);
+    }
+    
+    return entry->glyph_index;
+}
+
+const Font* get_glyph_font(const Font* font, u32 glyph_id, u32* glyph_index)
+{
+    *glyph_index = glyph_id & ((1u << FONT_GLYPH_INDEX_BITS) - 1);
+    
+    const u32 font_idx = glyph_id >> FONT_GLYPH_INDEX_BITS;
+    if (font_idx == 0) return font;
+    
+    assert((s32)font_idx <= font->fallback_count);
+    return font->fallbacks + font_idx - 1;
+}
+
+// Fallback glyphs are scaled to the same pixel height as primary font ones.
+static f32 glyph_font_scale(const Font* font, const Font* glyph_font, f32 scale)
+{
+    if (glyph_font == font) return scale;
+    return scale * (font->ascent - font->descent) / (f32)(glyph_font->ascent - glyph_font->descent);
+}
+
+s32 get_glyph_advance(const Font* font, const Font_Atlas* atlas, u32 glyph_id)
+{
+    u32 glyph_index;
+    const Font* glyph_font = get_glyph_font(font, glyph_id, &glyph_index);
+    
+    s32 advance_width = 0;
+    stbtt_GetGlyphHMetrics(glyph_font->info, glyph_index, &advance_width, 0);
+    
+    // Rounded the same way as advance of cached glyph.
+    return (s16)(advance_width * glyph_font_scale(font, glyph_font, atlas->px_h_scale));
+}
+
+f32 get_glyph_kern_advance(const Font* font, const Font_Atlas* atlas, u32 glyph_id_a, u32 glyph_id_b)
+{
+    // Glyphs of different fonts are never kerned.
+    if ((glyph_id_a ^ glyph_id_b) >> FONT_GLYPH_INDEX_BITS) return 0.0f;
+    
+    u32 glyph_index_a, glyph_index_b;
+    const Font* glyph_font = get_glyph_font(font, glyph_id_a, &glyph_index_a);
+    get_glyph_font(font, glyph_id_b, &glyph_index_b);
+    
+    const s32 kern = stbtt_GetGlyphKernAdvance(glyph_font->info, glyph_index_a, glyph_index_b);
+    return kern * glyph_font_scale(font, glyph_font, atlas->px_h_scale);
+}
+
+const u8* get_font_table(const Font* font, const char* tag)
+{
+    const u32 offset = stbtt__find_table(font->info->data, font->info->fontstart, tag);
+    return offset ? font->info->data + offset : null;
+}
+
+void init_font_render_context(Font_Render_Context* ctx, Arena* arena, s32 win_w, s32 win_h, bool sdf)
+{
+    const char* fragment_path = sdf ? DIR_SHADERS "text_batch_2d_sdf.fs" : DIR_SHADERS "text_batch_2d.fs";
+    ctx->program = gl_load_program(arena, DIR_SHADERS "text_batch_2d.vs", fragment_path);
+
+    ctx->u_glyph_rects = glGetUniformLocation(ctx->program, "u_glyph_rects");
     ctx->u_transforms = glGetUniformLocation(ctx->program, "u_transforms");
-    ctx->u_text_color = glGetUniformLocation(ctx->program, "u_text_color");
         
-    ctx->charmap = push_array(arena, FONT_RENDER_BATCH_SIZE, u32);
+    ctx->glyph_rects = push_array(arena, FONT_RENDER_BATCH_SIZE, vec4);
     ctx->transforms = push_array(arena, FONT_RENDER_BATCH_SIZE, mat4);
+    ctx->glyph_colors = push_array(arena, FONT_RENDER_BATCH_SIZE, vec3);
     
     glGenVertexArrays(1, &ctx->vao);
     glGenBuffers(1, &ctx->vbo);
@@ -49,162 +215,829 @@ void init_font_render_context(Font_Render_Context* ctx, Arena* arena, s32 win_w,
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), (void*)0);
+
+    // Colors advance once per glyph instance, they are streamed with each batch.
+    glGenBuffers(1, &ctx->color_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->color_vbo);
+    glBufferData(GL_ARRAY_BUFFER, FONT_RENDER_BATCH_SIZE * sizeof(vec3), null, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
+    glVertexAttribDivisor(1, 1);
     
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
-void bake_font_atlas(Font_Atlas* atlas, Arena* arena, const Font* font, u32 start_charcode, u32 end_charcode, s16 font_size)
+void init_font_atlas(Font_Atlas* atlas, const Font* font, u32 start_charcode, u32 end_charcode, s16 font_size)
 {
-    const u32 charcode_count = end_charcode - start_charcode + 1;
-    atlas->metrics = push_array(arena, charcode_count, Font_Glyph_Metric);
+    const f32 scale = stbtt_ScaleForPixelHeight(font->info, (f32)font_size);
+    
     atlas->start_charcode = start_charcode;
     atlas->end_charcode = end_charcode;
+    atlas->px_h_scale = scale;
+    atlas->line_height = (s32)((font->ascent - font->descent + font->line_gap) * scale);
     atlas->font_size = font_size;
+    atlas->monospace_advance = (s16)(font->monospace_advance * scale);
+    atlas->baked = false;
+}
+
+// Marks key of sdf bitmap glyph, sdf glyphs of exact font size only refer to it.
+inline constexpr u64 GLYPH_KEY_SDF = 1ULL << 63;
+
+static u64 glyph_key(u32 glyph_index, s16 font_size)
+{
+    // Font size is never 0, so valid key is never 0 either.
+    return ((u64)font_size << 32) | glyph_index;
+}
+
+static u64 sdf_glyph_key(u32 glyph_index)
+{
+    return GLYPH_KEY_SDF | glyph_key(glyph_index, SDF_GLYPH_SIZE);
+}
+
+static u32 glyph_index_from_key(u64 key)
+{
+    return (u32)(key & 0xFFFFFFFF);
+}
+
+static Cached_Glyph* find_glyph_slot(Glyph_Cache* cache, u64 key)
+{
+    // Hash table is kept at most half full, so there is always an empty slot.
+    u32 idx = (u32)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (GLYPH_CACHE_MAX_GLYPHS - 1);
+    while (true)
+    {
+        auto* glyph = cache->glyphs + idx;
+        if (glyph->key == key || glyph->key == 0) return glyph;
+        idx = (idx + 1) & (GLYPH_CACHE_MAX_GLYPHS - 1);
+    }
+}
+
+static void set_glyph_texture_params()
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Reallocate texture with bigger height and copy old contents at the same place,
+// so glyphs already pushed to render batch stay valid.
+static bool grow_glyph_cache(Glyph_Cache* cache, s32 min_height)
+{
+    if (min_height > cache->max_height) return false;
+
+    s32 new_height = max(min_height, cache->height + cache->height / 2);
+    new_height = min((new_height + 63) & ~63, cache->max_height);
+
+    u32 texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, cache->width, new_height, 0, GL_RED, GL_UNSIGNED_BYTE, null);
+    set_glyph_texture_params();
+
+    const u8 zero = 0;
+    glClearTexImage(texture, 0, GL_RED, GL_UNSIGNED_BYTE, &zero);
+
+    if (cache->texture)
+    {
+        glCopyImageSubData(cache->texture, GL_TEXTURE_2D, 0, 0, 0, 0, texture, GL_TEXTURE_2D, 0, 0, 0, 0, cache->width, cache->height, 1);
+        glDeleteTextures(1, &cache->texture);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
     
-    glGenTextures(1, &atlas->texture_array);
-    rescale_font_atlas(atlas, arena, font, font_size);
+    cache->texture = texture;
+    cache->height = new_height;
+    return true;
 }
 
-void rescale_font_atlas(Font_Atlas* atlas, Arena* arena, const Font* font, s16 font_size)
+void init_glyph_cache(Glyph_Cache* cache, Arena* arena, Font* font, u64 memory_budget, bool sdf)
 {
-    atlas->font_size = font_size;
+    s32 max_texture_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    
+    cache->arena = arena;
+    cache->font = font;
+    cache->glyphs = (Cached_Glyph*)push_zero(arena, GLYPH_CACHE_MAX_GLYPHS * sizeof(Cached_Glyph));
+    cache->shelves = push_array(arena, GLYPH_CACHE_MAX_SHELVES, Glyph_Shelf);
+    cache->texture = 0;
+    cache->frame = 0;
+    cache->glyph_count = 0;
+    cache->shelf_count = 0;
+    cache->width = GLYPH_CACHE_WIDTH;
+    cache->height = 0;
+    cache->max_height = (s32)clamp(memory_budget / GLYPH_CACHE_WIDTH, (u64)GLYPH_CACHE_MIN_HEIGHT, (u64)max_texture_size);
+    cache->sdf_scale = stbtt_ScaleForPixelHeight(font->info, SDF_GLYPH_SIZE);
+    cache->sdf = sdf;
 
-    const u32 charcode_count = atlas->end_charcode - atlas->start_charcode + 1;
-    const f32 scale = stbtt_ScaleForPixelHeight(font->info, (f32)font_size);
-    atlas->px_h_scale = scale;
-    atlas->line_height = (s32)((font->ascent - font->descent + font->line_gap) * scale);
+    grow_glyph_cache(cache, GLYPH_CACHE_MIN_HEIGHT);
+}
+
+// Reinsert glyphs except ones of evicted shelf, ones without bitmap and, if asked, sdf glyphs
+// of exact font size. Glyphs without bitmap take no shelf, so they are dropped on every rebuild
+// as only their metrics are lost. Eviction is rare so full pass is fine.
+static void rebuild_glyph_table(Glyph_Cache* cache, s32 evicted_shelf_idx, bool drop_sdf_sizes)
+{
+    auto* glyphs = push_array(cache->arena, cache->glyph_count, Cached_Glyph);
+    s32 glyph_count = 0;
+    
+    for (s32 i = 0; i < GLYPH_CACHE_MAX_GLYPHS; ++i)
+    {
+        auto* glyph = cache->glyphs + i;
+        if (!glyph->key) continue;
+        
+        const bool evicted = glyph->shelf_idx == evicted_shelf_idx || glyph->shelf_idx == INVALID_INDEX;
+        const bool dropped = drop_sdf_sizes && !(glyph->key & GLYPH_KEY_SDF);
+        if (!evicted && !dropped) glyphs[glyph_count++] = *glyph;
+        
+        glyph->key = 0;
+    }
+
+    for (s32 i = 0; i < glyph_count; ++i)
+        *find_glyph_slot(cache, glyphs[i].key) = glyphs[i];
+
+    pop(cache->arena, cache->glyph_count * sizeof(Cached_Glyph));
+    cache->glyph_count = glyph_count;
+}
+
+// Least recently used shelf of at least given height not touched this frame, INVALID_INDEX
+// if every suitable shelf is in use. Empty shelf is taken right away if it is allowed.
+static s32 lru_glyph_shelf(const Glyph_Cache* cache, s32 min_height, bool allow_empty)
+{
+    s32 lru_idx = INVALID_INDEX;
+    for (s32 i = 0; i < cache->shelf_count; ++i)
+    {
+        const auto* shelf = cache->shelves + i;
+        if (shelf->height < min_height || shelf->last_used_frame == cache->frame) continue;
+        
+        if (shelf->used_width == 0)
+        {
+            if (allow_empty) return i;
+            continue;
+        }
+        
+        if (lru_idx == INVALID_INDEX || shelf->last_used_frame < cache->shelves[lru_idx].last_used_frame)
+            lru_idx = i;
+    }
+
+    return lru_idx;
+}
+
+// Remove glyphs of shelf and clear its pixels.
+static void empty_glyph_shelf(Glyph_Cache* cache, s32 shelf_idx)
+{
+    rebuild_glyph_table(cache, shelf_idx, false);
+
+    // Clear old pixels, otherwise they can bleed into padding of new glyphs.
+    auto* shelf = cache->shelves + shelf_idx;
+    const u8 zero = 0;
+    glClearTexSubImage(cache->texture, 0, 0, shelf->y, 0, cache->width, shelf->height, 1, GL_RED, GL_UNSIGNED_BYTE, &zero);
+    shelf->used_width = 0;
+}
+
+// Shelf for new glyph of given height, empty one or emptied least recently used one.
+static s32 evict_glyph_shelf(Glyph_Cache* cache, s32 min_height)
+{
+    const s32 shelf_idx = lru_glyph_shelf(cache, min_height, true);
+    if (shelf_idx != INVALID_INDEX && cache->shelves[shelf_idx].used_width > 0)
+        empty_glyph_shelf(cache, shelf_idx);
+    
+    return shelf_idx;
+}
+
+static s32 shelf_height(s32 glyph_h)
+{
+    // Round up so glyphs of close heights share shelves.
+    return (glyph_h + GLYPH_PADDING + 3) & ~3;
+}
+
+static s32 new_glyph_shelf(Glyph_Cache* cache, s32 height)
+{
+    if (cache->shelf_count >= GLYPH_CACHE_MAX_SHELVES) return INVALID_INDEX;
+    
+    s32 bottom = 0;
+    if (cache->shelf_count > 0)
+    {
+        const auto* last_shelf = cache->shelves + cache->shelf_count - 1;
+        bottom = last_shelf->y + last_shelf->height;
+    }
+
+    if (bottom + height > cache->height && !grow_glyph_cache(cache, bottom + height))
+        return INVALID_INDEX;
+
+    auto* shelf = cache->shelves + cache->shelf_count;
+    shelf->last_used_frame = cache->frame;
+    shelf->y = (s16)bottom;
+    shelf->height = (s16)height;
+    shelf->used_width = 0;
+    
+    return cache->shelf_count++;
+}
+
+static s32 alloc_glyph_rect(Glyph_Cache* cache, s32 w, s32 h, s16* x, s16* y)
+{
+    const s32 padded_w = w + GLYPH_PADDING;
+    const s32 padded_h = shelf_height(h);
+    if (padded_w > cache->width) return INVALID_INDEX;
+
+    // Take the lowest shelf that fits and does not waste too much height.
+    s32 shelf_idx = INVALID_INDEX;
+    for (s32 i = 0; i < cache->shelf_count; ++i)
+    {
+        const auto* shelf = cache->shelves + i;
+        if (shelf->height < padded_h || shelf->height > padded_h + padded_h / 2) continue;
+        if (shelf->used_width + padded_w > cache->width) continue;
+        if (shelf_idx == INVALID_INDEX || shelf->height < cache->shelves[shelf_idx].height)
+            shelf_idx = i;
+    }
+
+    if (shelf_idx == INVALID_INDEX) shelf_idx = new_glyph_shelf(cache, padded_h);
+    if (shelf_idx == INVALID_INDEX) shelf_idx = evict_glyph_shelf(cache, padded_h);
+    if (shelf_idx == INVALID_INDEX) return INVALID_INDEX;
+
+    auto* shelf = cache->shelves + shelf_idx;
+    *x = shelf->used_width;
+    *y = shelf->y;
+    shelf->used_width += padded_w;
+    shelf->last_used_frame = cache->frame;
+
+    return shelf_idx;
+}
+
+// Make room in hash table, sdf glyphs of exact font size go first as they are cheap to recreate,
+// then glyphs of least recently used shelf that has any. True only if some glyphs were removed,
+// otherwise table would fill up and its lookup would never end.
+static bool free_glyph_slots(Glyph_Cache* cache)
+{
+    const s32 glyph_count = cache->glyph_count;
+    
+    if (cache->sdf)
+    {
+        rebuild_glyph_table(cache, INVALID_INDEX, true);
+        if (cache->glyph_count < glyph_count) return true;
+    }
+
+    const s32 shelf_idx = lru_glyph_shelf(cache, 0, false);
+    if (shelf_idx != INVALID_INDEX) empty_glyph_shelf(cache, shelf_idx);
+    else rebuild_glyph_table(cache, INVALID_INDEX, false);
+
+    return cache->glyph_count < glyph_count;
+}
+
+// Set bitmap box and metrics of glyph, sdf bitmaps are padded by distance field spread.
+static void init_cached_glyph(Cached_Glyph* glyph, const Font* font, u64 key, f32 scale)
+{
+    u32 glyph_index;
+    const Font* glyph_font = get_glyph_font(font, glyph_index_from_key(key), &glyph_index);
+    const f32 font_scale = glyph_font_scale(font, glyph_font, scale);
+    
+    s32 x0, y0, x1, y1;
+    stbtt_GetGlyphBitmapBox(glyph_font->info, glyph_index, font_scale, font_scale, &x0, &y0, &x1, &y1);
+
+    if ((key & GLYPH_KEY_SDF) && x0 != x1 && y0 != y1)
+    {
+        x0 -= SDF_PADDING;
+        y0 -= SDF_PADDING;
+        x1 += SDF_PADDING;
+        y1 += SDF_PADDING;
+    }
+    
+    s32 advance_width = 0;
+    stbtt_GetGlyphHMetrics(glyph_font->info, glyph_index, &advance_width, 0);
+
+    glyph->key = key;
+    glyph->x = 0;
+    glyph->y = 0;
+    glyph->w = (s16)(x1 - x0);
+    glyph->h = (s16)(y1 - y0);
+    glyph->offset_x = (s16)x0;
+    glyph->offset_y = (s16)y0;
+    glyph->advance_width = (s16)(advance_width * font_scale);
+    glyph->shelf_idx = INVALID_INDEX;
+    glyph->bitmap_scale = 1.0f;
+}
+
+// Rasterize glyph into bitmap with given row stride, can be called from any thread.
+static void rasterize_glyph(const Font* font, const Cached_Glyph* glyph, f32 scale, u8* bitmap, s32 stride)
+{
+    u32 glyph_index;
+    const Font* glyph_font = get_glyph_font(font, glyph_index_from_key(glyph->key), &glyph_index);
+    const f32 font_scale = glyph_font_scale(font, glyph_font, scale);
+    
+    if (!(glyph->key & GLYPH_KEY_SDF))
+    {
+        stbtt_MakeGlyphBitmap(glyph_font->info, bitmap, glyph->w, glyph->h, stride, font_scale, font_scale, glyph_index);
+        return;
+    }
+
+    s32 w, h, xoff, yoff;
+    u8* sdf = stbtt_GetGlyphSDF(glyph_font->info, font_scale, glyph_index, SDF_PADDING, SDF_ONEDGE_VALUE, SDF_PIXEL_DIST_SCALE, &w, &h, &xoff, &yoff);
+    if (!sdf) return;
+
+    const s32 row_size = min(w, (s32)glyph->w);
+    for (s32 y = 0; y < min(h, (s32)glyph->h); ++y)
+        memcpy(bitmap + y * stride, sdf + y * w, row_size);
     
-    s32 max_layers;
-    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
-    assert(charcode_count <= (u32)max_layers);
+    stbtt_FreeSDF(sdf, null);
+}
+
+static const Cached_Glyph* find_cached_glyph(Glyph_Cache* cache, u64 key)
+{
+    const Cached_Glyph* glyph = find_glyph_slot(cache, key);
+    if (glyph->key != key) return null;
+    
+    if (glyph->shelf_idx != INVALID_INDEX)
+        cache->shelves[glyph->shelf_idx].last_used_frame = cache->frame;
+    return glyph;
+}
+
+static const Cached_Glyph* insert_glyph(Glyph_Cache* cache, const Cached_Glyph* glyph)
+{
+    auto* slot = find_glyph_slot(cache, glyph->key);
+    *slot = *glyph;
+    cache->glyph_count++;
+    return slot;
+}
+
+static const Cached_Glyph* add_glyph(Glyph_Cache* cache, u64 key, f32 scale)
+{
+    Cached_Glyph glyph;
+    init_cached_glyph(&glyph, cache->font, key, scale);
+    
+    if (glyph.w > 0 && glyph.h > 0)
+    {
+        glyph.shelf_idx = (s16)alloc_glyph_rect(cache, glyph.w, glyph.h, &glyph.x, &glyph.y);
+        if (glyph.shelf_idx == INVALID_INDEX) return null;
+
+        const s32 bitmap_size = glyph.w * glyph.h;
+        u8* bitmap = push_zero(cache->arena, bitmap_size);
+        rasterize_glyph(cache->font, &glyph, scale, bitmap, glyph.w);
+        
+        // stbtt rasterizes glyphs as 8bpp, so tell open gl to use 1 byte per color channel.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, cache->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, glyph.x, glyph.y, glyph.w, glyph.h, GL_RED, GL_UNSIGNED_BYTE, bitmap);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        
+        pop(cache->arena, bitmap_size);
+    }
+
+    // Rect allocation could evict a shelf and rebuild hash table, so look up again.
+    return insert_glyph(cache, &glyph);
+}
+
+const Cached_Glyph* get_glyph(Glyph_Cache* cache, const Font_Atlas* atlas, u32 glyph_index)
+{
+    const u64 key = glyph_key(glyph_index, atlas->font_size);
+    if (const Cached_Glyph* glyph = find_cached_glyph(cache, key)) return glyph;
+
+    // Room for sdf bitmap glyph and its font size entry.
+    if (cache->glyph_count + 2 > GLYPH_CACHE_MAX_GLYPHS / 2 && !free_glyph_slots(cache))
+        return null;
+    
+    if (!cache->sdf) return add_glyph(cache, key, atlas->px_h_scale);
+
+    const u64 sdf_key = sdf_glyph_key(glyph_index);
+    const Cached_Glyph* sdf_glyph = find_cached_glyph(cache, sdf_key);
+    if (!sdf_glyph) sdf_glyph = add_glyph(cache, sdf_key, cache->sdf_scale);
+    if (!sdf_glyph) return null;
+
+    u32 font_glyph_index;
+    const Font* glyph_font = get_glyph_font(cache->font, glyph_index, &font_glyph_index);
+    
+    s32 advance_width = 0;
+    stbtt_GetGlyphHMetrics(glyph_font->info, font_glyph_index, &advance_width, 0);
+    
+    Cached_Glyph glyph = *sdf_glyph;
+    glyph.key = key;
+    glyph.advance_width = (s16)(advance_width * glyph_font_scale(cache->font, glyph_font, atlas->px_h_scale));
+    glyph.bitmap_scale = atlas->px_h_scale / cache->sdf_scale;
+    
+    return insert_glyph(cache, &glyph);
+}
+
+struct Glyph_Bake_Data
+{
+    const Font* font;
+    Cached_Glyph* glyphs;
+    u8* slab; // cache width times height of baked shelves
+    s32 slab_y;
+    s32 slab_w;
+    f32 scale;
+};
+
+static void rasterize_glyph_job(void* data, s32 idx)
+{
+    const auto* bake = (Glyph_Bake_Data*)data;
+    const auto* glyph = bake->glyphs + idx;
+    if (glyph->shelf_idx == INVALID_INDEX) return;
+
+    u8* bitmap = bake->slab + (glyph->y - bake->slab_y) * bake->slab_w + glyph->x;
+    rasterize_glyph(bake->font, glyph, bake->scale, bitmap, bake->slab_w);
+}
+
+static s32 compare_glyph_key(const void* a, const void* b)
+{
+    const u64 key_a = ((const Cached_Glyph*)a)->key;
+    const u64 key_b = ((const Cached_Glyph*)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+static s32 compare_glyph_height_desc(const void* a, const void* b)
+{
+    // Ties are resolved by key, so the same glyphs are always packed the same way.
+    const s32 delta = ((const Cached_Glyph*)b)->h - ((const Cached_Glyph*)a)->h;
+    return delta ? delta : compare_glyph_key(a, b);
+}
+
+// Baked atlases are saved to disk and on next launch their file is mapped and
+// uploaded as is, so neither metrics nor bitmaps are computed again.
+// Bump version whenever file layout, Cached_Glyph or glyph generation changes.
+inline constexpr u32 GLYPH_ATLAS_FILE_MAGIC = 0x53415447; // 'GTAS'
+inline constexpr u32 GLYPH_ATLAS_FILE_VERSION = 2;
+
+// File layout: header, glyphs, shelves, slab of cache width times slab height.
+// Glyph y and shelf index are relative to the first shelf of the slab.
+struct Glyph_Atlas_File_Header
+{
+    u32 magic;
+    u32 version;
+    u64 font_hash;
+    u32 start_charcode;
+    u32 end_charcode;
+    s16 font_size; // SDF_GLYPH_SIZE for distance field atlas
+    s16 sdf_padding; // 0 for bitmap atlas
+    s32 slab_w;
+    s32 slab_h;
+    s32 shelf_count;
+    s32 glyph_count;
+};
+
+struct Glyph_Atlas_File_Shelf
+{
+    s16 height;
+    s16 used_width;
+};
+
+static void glyph_atlas_path(char* path, const Font* font, const Font_Atlas* atlas, bool sdf)
+{
+    const char* extension = sdf ? "sdf" : "glyphs";
+    const s16 font_size = sdf ? SDF_GLYPH_SIZE : atlas->font_size;
+    sprintf(path, DIR_CACHE "%016llx_%d_%u_%u.%s", (unsigned long long)font->hash, font_size, atlas->start_charcode, atlas->end_charcode, extension);
+}
+
+static void init_glyph_atlas_file_header(Glyph_Atlas_File_Header* header, const Glyph_Cache* cache, const Font_Atlas* atlas)
+{
+    header->magic = GLYPH_ATLAS_FILE_MAGIC;
+    header->version = GLYPH_ATLAS_FILE_VERSION;
+    header->font_hash = cache->font->hash;
+    header->start_charcode = atlas->start_charcode;
+    header->end_charcode = atlas->end_charcode;
+    header->font_size = cache->sdf ? SDF_GLYPH_SIZE : atlas->font_size;
+    header->sdf_padding = cache->sdf ? SDF_PADDING : 0;
+    header->slab_w = cache->width;
+    header->slab_h = 0;
+    header->shelf_count = 0;
+    header->glyph_count = 0;
+}
+
+// Map baked atlas file, put its shelves at the bottom of cache and upload slab straight from mapping.
+static bool load_glyph_atlas(Glyph_Cache* cache, const Font_Atlas* atlas)
+{
+    char path[512];
+    glyph_atlas_path(path, cache->font, atlas, cache->sdf);
+
+    Mapped_File file;
+    if (!map_file(&file, path)) return false;
+
+    if (file.size < sizeof(Glyph_Atlas_File_Header))
+    {
+        unmap_file(&file);
+        return false;
+    }
+    
+    Glyph_Atlas_File_Header expected;
+    init_glyph_atlas_file_header(&expected, cache, atlas);
+    
+    const auto* header = (const Glyph_Atlas_File_Header*)file.data;
+    const auto* glyphs = (const Cached_Glyph*)(header + 1);
+    const auto* shelves = (const Glyph_Atlas_File_Shelf*)(glyphs + header->glyph_count);
+    const u8* slab = (const u8*)(shelves + header->shelf_count);
+
+    bool valid = header->magic == expected.magic && header->version == expected.version
+        && header->font_hash == expected.font_hash && header->font_size == expected.font_size
+        && header->start_charcode == expected.start_charcode && header->end_charcode == expected.end_charcode
+        && header->sdf_padding == expected.sdf_padding && header->slab_w == expected.slab_w
+        && header->glyph_count >= 0 && header->shelf_count >= 0 && header->slab_h >= 0
+        && file.size == (u64)(slab - file.data) + (u64)header->slab_w * header->slab_h;
 
-    // stbtt rasterizes glyphs as 8bpp, so tell open gl to use 1 byte per color channel.
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Loaded atlas takes only new shelves, so it must fit without eviction.
+    s32 bottom = 0;
+    if (cache->shelf_count > 0)
+        bottom = cache->shelves[cache->shelf_count - 1].y + cache->shelves[cache->shelf_count - 1].height;
 
-    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas->texture_array);
-    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, atlas->font_size, atlas->font_size, charcode_count, 0, GL_RED, GL_UNSIGNED_BYTE, null);
+    valid = valid && cache->shelf_count + header->shelf_count <= GLYPH_CACHE_MAX_SHELVES
+        && bottom + header->slab_h <= cache->max_height
+        && cache->glyph_count + header->glyph_count <= GLYPH_CACHE_MAX_GLYPHS / 2;
     
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (!valid)
+    {
+        unmap_file(&file);
+        return false;
+    }
+
+    const s32 first_shelf_idx = cache->shelf_count;
+    for (s32 i = 0; i < header->shelf_count; ++i)
+    {
+        const s32 shelf_idx = new_glyph_shelf(cache, shelves[i].height);
+        cache->shelves[shelf_idx].used_width = shelves[i].used_width;
+    }
     
-    u8* bitmap = push(arena, font_size * font_size);    
-    for (u32 i = 0; i < charcode_count; ++i)
+    if (header->slab_h > 0)
     {
-        const u32 c = i + atlas->start_charcode;
-        Font_Glyph_Metric* metric = atlas->metrics + i;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, cache->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, bottom, header->slab_w, header->slab_h, GL_RED, GL_UNSIGNED_BYTE, slab);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    for (s32 i = 0; i < header->glyph_count; ++i)
+    {
+        Cached_Glyph glyph = glyphs[i];
+
+        // Glyph could be rasterized on first use before atlas was baked.
+        if (find_glyph_slot(cache, glyph.key)->key == glyph.key) continue;
         
-        s32 w, h, offx, offy;
-        const s32 glyph_index = stbtt_FindGlyphIndex(font->info, c);
-        u8* stb_bitmap = stbtt_GetGlyphBitmap(font->info, scale, scale, glyph_index, &w, &h, &offx, &offy);
+        if (glyph.shelf_idx != INVALID_INDEX)
+        {
+            glyph.y += (s16)bottom;
+            glyph.shelf_idx += (s16)first_shelf_idx;
+        }
+        
+        insert_glyph(cache, &glyph);
+    }
 
-        // Offset original bitmap to be at center of new one.
-        const s32 x_offset = (font_size - w) / 2;
-        const s32 y_offset = (font_size - h) / 2;
+    unmap_file(&file);
+    return true;
+}
+
+static void save_glyph_atlas(Glyph_Cache* cache, const Font_Atlas* atlas, const Cached_Glyph* glyphs, s32 glyph_count, s32 first_shelf_idx, const u8* slab, s32 slab_y, s32 slab_h)
+{
+    auto* arena = cache->arena;
+    const s32 shelf_count = cache->shelf_count - first_shelf_idx;
+    const u64 slab_size = (u64)cache->width * slab_h;
+    const u64 size = sizeof(Glyph_Atlas_File_Header) + shelf_count * sizeof(Glyph_Atlas_File_Shelf) + glyph_count * sizeof(Cached_Glyph) + slab_size;
+    u8* data = push(arena, size);
+    
+    auto* header = (Glyph_Atlas_File_Header*)data;
+    init_glyph_atlas_file_header(header, cache, atlas);
+    header->slab_h = slab_h;
+    header->shelf_count = shelf_count;
+    header->glyph_count = glyph_count;
 
-        metric->offset_x = offx - x_offset;
-        metric->offset_y = offy - y_offset;
+    auto* file_glyphs = (Cached_Glyph*)(header + 1);
+    for (s32 i = 0; i < glyph_count; ++i)
+    {
+        file_glyphs[i] = glyphs[i];
+        if (file_glyphs[i].shelf_idx == INVALID_INDEX) continue;
         
-        memset(bitmap, 0, font_size * font_size);
+        file_glyphs[i].y -= (s16)slab_y;
+        file_glyphs[i].shelf_idx -= (s16)first_shelf_idx;
+    }
 
-        // @Cleanup: looks nasty, should come up with better solution.
-        // Now we bake bitmap using stbtt and 'rescale' it to font size square one.
-        // Maybe use stbtt_MakeGlyphBitmap at least?
-        for (int y = 0; y < h; ++y)
+    auto* shelves = (Glyph_Atlas_File_Shelf*)(file_glyphs + glyph_count);
+    for (s32 i = 0; i < shelf_count; ++i)
+    {
+        shelves[i].height = cache->shelves[first_shelf_idx + i].height;
+        shelves[i].used_width = cache->shelves[first_shelf_idx + i].used_width;
+    }
+
+    if (slab_size) memcpy(shelves + shelf_count, slab, slab_size);
+
+    char path[512];
+    glyph_atlas_path(path, cache->font, atlas, cache->sdf);
+    overwrite_file(path, data, (s32)size);
+    
+    pop(arena, size);
+}
+
+// Rasterize whole charcode range of atlas up front. Atlas baked on previous launch
+// is loaded from disk, otherwise missing glyphs are packed into new shelves at
+// the bottom of cache, rasterized in parallel into one slab, uploaded at once
+// and saved to disk. Return false if they do not fit without eviction, glyphs
+// are rasterized on first use then. In sdf mode only distance field bitmaps
+// are baked, so each font size after the first one is almost free.
+bool bake_font_atlas(Font_Atlas* atlas, Glyph_Cache* cache, Job_Queue* jobs)
+{
+    const s32 charcode_count = atlas->end_charcode - atlas->start_charcode + 1;
+    if (cache->glyph_count + charcode_count > GLYPH_CACHE_MAX_GLYPHS / 2) return false;
+
+    auto* arena = cache->arena;
+    const u64 arena_used = arena->used;
+    
+    auto* glyphs = push_array(arena, charcode_count, Cached_Glyph);
+    const f32 scale = cache->sdf ? cache->sdf_scale : atlas->px_h_scale;
+    s32 glyph_count = 0;
+    s32 cached_count = 0;
+    
+    for (s32 i = 0; i < charcode_count; ++i)
+    {
+        const u32 glyph_index = get_glyph_index(cache->font, atlas->start_charcode + i);
+        const u64 key = cache->sdf ? sdf_glyph_key(glyph_index) : glyph_key(glyph_index, atlas->font_size);
+        if (find_glyph_slot(cache, key)->key == key)
         {
-            for (int x = 0; x < w; ++x)
-            {
-                int src_index = y * w + x;
-                int dest_index = (y + y_offset) * font_size + (x + x_offset);
-                if (dest_index >= 0 && dest_index < font_size * font_size)
-                    bitmap[dest_index] = stb_bitmap[src_index];
-            }
+            cached_count++;
+            continue;
         }
 
-        stbtt_FreeBitmap(stb_bitmap, null);
+        glyphs[glyph_count++].key = key;
+    }
+
+    // Sdf atlas is shared by all font sizes, so it is usually baked already.
+    if (glyph_count == 0 || load_glyph_atlas(cache, atlas))
+    {
+        pop(arena, arena->used - arena_used);
+        atlas->baked = true;
+        return true;
+    }
+    
+    // Several charcodes can map to the same glyph, keep only one of them.
+    qsort(glyphs, glyph_count, sizeof(Cached_Glyph), compare_glyph_key);
+    
+    s32 unique_count = 0;
+    for (s32 i = 0; i < glyph_count; ++i)
+        if (unique_count == 0 || glyphs[unique_count - 1].key != glyphs[i].key)
+            glyphs[unique_count++] = glyphs[i];
+    glyph_count = unique_count;
+    
+    for (s32 i = 0; i < glyph_count; ++i)
+        init_cached_glyph(glyphs + i, cache->font, glyphs[i].key, scale);
 
-        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, font_size, font_size, 1, GL_RED, GL_UNSIGNED_BYTE, bitmap);
+    // Sort by height, so shelves are filled with glyphs of similar size.
+    qsort(glyphs, glyph_count, sizeof(Cached_Glyph), compare_glyph_height_desc);
 
-        s32 advance_width = 0;
-        stbtt_GetGlyphHMetrics(font->info, glyph_index, &advance_width, 0);
-        metric->advance_width = (s32)(advance_width * scale);
+    const s32 first_shelf_idx = cache->shelf_count;
+    s32 slab_y = cache->height;
+    s32 slab_end_y = 0;
+    s32 shelf_idx = INVALID_INDEX;
+    
+    for (s32 i = 0; i < glyph_count; ++i)
+    {
+        auto* glyph = glyphs + i;
+        if (glyph->w <= 0 || glyph->h <= 0) continue;
+
+        const s32 padded_w = glyph->w + GLYPH_PADDING;
+        if (shelf_idx == INVALID_INDEX || cache->shelves[shelf_idx].used_width + padded_w > cache->width)
+        {
+            shelf_idx = new_glyph_shelf(cache, shelf_height(glyph->h));
+            if (shelf_idx == INVALID_INDEX) break;
+
+            const auto* shelf = cache->shelves + shelf_idx;
+            slab_y = min(slab_y, (s32)shelf->y);
+            slab_end_y = shelf->y + shelf->height;
+        }
+
+        auto* shelf = cache->shelves + shelf_idx;
+        glyph->x = shelf->used_width;
+        glyph->y = shelf->y;
+        glyph->shelf_idx = (s16)shelf_idx;
+        shelf->used_width += padded_w;
+    }
+
+    bool baked = true;
+    for (s32 i = 0; i < glyph_count; ++i)
+    {
+        const auto* glyph = glyphs + i;
+        
+        // Out of space, the rest is going to be rasterized on first use.
+        if (glyph->w > 0 && glyph->h > 0 && glyph->shelf_idx == INVALID_INDEX)
+            baked = false;
+    }
+    
+    const s32 slab_h = max(slab_end_y - slab_y, 0);
+    u8* slab = null;
+    
+    if (slab_h > 0)
+    {
+        Glyph_Bake_Data bake;
+        bake.font = cache->font;
+        bake.glyphs = glyphs;
+        bake.slab = push_zero(arena, (u64)cache->width * slab_h);
+        bake.slab_y = slab_y;
+        bake.slab_w = cache->width;
+        bake.scale = scale;
+
+        run_jobs(jobs, rasterize_glyph_job, &bake, glyph_count);
+        slab = bake.slab;
+
+        // New shelves are fresh rows of texture, so whole strip is uploaded in one call.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, cache->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, slab_y, cache->width, slab_h, GL_RED, GL_UNSIGNED_BYTE, slab);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // Only complete atlas is saved, partial one would be loaded as is on next launch.
+    if (baked && cached_count == 0)
+        save_glyph_atlas(cache, atlas, glyphs, glyph_count, first_shelf_idx, slab, slab_y, slab_h);
+    
+    for (s32 i = 0; i < glyph_count; ++i)
+    {
+        const auto* glyph = glyphs + i;
+        if (glyph->w > 0 && glyph->h > 0 && glyph->shelf_idx == INVALID_INDEX) continue;
+        insert_glyph(cache, glyph);
     }
 
-    pop(arena, font_size * font_size);
+    pop(arena, arena->used - arena_used);
+
+    // Warm up is done once, glyphs that did not fit are handled by get_glyph.
+    atlas->baked = true;
     
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return baked;
+}
+
+void push_glyph(Font_Render_Context* ctx, const Cached_Glyph* glyph, s32 batch_idx, f32 x, f32 y, f32 scale, const vec3* color)
+{
+    const f32 texel_scale = scale * glyph->bitmap_scale;
+    const f32 gw = glyph->w * texel_scale;
+    const f32 gh = glyph->h * texel_scale;
+    const f32 gx = x + glyph->offset_x * texel_scale;
+    const f32 gy = y - (glyph->h + glyph->offset_y) * texel_scale;
+
+    mat4* transform = ctx->transforms + batch_idx;
+    identity(transform);
+    translate(transform, vec3{gx, gy, 0.0f});
+    ::scale(transform, vec3{gw, gh, 0.0f});
+
+    ctx->glyph_rects[batch_idx] = vec4{(f32)glyph->x, (f32)glyph->y, (f32)glyph->w, (f32)glyph->h};
+    ctx->glyph_colors[batch_idx] = *color;
+}
+
+void render_glyph_batch(const Font_Render_Context* ctx, const Glyph_Cache* cache, s32 count)
+{
+    if (count == 0) return;
 
-    // Restore default color channel size.
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);    
+    // Cache texture could be reallocated by growth since last batch.
+    glBindTexture(GL_TEXTURE_2D, cache->texture);
+    glUniformMatrix4fv(ctx->u_transforms, count, GL_FALSE, (f32*)ctx->transforms);
+    glUniform4fv(ctx->u_glyph_rects, count, (f32*)ctx->glyph_rects);
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->color_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(vec3), ctx->glyph_colors);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
 }
 
-void render_text(const Font_Render_Context* ctx, const Font_Atlas* atlas, const char* text, u32 size, f32 scale, f32 x, f32 y, f32 r, f32 g, f32 b)
+void render_text(Font_Render_Context* ctx, Glyph_Cache* cache, const Font_Atlas* atlas, const char* text, u32 size, f32 scale, f32 x, f32 y, f32 r, f32 g, f32 b)
 {
     glUseProgram(ctx->program);
     glBindVertexArray(ctx->vao);
     glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas->texture_array);
     
     glActiveTexture(GL_TEXTURE0);
-    glUniform3f(glGetUniformLocation(ctx->program, "u_text_color"), r, g, b);
 
+    const vec3 color = {r, g, b};
     s32 work_idx = 0;
     f32 x_pos = x;
     f32 y_pos = y;
     
-    for (u32 i = 0; i < size; ++i)
+    for (u32 i = 0; i < size;)
     {
-        const char c = text[i];
+        const u8 c = text[i];
         
         if (c == '\n')
         {
             x_pos = x;
             y_pos -= atlas->line_height * scale;
+            i++;
             continue;
         }
-        
-        assert((u32)c >= atlas->start_charcode);
-        assert((u32)c <= atlas->end_charcode);
 
-        const u32 ci = c - atlas->start_charcode; // correctly shifted index
-        const Font_Glyph_Metric* metric = atlas->metrics + ci;
-        
-        if (c == ' ')
-        {
-            x_pos += metric->advance_width * scale;
-            continue;
-        }
+        s32 sequence_size;
+        const u32 codepoint = next_codepoint(text + i, (s32)(size - i), &sequence_size);
+        i += sequence_size;
         
-        const f32 gw = (f32)atlas->font_size * scale;
-        const f32 gh = (f32)atlas->font_size * scale;
-        const f32 gx = x_pos + metric->offset_x * scale;
-        const f32 gy = y_pos - (gh + metric->offset_y) * scale;
+        const Cached_Glyph* glyph = get_glyph(cache, atlas, get_glyph_index(cache->font, codepoint));
+        if (!glyph) continue;
         
-        mat4* transform = ctx->transforms + work_idx;
-        identity(transform);
-        translate(transform, vec3{gx, gy, 0.0f});
-        ::scale(transform, vec3{gw, gh, 0.0f});
-
-        ctx->charmap[work_idx] = ci;
-
-        if (++work_idx >= FONT_RENDER_BATCH_SIZE)
+        if (glyph->shelf_idx != INVALID_INDEX)
         {
-            glUniformMatrix4fv(glGetUniformLocation(ctx->program, "u_transforms"), work_idx, GL_FALSE, (f32*)ctx->transforms);
-            glUniform1uiv(glGetUniformLocation(ctx->program, "u_charmap"), work_idx, ctx->charmap);
-            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, work_idx);
-            work_idx = 0;
+            push_glyph(ctx, glyph, work_idx, x_pos, y_pos, scale, &color);
+
+            if (++work_idx >= FONT_RENDER_BATCH_SIZE)
+            {
+                render_glyph_batch(ctx, cache, work_idx);
+                work_idx = 0;
+            }
         }
 
-        x_pos += metric->advance_width * scale;
+        x_pos += glyph->advance_width * scale;
     }
 
-    glUniformMatrix4fv(glGetUniformLocation(ctx->program, "u_transforms"), work_idx, GL_FALSE, (f32*)ctx->transforms);
-    glUniform1uiv(glGetUniformLocation(ctx->program, "u_charmap"), work_idx, ctx->charmap);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, work_idx);
+    render_glyph_batch(ctx, cache, work_idx);
     
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glUseProgram(0);
@@ -1,38 +1,117 @@
 #pragma once
 
+#include "file.h"
+
 // Size of batch for text glyphs to render.
 // Must be the same as in shaders.
 inline constexpr s16 FONT_RENDER_BATCH_SIZE = 128;
 
+// Direct mapped codepoint to glyph id cache, must be power of two.
+inline constexpr s32 FONT_CHARMAP_CACHE_SIZE = 1024;
+
+// Glyph id keeps glyph index in low bits and index of font in fallback chain above,
+// 0 for primary font, so glyph ids of primary font are plain glyph indices.
+inline constexpr u32 FONT_GLYPH_INDEX_BITS = 16;
+inline constexpr s32 MAX_FALLBACK_FONTS = 8;
+
+// Glyph cache texture keeps fixed width and grows in height up to memory budget.
+inline constexpr s32 GLYPH_CACHE_WIDTH = 1024;
+inline constexpr s32 GLYPH_CACHE_MIN_HEIGHT = 128;
+inline constexpr s32 GLYPH_CACHE_MAX_GLYPHS = 8192; // hash table capacity, must be power of two
+inline constexpr s32 GLYPH_CACHE_MAX_SHELVES = 1024;
+inline constexpr s32 GLYPH_PADDING = 1; // empty texels between glyphs so linear filtering does not bleed
+
+// Signed distance field glyphs are generated once at reference size and scaled to any font size.
+inline constexpr s16 SDF_GLYPH_SIZE = 48;
+inline constexpr s32 SDF_PADDING = 6; // texels of distance around glyph outline
+inline constexpr u8  SDF_ONEDGE_VALUE = 128; // must be the same as edge value in text_batch_2d_sdf.fs
+inline constexpr f32 SDF_PIXEL_DIST_SCALE = (f32)SDF_ONEDGE_VALUE / SDF_PADDING;
+
 struct Arena;
+struct Job_Queue;
 struct mat4;
+struct vec3;
+struct vec4;
 struct Gap_Buffer;
 
+struct Font_Charmap_Entry
+{
+    u32 codepoint;
+    u32 glyph_index;
+};
+
+// Font file stays mapped, so its bytes are never copied. Fallback fonts are tried
+// in order for codepoints missing in primary one and are loaded on first miss.
 struct Font
 {
     struct stbtt_fontinfo* info;
+    const char* path;
+    Mapped_File file;
+    Font_Charmap_Entry* charmap_cache; // resolved glyph ids, primary font only
+    Font* fallbacks;
+    s32 fallback_count;
+    bool loaded;
+    bool missing; // failed to load, skipped in fallback chain
+    u64 hash; // of font file identity and fallback chain
+    s32 monospace_advance; // unscaled advance shared by all printable ascii glyphs, 0 for proportional font
     // Unscaled font vertical params, scale by px_h_scale from Font_Atlas.
     s32 ascent;
     s32 descent;
     s32 line_gap;
 };
 
-struct Font_Glyph_Metric
-{
-    s32 offset_x;
-    s32 offset_y;
-    s32 advance_width; // already scaled
-};
-
+// Size specific font params, glyphs themselves live in Glyph_Cache.
 struct Font_Atlas
 {
-    Font_Glyph_Metric* metrics;
-    u32 texture_array;
-    u32 start_charcode;
+    u32 start_charcode; // range of glyphs to rasterize up front when atlas is baked
     u32 end_charcode;
     f32 px_h_scale;
     s32 line_height;
-    s16 font_size; // size of glyph square bitmap
+    s16 font_size;
+    s16 monospace_advance; // scaled like advance of cached glyph, 0 for proportional font
+    bool baked;
+};
+
+struct Cached_Glyph
+{
+    u64 key; // 0 if hash table slot is free
+    s16 x; // position of glyph bitmap in cache texture
+    s16 y;
+    s16 w;
+    s16 h;
+    s16 offset_x; // bitmap offset from pen position, y goes down
+    s16 offset_y;
+    s16 advance_width; // already scaled
+    s16 shelf_idx; // INVALID_INDEX for glyphs without bitmap like space
+    f32 bitmap_scale; // screen pixels per texel, sdf glyphs of all sizes share one bitmap
+};
+
+struct Glyph_Shelf
+{
+    u32 last_used_frame;
+    s16 y;
+    s16 height;
+    s16 used_width;
+};
+
+// Dynamic glyph atlas, glyphs of any font size are rasterized on first use and
+// packed into shelves of one 2D texture, least recently used shelf is evicted when full.
+// In sdf mode each glyph has one distance field bitmap and only metrics per font size.
+struct Glyph_Cache
+{
+    Arena* arena; // scratch memory for rasterization
+    Font* font;
+    Cached_Glyph* glyphs; // open addressing hash table keyed by (glyph index, font size)
+    Glyph_Shelf* shelves;
+    u32 texture;
+    u32 frame; // shelves used during current frame are never evicted
+    s32 glyph_count;
+    s32 shelf_count;
+    s32 width;
+    s32 height;
+    s32 max_height;
+    f32 sdf_scale; // font scale of reference sdf glyph size
+    bool sdf;
 };
 
 struct Font_Render_Context
@@ -40,15 +119,26 @@ struct Font_Render_Context
     u32 program;
     u32 vao;
     u32 vbo;
-    u32 u_charmap;
+    u32 color_vbo; // per instance glyph colors
+    u32 u_glyph_rects;
     u32 u_transforms;
-    u32 u_text_color;
-    u32* charmap;
+    vec4* glyph_rects;
     mat4* transforms;
+    vec3* glyph_colors;
 };
 
-void init_font(Font* font, Arena* arena, const char* path);
-void init_font_render_context(Font_Render_Context* ctx, Arena* arena, s32 win_w, s32 win_h);
-void bake_font_atlas(Font_Atlas* atlas, Arena* arena, const Font* font, u32 start_charcode, u32 end_charcode, s16 font_size);
-void rescale_font_atlas(Font_Atlas* atlas, Arena* arena, const Font* font, s16 font_size);
-void render_text(const Font_Render_Context* ctx, const Font_Atlas* atlas, const char* text, u32 size, f32 scale, f32 x, f32 y, f32 r, f32 g, f32 b);
+bool init_font(Font* font, Arena* arena, const char* path);
+void add_fallback_font(Font* font, Arena* arena, const char* path);
+u32 get_glyph_index(Font* font, u32 codepoint); // glyph id, primary or fallback font
+const Font* get_glyph_font(const Font* font, u32 glyph_id, u32* glyph_index); // font of glyph id in chain and glyph index in it
+s32 get_glyph_advance(const Font* font, const Font_Atlas* atlas, u32 glyph_id); // the same as advance of cached glyph
+f32 get_glyph_kern_advance(const Font* font, const Font_Atlas* atlas, u32 glyph_id_a, u32 glyph_id_b); // kern or GPOS pair adjustment
+const u8* get_font_table(const Font* font, const char* tag); // raw table data, null if font has none
+void init_font_render_context(Font_Render_Context* ctx, Arena* arena, s32 win_w, s32 win_h, bool sdf);
+void init_font_atlas(Font_Atlas* atlas, const Font* font, u32 start_charcode, u32 end_charcode, s16 font_size);
+void init_glyph_cache(Glyph_Cache* cache, Arena* arena, Font* font, u64 memory_budget, bool sdf);
+const Cached_Glyph* get_glyph(Glyph_Cache* cache, const Font_Atlas* atlas, u32 glyph_index); // null if does not fit
+bool bake_font_atlas(Font_Atlas* atlas, Glyph_Cache* cache, Job_Queue* jobs);
+void push_glyph(Font_Render_Context* ctx, const Cached_Glyph* glyph, s32 batch_idx, f32 x, f32 y, f32 scale, const vec3* color);
+void render_glyph_batch(const Font_Render_Context* ctx, const Glyph_Cache* cache, s32 count);
+void render_text(Font_Render_Context* ctx, Glyph_Cache* cache, const Font_Atlas* atlas, const char* text, u32 size, f32 scale, f32 x, f32 y, f32 r, f32 g, f32 b);
@@ -0,0 +1,159 @@
+#include "pch.h"
+#include "font_bench.h"
+#include "font.h"
+#include "my_font.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vendor/stb_truetype.h>
+#include <glfw/glfw3.h>
+
+// Rasterize printable ascii glyphs with stbtt and my_font at several sizes,
+// print time per glyph and how much bitmaps differ.
+void bench_glyph_rasterizers(Arena* arena, const Font* font)
+{
+    constexpr s32 ITERATION_COUNT = 64;
+    constexpr u32 FIRST_CHARCODE = 33;
+    constexpr u32 LAST_CHARCODE = 126;
+    constexpr s32 GLYPH_COUNT = LAST_CHARCODE - FIRST_CHARCODE + 1;
+    
+    const u64 arena_used = arena->used;
+    
+    Font_Face face;
+    if (!init_font_face(arena, font->path, &face)) return;
+
+    const f32 pixel_heights[] = { 12.0f, 24.0f, 48.0f, 96.0f };
+    for (f32 pixel_height : pixel_heights)
+    {
+        const f32 scale = stbtt_ScaleForPixelHeight(font->info, pixel_height);
+        
+        u16 glyph_indices[GLYPH_COUNT];
+        s32 boxes[GLYPH_COUNT][4];
+        s32 max_bitmap_size = 0;
+        
+        for (s32 i = 0; i < GLYPH_COUNT; ++i)
+        {
+            glyph_indices[i] = (u16)stbtt_FindGlyphIndex(font->info, FIRST_CHARCODE + i);
+            
+            s32* box = boxes[i];
+            stbtt_GetGlyphBitmapBox(font->info, glyph_indices[i], scale, scale, box + 0, box + 1, box + 2, box + 3);
+            max_bitmap_size = max(max_bitmap_size, (box[2] - box[0]) * (box[3] - box[1]));
+        }
+
+        u8* stb_bitmap = push_zero(arena, max_bitmap_size);
+        u8* my_bitmap = push_zero(arena, max_bitmap_size);
+
+        f64 start = glfwGetTime();
+        for (s32 iteration = 0; iteration < ITERATION_COUNT; ++iteration)
+        {
+            for (s32 i = 0; i < GLYPH_COUNT; ++i)
+            {
+                const s32 w = boxes[i][2] - boxes[i][0];
+                const s32 h = boxes[i][3] - boxes[i][1];
+                stbtt_MakeGlyphBitmap(font->info, stb_bitmap, w, h, w, scale, scale, glyph_indices[i]);
+            }
+        }
+        const f64 stb_time = glfwGetTime() - start;
+
+        start = glfwGetTime();
+        for (s32 iteration = 0; iteration < ITERATION_COUNT; ++iteration)
+        {
+            for (s32 i = 0; i < GLYPH_COUNT; ++i)
+            {
+                const s32 w = boxes[i][2] - boxes[i][0];
+                const s32 h = boxes[i][3] - boxes[i][1];
+                make_glyph_bitmap(&face, arena, my_bitmap, w, h, w, scale, scale, glyph_indices[i]);
+            }
+        }
+        const f64 my_time = glfwGetTime() - start;
+
+        // Outlines are decoded once at first size, other sizes skip glyf parsing.
+        start = glfwGetTime();
+        for (s32 iteration = 0; iteration < ITERATION_COUNT; ++iteration)
+        {
+            for (s32 i = 0; i < GLYPH_COUNT; ++i)
+            {
+                const s32 w = boxes[i][2] - boxes[i][0];
+                const s32 h = boxes[i][3] - boxes[i][1];
+                const Glyph_Slot* outline = get_glyph_outline(&face, glyph_indices[i]);
+                if (outline) make_outline_bitmap(outline, arena, my_bitmap, w, h, w, scale, scale);
+            }
+        }
+        const f64 cached_time = glfwGetTime() - start;
+
+        u64 diff_sum = 0;
+        u64 pixel_count = 0;
+        s32 max_diff = 0;
+        
+        for (s32 i = 0; i < GLYPH_COUNT; ++i)
+        {
+            const s32 w = boxes[i][2] - boxes[i][0];
+            const s32 h = boxes[i][3] - boxes[i][1];
+            stbtt_MakeGlyphBitmap(font->info, stb_bitmap, w, h, w, scale, scale, glyph_indices[i]);
+            make_glyph_bitmap(&face, arena, my_bitmap, w, h, w, scale, scale, glyph_indices[i]);
+
+            for (s32 j = 0; j < w * h; ++j)
+            {
+                const s32 diff = abs(stb_bitmap[j] - my_bitmap[j]);
+                diff_sum += diff;
+                max_diff = max(max_diff, diff);
+            }
+            
+            pixel_count += w * h;
+        }
+
+        const f64 glyph_count = (f64)ITERATION_COUNT * GLYPH_COUNT;
+        printf("Rasterizer bench (%.0fpx): stbtt %.2fus/glyph, my_font %.2fus/glyph, cached outline %.2fus/glyph, mean diff %.3f, max diff %d\n",
+               pixel_height, stb_time * 1000000.0 / glyph_count, my_time * 1000000.0 / glyph_count, cached_time * 1000000.0 / glyph_count,
+               pixel_count ? (f64)diff_sum / pixel_count : 0.0, max_diff);
+
+        pop(arena, 2 * max_bitmap_size);
+    }
+
+    close_font_face(&face);
+    pop(arena, arena->used - arena_used);
+}
+
+// Look up every codepoint of basic plane and first supplementary one
+// with page table or binary search and with plain cmap scan.
+void bench_cmap_lookup(Arena* arena, const Font* font)
+{
+    constexpr s32 ITERATION_COUNT = 4;
+    constexpr u32 CODEPOINT_COUNT = 0x20000;
+    
+    const u64 arena_used = arena->used;
+    
+    f64 start = glfwGetTime();
+    Font_Face face;
+    if (!init_font_face(arena, font->path, &face)) return;
+    const f64 init_time = glfwGetTime() - start;
+
+    u32 checksum = 0;
+    start = glfwGetTime();
+    for (s32 iteration = 0; iteration < ITERATION_COUNT; ++iteration)
+        for (u32 c = 0; c < CODEPOINT_COUNT; ++c)
+            checksum += get_glyph_index(&face, c);
+    const f64 table_time = glfwGetTime() - start;
+    
+    start = glfwGetTime();
+    for (s32 iteration = 0; iteration < ITERATION_COUNT; ++iteration)
+        for (u32 c = 0; c < CODEPOINT_COUNT; ++c)
+            checksum -= get_glyph_index_scan(&face, c);
+    const f64 scan_time = glfwGetTime() - start;
+
+    u32 mismatch_count = 0;
+    for (u32 c = 0; c < CODEPOINT_COUNT; ++c)
+        if (get_glyph_index(&face, c) != get_glyph_index_scan(&face, c))
+            mismatch_count++;
+
+    const auto* dir = face.dir;
+    const u32 range_count = dir->format_type == 4 ? dir->f4->seg_count_x2 / 2 : dir->format_type == 12 ? dir->f12->n_groups : 0;
+    const f64 lookup_count = (f64)ITERATION_COUNT * CODEPOINT_COUNT;
+    
+    printf("Cmap bench (format %u, %u ranges): init %.3fms, table %.2fns/lookup, scan %.2fns/lookup, mismatches %u, checksum %u\n",
+           dir->format_type, range_count, init_time * 1000.0, table_time * 1000000000.0 / lookup_count, scan_time * 1000000000.0 / lookup_count,
+           mismatch_count, checksum);
+
+    close_font_face(&face);
+    pop(arena, arena->used - arena_used);
+}
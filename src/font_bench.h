@@ -0,0 +1,8 @@
+#pragma once
+
+struct Arena;
+struct Font;
+
+// Debug benchmarks of font code, results are printed to stdout.
+void bench_glyph_rasterizers(Arena* arena, const Font* font);
+void bench_cmap_lookup(Arena* arena, const Font* font);
@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "gap_buffer.h"
 #include "arena.h"
+#include "utf8.h"
+#include "simd.h"
 #include <stdio.h>
 #include <malloc.h>
 
@@ -61,6 +63,30 @@ char char_before_pointer(const Gap_Buffer* buffer)
     return char_at(buffer, max(0, pos - 1));
 }
 
+u32 codepoint_at(const Gap_Buffer* buffer, s32 pos, s32* size)
+{
+    u8 bytes[4];
+    bytes[0] = (u8)char_at(buffer, pos);
+    
+    s32 sequence_size = utf8_sequence_size(bytes[0]);
+    if (pos + sequence_size > data_size(buffer)) sequence_size = 1;
+
+    for (s32 i = 1; i < sequence_size; ++i)
+    {
+        bytes[i] = (u8)char_at(buffer, pos + i);
+
+        // Broken sequence, lead byte is shown as replacement char on its own.
+        if (!is_utf8_continuation(bytes[i]))
+        {
+            *size = 1;
+            return UTF8_REPLACEMENT_CHAR;
+        }
+    }
+
+    *size = sequence_size;
+    return decode_utf8(bytes, sequence_size);
+}
+
 void init_gap_buffer(Gap_Buffer* buffer, s32 size)
 {
     const s32 total_size = size + GAP_EXPAND_SIZE;
@@ -80,16 +106,18 @@ void free(Gap_Buffer* buffer)
 
 void expand(Gap_Buffer* buffer, s32 extra_size)
 {
-    const char* old_start = buffer->start;
+    // Positions are kept as offsets, realloc may move block anywhere in address space.
+    const s32 pointer = (s32)(buffer->pointer - buffer->start);
+    const s32 gap_start = prefix_data_size(buffer);
+    const s32 gap_end = (s32)(buffer->gap_end - buffer->start);
     const s32 add_size = extra_size + GAP_EXPAND_SIZE;
-    const s32 new_size = total_data_size(buffer) + add_size;
-    buffer->start = (char*)realloc(buffer->start, new_size);
+    const s32 old_size = total_data_size(buffer);
+    buffer->start = (char*)realloc(buffer->start, old_size + add_size);
 
-    const s32 offset = (s32)(buffer->start - old_start);
-    buffer->end += offset;
-    buffer->pointer += offset;
-    buffer->gap_start += offset;
-    buffer->gap_end += offset;
+    buffer->end = buffer->start + old_size;
+    buffer->pointer = buffer->start + pointer;
+    buffer->gap_start = buffer->start + gap_start;
+    buffer->gap_end = buffer->start + gap_end;
 
     memmove(buffer->gap_end + add_size, buffer->gap_end, buffer->end - buffer->gap_end);
     buffer->end += add_size;
@@ -125,9 +153,8 @@ void push_str(Gap_Buffer* buffer, const char* str, s32 size)
     move_gap_to_pointer(buffer);
     if (size > gap_data_size(buffer)) expand(buffer, size);
 
-    for (s32 i = 0; i < size; ++i)
-        *buffer->gap_start++ = str[i];
-    
+    memcpy(buffer->gap_start, str, size);
+    buffer->gap_start += size;
     buffer->pointer = buffer->gap_start;
 }
 
@@ -147,6 +174,160 @@ char delete_char_overwrite(Gap_Buffer* buffer)
     return *buffer->gap_end++;
 }
 
+// Gap is moved to range end if it is past it, to range start if it is before it, and is just
+// widened over range if it is inside, so range itself is never copied.
+void delete_range(Gap_Buffer* buffer, s32 start, s32 end)
+{
+    assert(start >= 0);
+    assert(start <= end);
+    assert(end <= data_size(buffer));
+
+    const s32 prefix_size = prefix_data_size(buffer);
+    if (prefix_size >= end)
+    {
+        // Gap is after range, data between range end and gap is moved.
+        set_pointer(buffer, end);
+        move_gap_to_pointer(buffer);
+        buffer->gap_start -= end - start;
+    }
+    else if (prefix_size <= start)
+    {
+        // Gap is before range, data between gap and range start is moved.
+        set_pointer(buffer, start);
+        move_gap_to_pointer(buffer);
+        buffer->gap_end += end - start;
+    }
+    else
+    {
+        // Gap is inside range, it is widened over range on both sides without moving data.
+        buffer->gap_start = buffer->start + start;
+        buffer->gap_end += end - prefix_size;
+    }
+
+    buffer->pointer = buffer->gap_start;
+}
+
+// Pointer is left after inserted string.
+void replace_range(Gap_Buffer* buffer, s32 start, s32 end, const char* str, s32 size)
+{
+    delete_range(buffer, start, end);
+    if (size > gap_data_size(buffer)) expand(buffer, size);
+
+    memcpy(buffer->gap_start, str, size);
+    buffer->gap_start += size;
+    buffer->pointer = buffer->gap_start;
+}
+
+// Replace each range [starts[i], ends[i]) with string. Gap is moved to first range start once,
+// then data between ranges is moved over the gap in one sweep, so all edits cost one pass over
+// span between first and last range. Ranges must be sorted, inside buffer and must not overlap,
+// pointer is left after last inserted string.
+void replace_ranges(Gap_Buffer* buffer, const s32* starts, const s32* ends, s32 count, const char* str, s32 size)
+{
+    if (count == 0) return;
+
+    set_pointer(buffer, starts[0]);
+    move_gap_to_pointer(buffer);
+
+    // Gap only shrinks by string sizes, deleted bytes are added to it on the way.
+    if (count * size > gap_data_size(buffer)) expand(buffer, count * size);
+    
+    for (s32 i = 0; i < count; ++i)
+    {
+        buffer->gap_end += ends[i] - starts[i];
+        memcpy(buffer->gap_start, str, size);
+        buffer->gap_start += size;
+
+        if (i + 1 < count)
+        {
+            const s32 move_size = starts[i + 1] - ends[i];
+            assert(move_size >= 0);
+            
+            memmove(buffer->gap_start, buffer->gap_end, move_size);
+            buffer->gap_start += move_size;
+            buffer->gap_end += move_size;
+        }
+    }
+
+    buffer->pointer = buffer->gap_start;
+}
+
+void copy_data(const Gap_Buffer* buffer, s32 pos, s32 size, char* data)
+{
+    assert(pos >= 0);
+    assert(pos + size <= data_size(buffer));
+
+    const s32 prefix_size = prefix_data_size(buffer);
+    const s32 before_gap_size = clamp(prefix_size - pos, 0, size);
+    memcpy(data, buffer->start + pos, before_gap_size);
+
+    const s32 after_gap_pos = pos + before_gap_size - prefix_size;
+    memcpy(data + before_gap_size, buffer->gap_end + after_gap_pos, size - before_gap_size);
+}
+
+s32 count_char(const Gap_Buffer* buffer, s32 pos, s32 size, char c)
+{
+    assert(pos >= 0);
+    assert(pos + size <= data_size(buffer));
+    
+    const s32 prefix_size = prefix_data_size(buffer);
+    const s32 before_gap_size = clamp(prefix_size - pos, 0, size);
+    const s32 after_gap_pos = pos + before_gap_size - prefix_size;
+    
+    return count_byte(buffer->start + pos, before_gap_size, c) + count_byte(buffer->gap_end + after_gap_pos, size - before_gap_size, c);
+}
+
+s32 step_chars(const Gap_Buffer* buffer, s32 pos, s32 delta)
+{
+    const s32 size = data_size(buffer);
+    
+    for (; delta > 0 && pos < size; --delta)
+    {
+        pos++;
+        while (pos < size && is_utf8_continuation(char_at(buffer, pos))) pos++;
+    }
+    
+    for (; delta < 0 && pos > 0; ++delta)
+    {
+        pos--;
+        while (pos > 0 && is_utf8_continuation(char_at(buffer, pos))) pos--;
+    }
+
+    return pos;
+}
+
+s32 find_char(const Gap_Buffer* buffer, s32 pos, s32 size, char c)
+{
+    assert(pos >= 0);
+    assert(pos + size <= data_size(buffer));
+
+    const s32 prefix_size = prefix_data_size(buffer);
+    const s32 before_gap_size = clamp(prefix_size - pos, 0, size);
+    const s32 before_gap_idx = find_either_byte(buffer->start + pos, 0, before_gap_size, c, c);
+    if (before_gap_idx < before_gap_size) return pos + before_gap_idx;
+
+    const s32 after_gap_pos = pos + before_gap_size - prefix_size;
+    return pos + before_gap_size + find_either_byte(buffer->gap_end + after_gap_pos, 0, size - before_gap_size, c, c);
+}
+
+// Gap is moved to range end, so range is one piece and first gap byte can hold terminator.
+// Only data between gap and range is moved, range itself is never copied. Pointer stays.
+const char* contiguous_string(Gap_Buffer* buffer, s32 pos, s32 size)
+{
+    assert(pos >= 0);
+    assert(pos + size <= data_size(buffer));
+
+    const s32 pointer = pointer_pos(buffer);
+    set_pointer(buffer, pos + size);
+    move_gap_to_pointer(buffer);
+    if (buffer->gap_start == buffer->gap_end) expand(buffer);
+
+    *buffer->gap_start = '\0';
+    set_pointer(buffer, pointer);
+    
+    return buffer->start + pos;
+}
+
 s32 fill_utf8(const Gap_Buffer* buffer, char* data)
 {
     const s32 prefix_size = prefix_data_size(buffer);
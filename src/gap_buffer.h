@@ -23,6 +23,12 @@ s32 suffix_data_size(const Gap_Buffer* buffer);
 char char_at(const Gap_Buffer* buffer, s32 pos);
 char char_at_pointer(const Gap_Buffer* buffer); // be care of pointer == gap_start
 char char_before_pointer(const Gap_Buffer* buffer);
+u32 codepoint_at(const Gap_Buffer* buffer, s32 pos, s32* size); // decode utf8 sequence starting at pos
+void copy_data(const Gap_Buffer* buffer, s32 pos, s32 size, char* data); // contiguous copy of data range, gap is skipped
+s32 count_char(const Gap_Buffer* buffer, s32 pos, s32 size, char c); // in data range, gap is skipped
+s32 step_chars(const Gap_Buffer* buffer, s32 pos, s32 delta); // position delta utf8 chars away, clamped to data
+s32 find_char(const Gap_Buffer* buffer, s32 pos, s32 size, char c); // position of first c in data range, pos + size if there is none
+const char* contiguous_string(Gap_Buffer* buffer, s32 pos, s32 size); // data range in place with terminator in gap, valid until next change
 
 void init_gap_buffer(Gap_Buffer* buffer, s32 size);
 void free(Gap_Buffer* buffer);
@@ -33,6 +39,9 @@ void push_char(Gap_Buffer* buffer, char c);
 void push_str(Gap_Buffer* buffer, const char* str, s32 size);
 char delete_char(Gap_Buffer* buffer);
 char delete_char_overwrite(Gap_Buffer* buffer);
+void delete_range(Gap_Buffer* buffer, s32 start, s32 end); // at most one gap move, then gap is widened over range
+void replace_range(Gap_Buffer* buffer, s32 start, s32 end, const char* str, s32 size);
+void replace_ranges(Gap_Buffer* buffer, const s32* starts, const s32* ends, s32 count, const char* str, s32 size); // sorted disjoint ranges are replaced with the same string in one sweep
 
 void move_gap_to_pointer(Gap_Buffer* buffer);
 
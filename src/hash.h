@@ -0,0 +1,14 @@
+#pragma once
+
+inline constexpr u64 FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+
+// FNV-1a, previous hash can be passed to continue hashing.
+inline u64 hash_bytes(const u8* data, u64 size, u64 hash = FNV_OFFSET_BASIS)
+{
+    for (u64 i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
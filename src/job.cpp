@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "job.h"
+#include <windows.h>
+
+#ifndef WIN32
+#error "Only win32 is supported for now"
+#endif
+
+static DWORD WINAPI job_worker_proc(LPVOID param)
+{
+    auto* queue = (Job_Queue*)param;
+    while (true)
+    {
+        if (!do_next_job(queue))
+            WaitForSingleObject(queue->semaphore, INFINITE);
+    }
+}
+
+s32 cpu_core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (s32)info.dwNumberOfProcessors;
+}
+
+void init_job_queue(Job_Queue* queue, s32 worker_count)
+{
+    queue->next_write_idx = 0;
+    queue->next_read_idx = 0;
+    queue->worker_count = worker_count;
+    queue->semaphore = CreateSemaphoreA(null, 0, max(worker_count, 1), null);
+
+    for (s32 i = 0; i < worker_count; ++i)
+    {
+        HANDLE thread = CreateThread(null, 0, job_worker_proc, queue, 0, null);
+        CloseHandle(thread);
+    }
+}
+
+void push_job(Job_Queue* queue, Job_Batch* batch, Job_Proc proc, void* data, s32 idx)
+{
+    const u32 new_next_write_idx = (queue->next_write_idx + 1) & (JOB_QUEUE_SIZE - 1);
+
+    // Queue is full, help workers instead of overwriting jobs in flight.
+    while (new_next_write_idx == queue->next_read_idx)
+        do_next_job(queue);
+    
+    Job* job = queue->jobs + queue->next_write_idx;
+    job->proc = proc;
+    job->data = data;
+    job->batch = batch;
+    job->idx = idx;
+
+    InterlockedIncrement((volatile LONG*)&batch->pending_count);
+
+    // Job must be completely written before it becomes visible to workers.
+    _ReadWriteBarrier();
+    queue->next_write_idx = new_next_write_idx;
+    ReleaseSemaphore(queue->semaphore, 1, null);
+}
+
+bool do_next_job(Job_Queue* queue)
+{
+    const u32 read_idx = queue->next_read_idx;
+    if (read_idx == queue->next_write_idx) return false;
+
+    // Job is copied while its slot is still owned by queue, once read index moves past it
+    // producer may overwrite slot. Copy is used only if this thread wins the slot.
+    _ReadWriteBarrier();
+    const Job job = queue->jobs[read_idx];
+    _ReadWriteBarrier();
+    
+    const u32 new_next_read_idx = (read_idx + 1) & (JOB_QUEUE_SIZE - 1);
+    const u32 idx = InterlockedCompareExchange((volatile LONG*)&queue->next_read_idx, new_next_read_idx, read_idx);
+
+    // Other thread took this job, but there may be more.
+    if (idx != read_idx) return true;
+
+    job.proc(job.data, job.idx);
+    InterlockedDecrement((volatile LONG*)&job.batch->pending_count);
+    
+    return true;
+}
+
+bool jobs_done(const Job_Batch* batch)
+{
+    return batch->pending_count == 0;
+}
+
+void wait_jobs(Job_Queue* queue, Job_Batch* batch)
+{
+    while (!jobs_done(batch))
+        do_next_job(queue);
+}
+
+void run_jobs(Job_Queue* queue, Job_Proc proc, void* data, s32 count)
+{
+    if (!queue)
+    {
+        for (s32 i = 0; i < count; ++i)
+            proc(data, i);
+        return;
+    }
+
+    Job_Batch batch = {0};
+    for (s32 i = 0; i < count; ++i)
+        push_job(queue, &batch, proc, data, i);
+
+    wait_jobs(queue, &batch);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Must be power of two.
+inline constexpr u32 JOB_QUEUE_SIZE = 4096;
+
+typedef void (*Job_Proc)(void* data, s32 idx);
+
+struct Job_Batch
+{
+    volatile s32 pending_count;
+};
+
+struct Job
+{
+    Job_Proc proc;
+    void* data;
+    Job_Batch* batch;
+    s32 idx;
+};
+
+// Single producer (main thread), multiple consumers (workers and main thread while waiting).
+struct Job_Queue
+{
+    Job jobs[JOB_QUEUE_SIZE];
+    volatile u32 next_write_idx;
+    volatile u32 next_read_idx;
+    void* semaphore;
+    s32 worker_count;
+};
+
+s32 cpu_core_count();
+void init_job_queue(Job_Queue* queue, s32 worker_count);
+void push_job(Job_Queue* queue, Job_Batch* batch, Job_Proc proc, void* data, s32 idx);
+bool do_next_job(Job_Queue* queue);
+bool jobs_done(const Job_Batch* batch);
+void wait_jobs(Job_Queue* queue, Job_Batch* batch); // helps to execute jobs while waiting
+
+// Run proc for [0, count) indices across all workers and block until all are done.
+// Null queue executes everything on calling thread.
+void run_jobs(Job_Queue* queue, Job_Proc proc, void* data, s32 count);
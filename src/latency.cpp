@@ -0,0 +1,111 @@
+#include "pch.h"
+#include "latency.h"
+#include "file.h"
+#include "arena.h"
+#include <stdio.h>
+
+static const char* latency_stage_names[LATENCY_STAGE_COUNT] = { "edit", "layout", "submit", "present" };
+
+static s32 latency_bucket(u64 us)
+{
+    if (us < 8) return (s32)us;
+
+    s32 msb = 0;
+    for (u64 v = us; v > 1; v >>= 1) msb++;
+
+    const s32 sub_bucket = (s32)((us >> (msb - 3)) & 7);
+    return min((msb - 2) * 8 + sub_bucket, LATENCY_BUCKET_COUNT - 1);
+}
+
+// Upper bound of bucket in microseconds.
+static u64 latency_bucket_limit(s32 bucket)
+{
+    if (bucket < 8) return bucket + 1;
+
+    const s32 msb = bucket / 8 + 2;
+    const u64 sub_bucket = bucket % 8;
+    return (9 + sub_bucket) << (msb - 3);
+}
+
+static void add_sample(Latency_Histogram* histogram, f64 seconds)
+{
+    const u64 us = seconds > 0.0 ? (u64)(seconds * 1000000.0) : 0;
+    histogram->buckets[latency_bucket(us)]++;
+    histogram->count++;
+}
+
+void track_input(Latency_Tracker* tracker, f64 input_time, f64 edit_time)
+{
+    if (tracker->pending_input_count >= LATENCY_MAX_PENDING_INPUTS) return;
+
+    auto* input = tracker->pending_inputs + tracker->pending_input_count++;
+    input->input_time = input_time;
+    input->edit_time = edit_time;
+}
+
+void track_frame_stage(Latency_Tracker* tracker, Latency_Stage stage, f64 time)
+{
+    assert(stage != LATENCY_STAGE_EDIT); // edit time comes with input
+    tracker->frame_times[stage] = time;
+
+    if (stage != LATENCY_STAGE_PRESENT) return;
+
+    // Frame is on screen, so all inputs applied before it are as well.
+    for (s32 i = 0; i < tracker->pending_input_count; ++i)
+    {
+        const auto* input = tracker->pending_inputs + i;
+        add_sample(tracker->histograms + LATENCY_STAGE_EDIT, input->edit_time - input->input_time);
+        
+        for (s32 j = LATENCY_STAGE_LAYOUT; j < LATENCY_STAGE_COUNT; ++j)
+            add_sample(tracker->histograms + j, tracker->frame_times[j] - input->input_time);
+    }
+
+    tracker->pending_input_count = 0;
+}
+
+f64 latency_percentile(const Latency_Histogram* histogram, f64 percentile)
+{
+    if (histogram->count == 0) return 0.0;
+
+    const u64 target = (u64)(percentile * histogram->count + 0.5);
+    u64 sum = 0;
+    
+    for (s32 i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+    {
+        sum += histogram->buckets[i];
+        if (sum >= target && sum > 0)
+            return latency_bucket_limit(i) / 1000.0;
+    }
+    
+    return latency_bucket_limit(LATENCY_BUCKET_COUNT - 1) / 1000.0;
+}
+
+void dump_latency(const Latency_Tracker* tracker, Arena* arena, const char* path)
+{
+    constexpr s32 max_size = KB(16);
+    char* text = push_array(arena, max_size, char);
+    s32 size = 0;
+
+    size += sprintf(text + size, "stage\tcount\tp50_ms\tp99_ms\tp999_ms\n");
+    for (s32 i = 0; i < LATENCY_STAGE_COUNT; ++i)
+    {
+        const auto* histogram = tracker->histograms + i;
+        size += sprintf(text + size, "%s\t%u\t%.3f\t%.3f\t%.3f\n", latency_stage_names[i], histogram->count,
+                        latency_percentile(histogram, 0.5), latency_percentile(histogram, 0.99), latency_percentile(histogram, 0.999));
+    }
+
+    // Raw presented histogram for offline comparison between builds.
+    const auto* present = tracker->histograms + LATENCY_STAGE_PRESENT;
+    size += sprintf(text + size, "\nbucket_limit_us\tcount\n");
+    for (s32 i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+    {
+        if (present->buckets[i] == 0) continue;
+        size += sprintf(text + size, "%llu\t%u\n", (unsigned long long)latency_bucket_limit(i), present->buckets[i]);
+    }
+
+    assert(size < max_size);
+    overwrite_file(path, (u8*)text, size);
+    pop(arena, max_size);
+    
+    printf("Latency histogram is dumped to (%s)\n", path);
+}
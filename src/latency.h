@@ -0,0 +1,44 @@
+#pragma once
+
+struct Arena;
+
+// Input events waiting to be presented, the ones over limit are not tracked.
+inline constexpr s32 LATENCY_MAX_PENDING_INPUTS = 64;
+
+// First 8 buckets are 1us wide, then each power of two is split into 8 buckets,
+// which gives 12.5% precision up to ~2 seconds, the last bucket collects the rest.
+inline constexpr s32 LATENCY_BUCKET_COUNT = 160;
+
+enum Latency_Stage : u8
+{
+    LATENCY_STAGE_EDIT,    // input callback has applied its edit
+    LATENCY_STAGE_LAYOUT,  // frame layout is done (scroll bounds etc.)
+    LATENCY_STAGE_SUBMIT,  // draw calls are submitted
+    LATENCY_STAGE_PRESENT, // glfwSwapBuffers has returned
+    LATENCY_STAGE_COUNT
+};
+
+struct Latency_Histogram
+{
+    u32 buckets[LATENCY_BUCKET_COUNT]; // microseconds from input
+    u32 count;
+};
+
+struct Latency_Input
+{
+    f64 input_time;
+    f64 edit_time;
+};
+
+struct Latency_Tracker
+{
+    Latency_Input pending_inputs[LATENCY_MAX_PENDING_INPUTS];
+    Latency_Histogram histograms[LATENCY_STAGE_COUNT];
+    f64 frame_times[LATENCY_STAGE_COUNT]; // stage times of frame in flight
+    s32 pending_input_count;
+};
+
+void track_input(Latency_Tracker* tracker, f64 input_time, f64 edit_time);
+void track_frame_stage(Latency_Tracker* tracker, Latency_Stage stage, f64 time);
+f64 latency_percentile(const Latency_Histogram* histogram, f64 percentile); // in ms
+void dump_latency(const Latency_Tracker* tracker, Arena* arena, const char* path);
@@ -12,14 +12,24 @@ int main()
     void* heap = vm_commit(vm_core, heap_size);
 
     ted_settings.tab_size = 4;
+    ted_settings.atlas_memory_budget = MB(8);
+    ted_settings.sdf_glyphs = false; // opt in, zoom then goes one pixel at a time
+    ted_settings.kerning = true;
+    ted_settings.ligatures = true;
+    ted_settings.soft_wrap = false;
     
     Ted_Context ted;
     init_ted_context(&ted, heap, heap_size);
     create_window(&ted, 800, 600, 4, 32);
     load_font(&ted, "C:/Windows/Fonts/Consola.ttf");
+    add_fallback_font(&ted, "C:/Windows/Fonts/segoeui.ttf");
+    add_fallback_font(&ted, "C:/Windows/Fonts/msyh.ttc");
+    add_fallback_font(&ted, "C:/Windows/Fonts/seguisym.ttf");
     init_render_context(&ted);
-    bake_font(&ted, 0, 127, 6, 128, 4);
-    ted.active_atlas_idx = 6;
+    // Sdf glyphs scale to any size, so zoom can go one pixel at a time.
+    const s16 font_size_stride = ted_settings.sdf_glyphs ? 1 : 4;
+    bake_font(&ted, 0, 127, 6, 128, font_size_stride);
+    ted.active_atlas_idx = (30 - 6) / font_size_stride;
 
     const s16 buffer_idx = create_buffer(&ted);
     set_active_buffer(&ted, buffer_idx);
@@ -33,6 +43,7 @@ int main()
     while (alive(&ted))
     {
         update_frame(&ted);
+        wait_events(&ted);
     }
     
     destroy(&ted);
@@ -0,0 +1,31 @@
+#pragma once
+
+// Segment tree of maximum of array values, value updates take log time and maximum of
+// all of them is kept in root. Tree is 1-based, leaves are tree[count..2 * count).
+
+// Update ancestors of leaves [first, end) after they were set, level by level. Cost is of
+// range size plus tree height, whole tree is built with range of all leaves.
+inline void build_max_tree(s32* tree, s32 count, s32 first, s32 end)
+{
+    if (first >= end) return;
+    
+    for (s32 lo = (first + count) / 2, hi = (end - 1 + count) / 2; lo > 0; lo /= 2, hi /= 2)
+        for (s32 i = lo; i <= hi; ++i)
+            tree[i] = max(tree[2 * i], tree[2 * i + 1]);
+}
+
+// Set value with given 0-based index.
+inline void set_max_tree_value(s32* tree, s32 count, s32 idx, s32 value)
+{
+    s32 i = idx + count;
+    tree[i] = value;
+    
+    for (i /= 2; i > 0; i /= 2)
+        tree[i] = max(tree[2 * i], tree[2 * i + 1]);
+}
+
+// Maximum of all values.
+inline s32 max_tree_root(const s32* tree)
+{
+    return tree[1];
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <emmintrin.h>
+
 inline u16 swap_endianness_16(const void* data)
 {
     const u8* mem = (u8*)data;
@@ -19,6 +21,51 @@ inline u64 swap_endianness_64(const void* data)
            ((u64)mem[4] << 24) | ((u64)mem[5] << 16) | ((u64)mem[6] <<  8) | ((u64)mem[7] <<  0);
 }
 
+// Decode big-endian value of integral type without moving data pointer.
+// Struct types provide their own specializations next to definition.
+template <typename T>
+inline T read_big_endian(const void* data)
+{
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "Unsupported big-endian type size");
+    
+#if LITTLE_ENDIAN
+    if constexpr (sizeof(T) == 1)      return *(const T*)data;
+    else if constexpr (sizeof(T) == 2) return (T)swap_endianness_16(data);
+    else if constexpr (sizeof(T) == 4) return (T)swap_endianness_32(data);
+    else                               return (T)swap_endianness_64(data);
+#else
+    return *(const T*)data;
+#endif
+}
+
+// View over array of big-endian values in place, elements are decoded on access.
+template <typename T>
+struct Big_Endian_Array
+{
+    const u8* data;
+    u32 count;
+
+    T operator[](u32 idx) const { return read_big_endian<T>(data + idx * sizeof(T)); }
+};
+
+// Decode count big-endian u16 values into native ones, 8 values per iteration.
+inline void read_big_endian_array_u16(const void* data, u16* values, u32 count)
+{
+    const u8* mem = (u8*)data;
+    u32 i = 0;
+    
+#if LITTLE_ENDIAN
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(mem + i * sizeof(u16)));
+        _mm_storeu_si128((__m128i*)(values + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#endif
+    
+    for (; i < count; ++i)
+        values[i] = read_big_endian<u16>(mem + i * sizeof(u16));
+}
+
 inline void* eat(void** data, u32 bytes)
 {
     void* ptr = *data;
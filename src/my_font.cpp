@@ -1,9 +1,12 @@
 #include "pch.h"
-#include "font.h"
+#include "my_font.h"
 #include "arena.h"
 #include "memory_eater.h"
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 #include <malloc.h>
+#include <immintrin.h>
 
 static inline void eat_offset_subtable(void** data, Offset_Subtable* table)
 {
@@ -80,38 +83,36 @@ static inline void eat_hhea(void** data, Hhea* hhea)
     hhea->num_of_long_hor_metrics = eat_big_endian_u16(data);
 }
 
-static inline void eat_hmtx(Arena* arena, void** data, u16 num_glyphs, u16 num_of_long_hor_metrics, Hmtx* hmtx)
-{   
-    hmtx->h_metrics = push_array(arena, num_of_long_hor_metrics, Long_Hor_Metric);
-    for (u16 i = 0; i < num_of_long_hor_metrics; ++i)
+static inline void eat_hmtx(const void* data, u16 num_glyphs, u16 num_of_long_hor_metrics, Hmtx* hmtx)
+{
+    hmtx->h_metrics.data = (u8*)data;
+    hmtx->h_metrics.count = num_of_long_hor_metrics;
+    hmtx->left_side_bearings.data = hmtx->h_metrics.data + num_of_long_hor_metrics * sizeof(Long_Hor_Metric);
+    hmtx->left_side_bearings.count = num_glyphs - num_of_long_hor_metrics;
+}
+
+static inline void eat_loca(const void* data, u16 num_glyphs, s16 index_to_loc_format, Loca* loca)
+{
+    loca->index_to_loc_format = index_to_loc_format;
+    
+    if (index_to_loc_format == 0)
     {
-        hmtx->h_metrics[i].advance_width = eat_big_endian_u16(data);
-        hmtx->h_metrics[i].left_side_bearing = eat_big_endian_s16(data);
+        loca->short_offsets.data = (u8*)data;
+        loca->short_offsets.count = num_glyphs + 1;
     }
-    
-    const u16 num_of_left_side_bearings = num_glyphs - num_of_long_hor_metrics;
-    hmtx->left_side_bearings = push_array(arena, num_of_left_side_bearings, s16);
-    for (u16 i = 0; i < num_of_left_side_bearings; ++i)
+    else
     {
-        hmtx->left_side_bearings[i] = eat_big_endian_s16(data);
-    }    
+        loca->long_offsets.data = (u8*)data;
+        loca->long_offsets.count = num_glyphs + 1;
+    }
 }
 
-static inline void eat_loca(Arena* arena, void** data, u16 num_glyphs, s16 index_to_loc_format, Loca* loca)
+static inline u32 get_glyph_offset(const Loca* loca, u16 glyph_index)
 {
-    loca->offsets = push_array(arena, num_glyphs + 1, u32);
+    if (loca->index_to_loc_format == 0)
+        return loca->short_offsets[glyph_index] * 2;
     
-    for (u16 i = 0; i < num_glyphs + 1; ++i)
-    {
-        if (index_to_loc_format == 0)
-        {
-            loca->offsets[i] = eat_big_endian_u16(data) * 2;
-        }
-        else
-        {
-            loca->offsets[i] = eat_big_endian_u32(data);       
-        }
-    }
+    return loca->long_offsets[glyph_index];
 }
 
 static inline void eat_cmap(Arena* arena, void** data, Cmap* cmap)
@@ -128,7 +129,14 @@ static inline void eat_cmap(Arena* arena, void** data, Cmap* cmap)
     }
 }
 
-static inline void eat_format4(Arena* arena, void** data, Format4* f4)
+template <typename T>
+static inline void eat_big_endian_array(void** data, u32 count, Big_Endian_Array<T>* array)
+{
+    array->data = (u8*)eat(data, count * sizeof(T));
+    array->count = count;
+}
+
+static inline void eat_format4(void** data, Format4* f4)
 {
     const u8* start = (u8*)*data;
     
@@ -142,33 +150,39 @@ static inline void eat_format4(Arena* arena, void** data, Format4* f4)
     f4->range_shift = eat_big_endian_u16(data);
 
     const u16 seg_count = f4->seg_count_x2 / 2;
-    f4->end_code = push_array(arena, seg_count, u16);
-    for (u16 i = 0; i < seg_count; ++i)
-        f4->end_code[i] = eat_big_endian_u16(data);
-
+    eat_big_endian_array(data, seg_count, &f4->end_code);
     eat_u16(data); // skip reserved
+    eat_big_endian_array(data, seg_count, &f4->start_code);
+    eat_big_endian_array(data, seg_count, &f4->id_delta);
+    eat_big_endian_array(data, seg_count, &f4->id_range_offset);
     
-    f4->start_code = push_array(arena, seg_count, u16);
-    for (u16 i = 0; i < seg_count; ++i)
-        f4->start_code[i] = eat_big_endian_u16(data);
+    const u32 remaining_bytes = f4->length - (u32)((u8*)*data - start);
+    eat_big_endian_array(data, remaining_bytes / 2, &f4->glyph_index_array);
+}
 
-    f4->id_delta = push_array(arena, seg_count, u16);
-    for (u16 i = 0; i < seg_count; ++i)
-        f4->id_delta[i] = eat_big_endian_u16(data);
+// Offset is relative to its own place in file, so it may point into glyph index array.
+static inline const u8* get_segment_glyph_indices(const Format4* f4, s32 code_idx, u32 character)
+{
+    const u16 start_code = f4->start_code[code_idx];
+    return f4->id_range_offset.data + code_idx * sizeof(u16) + f4->id_range_offset[code_idx] + (character - start_code) * sizeof(u16);
+}
 
-    f4->id_range_offset = push_array(arena, seg_count, u16);
-    for (u16 i = 0; i < seg_count; ++i)
-        f4->id_range_offset[i] = eat_big_endian_u16(data);
+static u16 get_segment_glyph_index(const Format4* f4, s32 code_idx, u32 character)
+{
+    if (f4->start_code[code_idx] > character)
+        return 0;
     
-    const u32 remaining_bytes = f4->length - (u32)((u8*)*data - start);
-    const u32 glyph_index_count = remaining_bytes / 2;
-    f4->glyph_index_array = (u16*)push(arena, remaining_bytes);
+    if (f4->id_range_offset[code_idx] == 0)
+        return (character + f4->id_delta[code_idx]) % 65536;
+
+    const u16 glyph_idx = read_big_endian<u16>(get_segment_glyph_indices(f4, code_idx, character));
+    if (glyph_idx == 0)
+        return 0;
     
-    for (u32 i = 0; i < glyph_index_count; ++i)
-        f4->glyph_index_array[i] = eat_big_endian_u16(data);
+    return (glyph_idx + f4->id_delta[code_idx]) % 65536;
 }
 
-static u16 get_glyph_index(Format4* f4, u32 character)
+static u16 get_glyph_index(const Format4* f4, u32 character)
 {
     assert(f4->format == 4);
     
@@ -186,27 +200,10 @@ static u16 get_glyph_index(Format4* f4, u32 character)
 	if (code_idx == -1)
         return 0;
 
-	if (f4->start_code[code_idx] < character)
-    {
-		if (f4->id_range_offset[code_idx] == 0)
-        {
-            return (character + f4->id_delta[code_idx]) % 65536;
-        }
-        else
-        {
-            const u16 glyph_idx = *(f4->id_range_offset + code_idx + f4->id_range_offset[code_idx] / 2 + (character - f4->start_code[code_idx]));
-            
-			if (glyph_idx == 0)
-                return 0;
-            
-			return (glyph_idx + f4->id_delta[code_idx]) % 65536;
-		}
-	}
-    
-	return 0;
+    return get_segment_glyph_index(f4, code_idx, character);
 }
 
-static inline void eat_format12(Arena* arena, void** data, Format12* f12)
+static inline void eat_format12(void** data, Format12* f12)
 {
     f12->format = eat_big_endian_u16(data);
     assert(f12->format == 12);
@@ -214,23 +211,147 @@ static inline void eat_format12(Arena* arena, void** data, Format12* f12)
     f12->length = eat_big_endian_u32(data);
     f12->language = eat_big_endian_u32(data);
     f12->n_groups = eat_big_endian_u32(data);
-    f12->groups = push_array(arena, f12->n_groups, Format12_Group);
-    
+    eat_big_endian_array(data, f12->n_groups, &f12->groups);
+}
+
+static u16 get_group_glyph_index(const Format12_Group* group, u32 character)
+{
+    return (u16)(group->start_glyph_code + (character - group->start_char_code));
+}
+
+static u16 get_glyph_index(const Format12* f12, u32 character)
+{
+    assert(f12->format == 12);
+
     for (u32 i = 0; i < f12->n_groups; ++i)
     {
-        auto* group = f12->groups + i;
-        group->start_char_code = eat_big_endian_u32(data);
-        group->end_char_code = eat_big_endian_u32(data);
-        group->start_glyph_code = eat_big_endian_u32(data);
+        const auto group = f12->groups[i];
+        if (group.start_char_code <= character && character <= group.end_char_code)
+            return get_group_glyph_index(&group, character);
     }
+    
+    return 0;
 }
 
-static u16 get_glyph_index(Format12* f12, u32 character)
+// Groups are sorted by char code and do not overlap.
+static u16 find_glyph_index(const Format12* f12, u32 character)
 {
-    assert(f12->format == 12);
+    u32 low = 0;
+    u32 high = f12->n_groups;
+    
+    while (low < high)
+    {
+        const u32 mid = low + (high - low) / 2;
+        const auto group = f12->groups[mid];
+        
+        if (character < group.start_char_code)     high = mid;
+        else if (character > group.end_char_code)  low = mid + 1;
+        else return get_group_glyph_index(&group, character);
+    }
+    
     return 0;
 }
 
+static const u16 zero_cmap_page[256] = {};
+
+static Cmap_Page_Table* init_bmp_table(Arena* arena)
+{
+    auto* table = push_struct(arena, Cmap_Page_Table);
+    memset(table->pages, 0, sizeof(table->pages));
+    
+    // Reserved only, page memory is not touched until its page is built.
+    table->page_storage = push_array(arena, 256 * 256, u16);
+    
+    return table;
+}
+
+static void fill_bmp_page(const Format4* f4, u16* page, u32 first_character)
+{
+    const u32 last_character = first_character + 255;
+    const u16 seg_count = f4->seg_count_x2 / 2;
+
+    // Segments are sorted by end code, so skip ones that end before page.
+    u16 low = 0;
+    u16 high = seg_count;
+    while (low < high)
+    {
+        const u16 mid = low + (high - low) / 2;
+        if (f4->end_code[mid] < first_character) low = mid + 1;
+        else high = mid;
+    }
+
+    for (u16 i = low; i < seg_count && f4->start_code[i] <= last_character; ++i)
+    {
+        const u32 start = max((u32)f4->start_code[i], first_character);
+        const u32 end = min((u32)f4->end_code[i], last_character);
+        const u16 id_delta = f4->id_delta[i];
+        u16* indices = page + (start - first_character);
+        const u32 count = end - start + 1;
+        
+        if (f4->id_range_offset[i] == 0)
+        {
+            for (u32 j = 0; j < count; ++j)
+                indices[j] = (u16)(start + j + id_delta);
+            continue;
+        }
+
+        // Glyph indices of segment are contiguous in file, decode them in bulk.
+        read_big_endian_array_u16(get_segment_glyph_indices(f4, i, start), indices, count);
+        
+        if (id_delta == 0) continue;
+        
+        for (u32 j = 0; j < count; ++j)
+            if (indices[j]) indices[j] += id_delta;
+    }
+}
+
+static void fill_bmp_page(const Format12* f12, u16* page, u32 first_character)
+{
+    const u32 last_character = first_character + 255;
+    
+    u32 low = 0;
+    u32 high = f12->n_groups;
+    while (low < high)
+    {
+        const u32 mid = low + (high - low) / 2;
+        if (f12->groups[mid].end_char_code < first_character) low = mid + 1;
+        else high = mid;
+    }
+
+    for (u32 i = low; i < f12->n_groups; ++i)
+    {
+        const auto group = f12->groups[i];
+        if (group.start_char_code > last_character) break;
+
+        const u32 start = max(group.start_char_code, first_character);
+        const u32 end = min(group.end_char_code, last_character);
+        for (u32 c = start; c <= end; ++c)
+            page[c - first_character] = get_group_glyph_index(&group, c);
+    }
+}
+
+static const u16* build_bmp_page(Font_Directory* dir, u32 page_idx)
+{
+    u16* page = dir->bmp_table->page_storage + page_idx * 256;
+    memset(page, 0, 256 * sizeof(u16));
+    
+    if (dir->format_type == 4)       fill_bmp_page(dir->f4, page, page_idx << 8);
+    else if (dir->format_type == 12) fill_bmp_page(dir->f12, page, page_idx << 8);
+
+    const u16* result = zero_cmap_page;
+    for (s32 i = 0; i < 256; ++i)
+    {
+        if (page[i])
+        {
+            result = page;
+            break;
+        }
+    }
+    
+    dir->bmp_table->pages[page_idx] = result;
+    return result;
+}
+
 static inline void eat_font_directory(Arena* arena, void* data, Font_Directory* dir)
 {
     u8* data_start = (u8*)data;
@@ -279,24 +400,34 @@ static inline void eat_font_directory(Arena* arena, void* data, Font_Directory*
                 void* cmap_data = data_start + t->offset;
                 eat_cmap(arena, &cmap_data, &dir->cmap);
     
-                // @Todo: assume 4th format by default for now, support others later.
-                void* format_data = data_start + t->offset + dir->cmap.subtables[0].offset;
-
+                // Prefer format 12 as it covers all planes, otherwise take format 4 or first subtable.
+                void* format_data = null;
+                for (u16 j = 0; j < dir->cmap.number_subtables; ++j)
+                {
+                    void* subtable_data = data_start + t->offset + dir->cmap.subtables[j].offset;
 #if LITTLE_ENDIAN
-                dir->format_type = swap_endianness_16(format_data);
+                    const u16 format_type = swap_endianness_16(subtable_data);
 #else
-                dir->format_type = *(u16*)format_data;
+                    const u16 format_type = *(u16*)subtable_data;
 #endif
+                    if (!format_data || format_type == 12 || (format_type == 4 && dir->format_type != 12))
+                    {
+                        format_data = subtable_data;
+                        dir->format_type = format_type;
+                    }
+                }
+
+                if (!format_data) break;
                 
                 if (dir->format_type == 4)
                 {
                     dir->f4 = push_struct(arena, Format4);
-                    eat_format4(arena, &format_data, dir->f4);
+                    eat_format4(&format_data, dir->f4);
                 }
                 else if (dir->format_type == 12)
                 {
                     dir->f12 = push_struct(arena, Format12);
-                    eat_format12(arena, &format_data, dir->f12);
+                    eat_format12(&format_data, dir->f12);
                 }
                 
                 break;
@@ -313,15 +444,13 @@ static inline void eat_font_directory(Arena* arena, void* data, Font_Directory*
         {
             case HMTX_TAG:
             {    
-                void* hmtx_data = data_start + t->offset;
-                eat_hmtx(arena, &hmtx_data, dir->maxp.num_glyphs, dir->hhea.num_of_long_hor_metrics, &dir->hmtx);
+                eat_hmtx(data_start + t->offset, dir->maxp.num_glyphs, dir->hhea.num_of_long_hor_metrics, &dir->hmtx);
                 break;
             }
 
             case LOCA_TAG:
             {
-                void* loca_data = data_start + t->offset;
-                eat_loca(arena, &loca_data, dir->maxp.num_glyphs, dir->head.index_to_loc_format, &dir->loca);
+                eat_loca(data_start + t->offset, dir->maxp.num_glyphs, dir->head.index_to_loc_format, &dir->loca);
                 break;
             }
         }
@@ -338,12 +467,18 @@ static void eat_component_glyph(void** data, Component_Glyph* component)
         component->argument1 = eat_big_endian_s16(data);
         component->argument2 = eat_big_endian_s16(data);
     }
-    else
+    else if (component->flag.args_are_xy_values)
     {
         component->argument1 = eat_s8(data);
         component->argument2 = eat_s8(data);
     }
+    else // point numbers are unsigned
+    {
+        component->argument1 = eat_u8(data);
+        component->argument2 = eat_u8(data);
+    }
 
+    // Offset for matched points is known only after component is decoded.
     component->e = 0.0f;
     component->f = 0.0f;
     
@@ -352,11 +487,6 @@ static void eat_component_glyph(void** data, Component_Glyph* component)
         component->e = (f32)component->argument1;
         component->f = (f32)component->argument2;
     }
-    else
-    {
-        // @Todo: handle points.
-        assert(false && "Unhandled entry");
-    }
     
     component->a = 1.0f;
     component->b = 0.0f;
@@ -382,7 +512,7 @@ static void eat_component_glyph(void** data, Component_Glyph* component)
     }
 }
 
-static void eat_glyph_arrays(Font_Face* face, void* data, u16 countours_num, u16* countours, s16* x_coordinates, s16* y_coordinates)
+static bool eat_glyph_arrays(void* data, u16 countours_num, u32 max_points, u16* countours, s16* x_coordinates, s16* y_coordinates, u8* on_curve)
 {
     for (s16 i = 0; i < countours_num; ++i)
     {
@@ -393,6 +523,8 @@ static void eat_glyph_arrays(Font_Face* face, void* data, u16 countours_num, u16
     eat(&data, instruction_length); // skip instructions
 
     const u16 last_idx = countours[countours_num - 1];
+    if (last_idx >= max_points) return false;
+    
     auto* flags = (Glyph_Outline_Flag*)alloca(last_idx + 1);
 
     for (u16 i = 0; i <= last_idx; ++i)
@@ -402,7 +534,7 @@ static void eat_glyph_arrays(Font_Face* face, void* data, u16 countours_num, u16
         if (flags[i].repeat)
         {
             u8 repeat_count = eat_u8(&data);
-            while (repeat_count > 0)
+            while (repeat_count > 0 && i < last_idx)
             {
                 i++;
                 flags[i] = flags[i - 1];
@@ -411,6 +543,9 @@ static void eat_glyph_arrays(Font_Face* face, void* data, u16 countours_num, u16
         }
     }
 
+    for (u16 i = 0; i <= last_idx; ++i)
+        on_curve[i] = flags[i].on_curve;
+    
     s16 prev_coordinate = 0;
     s16 curr_coordinate = 0;
 
@@ -446,33 +581,111 @@ static void eat_glyph_arrays(Font_Face* face, void* data, u16 countours_num, u16
         y_coordinates[i] = curr_coordinate + prev_coordinate;
         prev_coordinate = y_coordinates[i];
     }
+
+    return true;
 }
 
-static inline void* get_glyph_data(Font_Face* face, u16 glyph_index)
+static inline void* get_glyph_data(const Font_Face* face, u16 glyph_index)
 {
-    return face->dir->glyf.data + face->dir->loca.offsets[glyph_index];
+    return (void*)(face->dir->glyf.data + get_glyph_offset(&face->dir->loca, glyph_index));
 }
 
-extern u8* read_entire_file(Arena* arena, const char* path, s32* size_read);
+static inline bool is_empty_glyph(const Font_Face* face, u16 glyph_index)
+{
+    const Loca* loca = &face->dir->loca;
+    return get_glyph_offset(loca, glyph_index) == get_glyph_offset(loca, glyph_index + 1);
+}
+
+static void get_outline_capacity(const Font_Directory* dir, u32* max_contours, u32* max_points)
+{
+    const Maxp* maxp = &dir->maxp;
+    *max_contours = max(maxp->max_contours, maxp->max_component_contours);
+    *max_points = max(maxp->max_points, maxp->max_component_points);
+}
+
+static void init_glyph_slot(Arena* arena, const Font_Directory* dir, Glyph_Slot* glyph)
+{
+    u32 max_contours, max_points;
+    get_outline_capacity(dir, &max_contours, &max_points);
+    
+    glyph->end_pts_of_countours = push_array(arena, max_contours, u16);
+    glyph->x_coordinates = push_array(arena, max_points, s16);
+    glyph->y_coordinates = push_array(arena, max_points, s16);
+    glyph->on_curve = push_array(arena, max_points, u8);
+}
+
+static void flush_glyph_outline_cache(Glyph_Outline_Cache* cache)
+{
+    for (u32 i = 0; i < GLYPH_OUTLINE_CACHE_SIZE; ++i)
+        cache->glyph_indices[i] = GLYPH_OUTLINE_EMPTY;
+
+    cache->outline_count = 0;
+    cache->contour_count = 0;
+    cache->point_count = 0;
+}
+
+static void init_glyph_outline_cache(Arena* arena, const Font_Directory* dir, Glyph_Outline_Cache* cache)
+{
+    u32 max_contours, max_points;
+    get_outline_capacity(dir, &max_contours, &max_points);
+
+    // Pools must fit any single glyph, so insert after flush always succeeds.
+    cache->contour_capacity = max((u32)GLYPH_OUTLINE_CACHE_CONTOURS, max_contours);
+    cache->point_capacity = max((u32)GLYPH_OUTLINE_CACHE_POINTS, max_points);
+    
+    cache->glyph_indices = push_array(arena, GLYPH_OUTLINE_CACHE_SIZE, u16);
+    cache->outlines = push_array(arena, GLYPH_OUTLINE_CACHE_SIZE, Glyph_Slot);
+    cache->end_pts_of_countours = push_array(arena, cache->contour_capacity, u16);
+    cache->x_coordinates = push_array(arena, cache->point_capacity, s16);
+    cache->y_coordinates = push_array(arena, cache->point_capacity, s16);
+    cache->on_curve = push_array(arena, cache->point_capacity, u8);
+
+    flush_glyph_outline_cache(cache);
+}
 
-void init_font_face(Arena* arena, const char* font_path, Font_Face* face)
-{ 
-    u8* font_data = read_entire_file(arena, font_path, nullptr);
+bool init_font_face(Arena* arena, const char* font_path, Font_Face* face)
+{
+    // Font stays mapped, tables are decoded from it on access.
+    if (!map_file(&face->file, font_path))
+    {
+        printf("Failed to map font file %s\n", font_path);
+        return false;
+    }
+    
     face->dir = push_struct(arena, Font_Directory);
-    eat_font_directory(arena, font_data, face->dir);
+    eat_font_directory(arena, (void*)face->file.data, face->dir);
+    face->dir->bmp_table = init_bmp_table(arena);
 
     face->glyph = push_struct(arena, Glyph_Slot);
+    init_glyph_slot(arena, face->dir, face->glyph);
+    
+    face->outline_cache = push_struct(arena, Glyph_Outline_Cache);
+    init_glyph_outline_cache(arena, face->dir, face->outline_cache);
 
-    const Maxp* maxp = &face->dir->maxp;
-    const u16 max_contours = max(maxp->max_contours, maxp->max_component_contours);
-    face->glyph->end_pts_of_countours = push_array(arena, max_contours, u16);
+    return true;
+}
 
-    const u16 max_points = max(maxp->max_points, maxp->max_component_points);
-    face->glyph->x_coordinates = push_array(arena, max_points * 2, s16);
-    face->glyph->y_coordinates = push_array(arena, max_points * 2, s16);
+void close_font_face(Font_Face* face)
+{
+    unmap_file(&face->file);
 }
 
 u16 get_glyph_index(Font_Face* face, u32 character)
+{
+    if (character <= 0xFFFF)
+    {
+        const u16* page = face->dir->bmp_table->pages[character >> 8];
+        if (!page) page = build_bmp_page(face->dir, character >> 8);
+        return page[character & 0xFF];
+    }
+
+    if (face->dir->format_type == 12)
+        return find_glyph_index(face->dir->f12, character);
+    
+    return 0;
+}
+
+u16 get_glyph_index_scan(Font_Face* face, u32 character)
 {
     if (face->dir->format_type == 4)
         return get_glyph_index(face->dir->f4, character);
@@ -484,6 +697,130 @@ u16 get_glyph_index(Font_Face* face, u32 character)
     return 0;
 }
 
+// Glyph outline being flattened into slot, compound glyphs append their components.
+struct Outline_Builder
+{
+    Glyph_Slot* glyph;
+    u32 contour_count;
+    u32 point_count;
+    u32 max_contours;
+    u32 max_points;
+};
+
+static bool append_glyph_outline(const Font_Face* face, u16 glyph_index, s32 depth, Outline_Builder* builder)
+{
+    if (glyph_index >= face->dir->maxp.num_glyphs || depth > MAX_GLYPH_COMPONENT_DEPTH) return false;
+    
+    // Glyphs like space have no outline data at all.
+    if (is_empty_glyph(face, glyph_index)) return true;
+    
+    Glyph_Slot* glyph = builder->glyph;
+    void* data = get_glyph_data(face, glyph_index);
+    
+    const s16 number_of_countours = eat_big_endian_s16(&data);
+    eat(&data, 4 * sizeof(s16)); // skip min/max points
+
+    if (number_of_countours >= 0)
+    {
+        if (number_of_countours == 0) return true;
+        if (builder->contour_count + number_of_countours > builder->max_contours) return false;
+
+        const u32 first_point = builder->point_count;
+        u16* contours = glyph->end_pts_of_countours + builder->contour_count;
+        
+        if (!eat_glyph_arrays(data, number_of_countours, builder->max_points - first_point, contours,
+                              glyph->x_coordinates + first_point, glyph->y_coordinates + first_point, glyph->on_curve + first_point))
+        {
+            return false;
+        }
+
+        const u16 point_count = contours[number_of_countours - 1] + 1;
+        for (s16 i = 0; i < number_of_countours; ++i)
+            contours[i] += first_point;
+        
+        builder->contour_count += number_of_countours;
+        builder->point_count += point_count;
+        return true;
+    }
+
+    const u32 glyph_first_point = builder->point_count;
+    
+    while (true)
+    {           
+        Component_Glyph component;
+        eat_component_glyph(&data, &component);
+
+        const u32 first_point = builder->point_count;
+        if (!append_glyph_outline(face, component.glyph_index, depth + 1, builder)) return false;
+        
+        s16* xs = glyph->x_coordinates;
+        s16* ys = glyph->y_coordinates;
+        
+        // Linear part first, so matched points can be compared in final orientation.
+        for (u32 i = first_point; i < builder->point_count; ++i)
+        {
+            const f32 x = (f32)xs[i];
+            const f32 y = (f32)ys[i];
+            xs[i] = (s16)roundf(component.a * x + component.c * y);
+            ys[i] = (s16)roundf(component.b * x + component.d * y);
+        }
+
+        if (!component.flag.args_are_xy_values)
+        {
+            // Align component point with already decoded point of this glyph.
+            const u32 parent_point = glyph_first_point + (u16)component.argument1;
+            const u32 child_point = first_point + (u16)component.argument2;
+            if (parent_point >= first_point || child_point >= builder->point_count) return false;
+            
+            component.e = (f32)(xs[parent_point] - xs[child_point]);
+            component.f = (f32)(ys[parent_point] - ys[child_point]);
+        }
+
+        const s16 e = (s16)component.e;
+        const s16 f = (s16)component.f;
+        for (u32 i = first_point; i < builder->point_count; ++i)
+        {
+            xs[i] += e;
+            ys[i] += f;
+        }
+                
+        if (!component.flag.more_components)
+            break;
+    }
+
+    return true;
+}
+
+static bool load_glyph(const Font_Face* face, u16 glyph_index, Glyph_Slot* glyph)
+{
+    if (glyph_index >= face->dir->maxp.num_glyphs) return false;
+
+    glyph->number_of_countours = 0;
+    glyph->x_min = glyph->y_min = glyph->x_max = glyph->y_max = 0;
+
+    if (is_empty_glyph(face, glyph_index)) return true;
+    
+    void* data = get_glyph_data(face, glyph_index);
+    eat(&data, sizeof(s16)); // skip number of contours, compound glyphs report -1
+    glyph->x_min = eat_big_endian_s16(&data);
+    glyph->y_min = eat_big_endian_s16(&data);
+    glyph->x_max = eat_big_endian_s16(&data);
+    glyph->y_max = eat_big_endian_s16(&data);
+
+    Outline_Builder builder = {};
+    builder.glyph = glyph;
+    get_outline_capacity(face->dir, &builder.max_contours, &builder.max_points);
+    
+    if (!append_glyph_outline(face, glyph_index, 0, &builder))
+    {
+        glyph->number_of_countours = 0;
+        return false;
+    }
+
+    glyph->number_of_countours = (s16)builder.contour_count;
+    return true;
+}
+
 bool load_glyph(Font_Face* face, u16 glyph_index)
 {
     if (glyph_index == 0)
@@ -491,80 +828,439 @@ bool load_glyph(Font_Face* face, u16 glyph_index)
         printf("Invalid glyph index (%u)\n", glyph_index);
         return false;
     }
+
+    return load_glyph(face, glyph_index, face->glyph);
+}
+
+bool load_char(Font_Face* face, u32 character)
+{
+    const u16 idx = get_glyph_index(face, character);
+    return load_glyph(face, idx);
+}
+
+const Glyph_Slot* get_glyph_outline(Font_Face* face, u16 glyph_index)
+{
+    auto* cache = face->outline_cache;
+    constexpr u32 mask = GLYPH_OUTLINE_CACHE_SIZE - 1;
+
+    // Glyph indices are dense, so they spread well over table as is.
+    u32 slot = glyph_index & mask;
+    while (cache->glyph_indices[slot] != GLYPH_OUTLINE_EMPTY)
+    {
+        if (cache->glyph_indices[slot] == glyph_index)
+            return cache->outlines + slot;
+        
+        slot = (slot + 1) & mask;
+    }
+
+    Glyph_Slot* glyph = face->glyph;
+    if (!load_glyph(face, glyph_index, glyph)) return null;
+
+    const u32 contour_count = glyph->number_of_countours;
+    const u32 point_count = contour_count ? get_point_count(glyph) : 0;
     
+    // Working set of glyphs is small, so start over instead of tracking usage.
+    if (cache->outline_count + 1 > GLYPH_OUTLINE_CACHE_SIZE * 3 / 4 ||
+        cache->contour_count + contour_count > cache->contour_capacity ||
+        cache->point_count + point_count > cache->point_capacity)
+    {
+        flush_glyph_outline_cache(cache);
+        slot = glyph_index & mask;
+    }
+
+    Glyph_Slot* outline = cache->outlines + slot;
+    *outline = *glyph;
+    outline->end_pts_of_countours = cache->end_pts_of_countours + cache->contour_count;
+    outline->x_coordinates = cache->x_coordinates + cache->point_count;
+    outline->y_coordinates = cache->y_coordinates + cache->point_count;
+    outline->on_curve = cache->on_curve + cache->point_count;
+
+    memcpy(outline->end_pts_of_countours, glyph->end_pts_of_countours, contour_count * sizeof(u16));
+    memcpy(outline->x_coordinates, glyph->x_coordinates, point_count * sizeof(s16));
+    memcpy(outline->y_coordinates, glyph->y_coordinates, point_count * sizeof(s16));
+    memcpy(outline->on_curve, glyph->on_curve, point_count * sizeof(u8));
+    
+    cache->glyph_indices[slot] = glyph_index;
+    cache->outline_count += 1;
+    cache->contour_count += contour_count;
+    cache->point_count += point_count;
+    
+    return outline;
+}
+
+f32 scale_for_pixel_height(const Font_Face* face, f32 pixel_height)
+{
+    const Hhea* hhea = &face->dir->hhea;
+    return pixel_height / (hhea->ascent - hhea->descent);
+}
+
+void get_glyph_h_metrics(const Font_Face* face, u16 glyph_index, s32* advance_width, s32* left_side_bearing)
+{
+    const Hmtx* hmtx = &face->dir->hmtx;
+    const u16 num_of_long_hor_metrics = face->dir->hhea.num_of_long_hor_metrics;
+
+    // Glyphs past long metrics share advance of the last one and store only bearing.
+    if (glyph_index < num_of_long_hor_metrics)
+    {
+        if (advance_width) *advance_width = hmtx->h_metrics[glyph_index].advance_width;
+        if (left_side_bearing) *left_side_bearing = hmtx->h_metrics[glyph_index].left_side_bearing;
+    }
+    else
+    {
+        if (advance_width) *advance_width = hmtx->h_metrics[num_of_long_hor_metrics - 1].advance_width;
+        if (left_side_bearing) *left_side_bearing = hmtx->left_side_bearings[glyph_index - num_of_long_hor_metrics];
+    }
+}
+
+void get_glyph_bitmap_box(const Font_Face* face, u16 glyph_index, f32 scale_x, f32 scale_y, s32* x0, s32* y0, s32* x1, s32* y1)
+{
+    if (glyph_index >= face->dir->maxp.num_glyphs || is_empty_glyph(face, glyph_index))
+    {
+        *x0 = *y0 = *x1 = *y1 = 0;
+        return;
+    }
+
     void* data = get_glyph_data(face, glyph_index);
-    auto* glyph = face->glyph;
+    eat(&data, sizeof(s16)); // skip number of contours
     
-    glyph->number_of_countours = eat_big_endian_s16(&data);
-    glyph->x_min = eat_big_endian_s16(&data);
-    glyph->y_min = eat_big_endian_s16(&data);
-    glyph->x_max = eat_big_endian_s16(&data);
-    glyph->y_max = eat_big_endian_s16(&data);
+    const s16 x_min = eat_big_endian_s16(&data);
+    const s16 y_min = eat_big_endian_s16(&data);
+    const s16 x_max = eat_big_endian_s16(&data);
+    const s16 y_max = eat_big_endian_s16(&data);
+
+    // Flip y, so box is in bitmap space.
+    *x0 = (s32)floorf(x_min * scale_x);
+    *y0 = (s32)floorf(-y_max * scale_y);
+    *x1 = (s32)ceilf(x_max * scale_x);
+    *y1 = (s32)ceilf(-y_min * scale_y);
+}
 
-    if (glyph->number_of_countours >= 0)
+// Signed area accumulation rasterizer. Every outline edge adds its signed coverage
+// deltas to the cells it crosses, prefix sum of each row then gives coverage.
+struct Glyph_Raster
+{
+    f32* cells; // rows of w + 2 cells, so edges touching right border need no checks
+    s32 w;
+    s32 h;
+    s32 row_size;
+};
+
+struct Raster_Point
+{
+    f32 x;
+    f32 y;
+};
+
+static void raster_line(Glyph_Raster* raster, Raster_Point p0, Raster_Point p1)
+{
+    if (fabsf(p0.y - p1.y) <= 1e-6f) return;
+
+    // Points outside bitmap can only come from rounding, clamp them instead of clipping.
+    p0.x = clamp(p0.x, 0.0f, (f32)raster->w);
+    p1.x = clamp(p1.x, 0.0f, (f32)raster->w);
+
+    f32 dir = 1.0f;
+    if (p0.y > p1.y)
     {
-        eat_glyph_arrays(face, data, glyph->number_of_countours, glyph->end_pts_of_countours, glyph->x_coordinates, glyph->y_coordinates);
+        const Raster_Point p = p0;
+        p0 = p1;
+        p1 = p;
+        dir = -1.0f;
     }
-    else // @Todo: probably won't work with component depth > 1 ?
+
+    const f32 dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+    f32 x = p0.x;
+    if (p0.y < 0.0f) x -= p0.y * dxdy;
+
+    const s32 y_start = max((s32)p0.y, 0);
+    const s32 y_end = min((s32)ceilf(p1.y), raster->h);
+    
+    for (s32 y = y_start; y < y_end; ++y)
     {
-        s16 total_component_countours = 0;
-        s16 total_component_points = 0;
-        u16* component_contours = nullptr;
-        s16* component_x_coordinates = nullptr;
-        s16* component_y_coordinates = nullptr;
+        f32* row = raster->cells + y * raster->row_size;
         
-        while (true)
-        {           
-            Component_Glyph component;
-            eat_component_glyph(&data, &component);
-
-            void* component_data = get_glyph_data(face, component.glyph_index);
-            const s16 component_number_of_countours = eat_big_endian_s16(&component_data);
-            eat(&component_data, 4 * sizeof(u16)); // skip min/max points
-
-            component_contours = glyph->end_pts_of_countours + total_component_countours;
-            component_x_coordinates = glyph->x_coordinates + total_component_points;
-            component_y_coordinates = glyph->y_coordinates + total_component_points;
-            
-            eat_glyph_arrays(face, component_data, component_number_of_countours, component_contours, component_x_coordinates, component_y_coordinates);
+        const f32 dy = min((f32)(y + 1), p1.y) - max((f32)y, p0.y);
+        const f32 x_next = x + dxdy * dy;
+        const f32 d = dy * dir;
+        
+        const f32 x0 = min(x, x_next);
+        const f32 x1 = max(x, x_next);
+        const f32 x0_floor = floorf(x0);
+        const s32 x0i = (s32)x0_floor;
+        const f32 x1_ceil = ceilf(x1);
+        const s32 x1i = (s32)x1_ceil;
+
+        if (x1i <= x0i + 1)
+        {
+            // Edge stays in one cell, split its area between this cell and the next.
+            const f32 xmf = 0.5f * (x + x_next) - x0_floor;
+            row[x0i] += d - d * xmf;
+            row[x0i + 1] += d * xmf;
+        }
+        else
+        {
+            const f32 s = 1.0f / (x1 - x0);
+            const f32 x0f = x0 - x0_floor;
+            const f32 a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+            const f32 x1f = x1 - x1_ceil + 1.0f;
+            const f32 am = 0.5f * s * x1f * x1f;
+
+            row[x0i] += d * a0;
             
-            // Offset countour indices.
-            for (s16 i = 0; i < component_number_of_countours; ++i)
+            if (x1i == x0i + 2)
             {
-                component_contours[i] += total_component_points;
+                row[x0i + 1] += d * (1.0f - a0 - am);
+            }
+            else
+            {
+                const f32 a1 = s * (1.5f - x0f);
+                row[x0i + 1] += d * (a1 - a0);
+                
+                for (s32 xi = x0i + 2; xi < x1i - 1; ++xi)
+                    row[xi] += d * s;
+                
+                const f32 a2 = a1 + (x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1.0f - a2 - am);
             }
             
-            const u16 component_last_idx = component_contours[component_number_of_countours - 1];
-            total_component_countours += component_number_of_countours;
-            total_component_points += component_last_idx + 1;
+            row[x1i] += d * am;
+        }
+        
+        x = x_next;
+    }
+}
+
+static void raster_quad(Glyph_Raster* raster, Raster_Point p0, Raster_Point p1, Raster_Point p2)
+{
+    // Deviation of control point from chord defines how many segments keep error below tolerance.
+    const f32 dev_x = p0.x - 2.0f * p1.x + p2.x;
+    const f32 dev_y = p0.y - 2.0f * p1.y + p2.y;
+    const f32 dev_sq = dev_x * dev_x + dev_y * dev_y;
+    
+    if (dev_sq < 0.333f)
+    {
+        raster_line(raster, p0, p2);
+        return;
+    }
+
+    const s32 segment_count = 1 + (s32)sqrtf(sqrtf(3.0f * dev_sq));
+    const f32 step = 1.0f / segment_count;
+    
+    Raster_Point prev = p0;
+    for (s32 i = 1; i <= segment_count; ++i)
+    {
+        const f32 t = i * step;
+        const f32 mt = 1.0f - t;
+        
+        Raster_Point p;
+        p.x = mt * mt * p0.x + 2.0f * mt * t * p1.x + t * t * p2.x;
+        p.y = mt * mt * p0.y + 2.0f * mt * t * p1.y + t * t * p2.y;
+        
+        raster_line(raster, prev, p);
+        prev = p;
+    }
+}
+
+static Raster_Point midpoint(Raster_Point a, Raster_Point b)
+{
+    return Raster_Point{ 0.5f * (a.x + b.x), 0.5f * (a.y + b.y) };
+}
+
+// Walk contour of on and off curve points, two off curve points in a row
+// have implicit on curve point between them.
+static void raster_contour(Glyph_Raster* raster, const Raster_Point* points, const u8* on_curve, s32 count)
+{
+    if (count < 2) return;
+
+    Raster_Point first;
+    s32 loop_start;
+    s32 loop_count;
+    
+    if (on_curve[0])
+    {
+        first = points[0];
+        loop_start = 1;
+        loop_count = count - 1;
+    }
+    else if (on_curve[count - 1])
+    {
+        first = points[count - 1];
+        loop_start = 0;
+        loop_count = count - 1;
+    }
+    else
+    {
+        first = midpoint(points[0], points[count - 1]);
+        loop_start = 0;
+        loop_count = count;
+    }
+
+    Raster_Point prev = first;
+    Raster_Point control;
+    bool has_control = false;
+    
+    for (s32 i = 0; i < loop_count; ++i)
+    {
+        const s32 idx = loop_start + i;
+        const Raster_Point p = points[idx];
+
+        if (on_curve[idx])
+        {
+            if (has_control) raster_quad(raster, prev, control, p);
+            else             raster_line(raster, prev, p);
             
-            // Transform coordinates.
-            for(u16 i = 0; i <= component_last_idx; ++i)
+            prev = p;
+            has_control = false;
+        }
+        else
+        {
+            if (has_control)
             {
-                f32 x = (f32)component_x_coordinates[i];
-                f32 y = (f32)component_y_coordinates[i];
+                const Raster_Point mid = midpoint(control, p);
+                raster_quad(raster, prev, control, mid);
+                prev = mid;
+            }
+            
+            control = p;
+            has_control = true;
+        }
+    }
 
-                x = component.a * x + component.c * y + component.e;
-                y = component.b * x + component.d * y + component.f;
+    if (has_control) raster_quad(raster, prev, control, first);
+    else             raster_line(raster, prev, first);
+}
 
-                component_x_coordinates[i] = (s16)x;
-                component_y_coordinates[i] = (s16)y;
-            }
-                    
-            if (!component.flag.more_components)
-                break;
+// Prefix sum of cell deltas along the row, absolute value of sum is coverage.
+static void accumulate_row(const f32* cells, u8* out, s32 w)
+{
+    s32 x = 0;
+    f32 sum = 0.0f;
+    
+#if defined(__AVX2__)
+    {
+        const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 max_value = _mm256_set1_ps(255.0f);
+        __m256 offset = _mm256_setzero_ps();
+        
+        for (; x + 8 <= w; x += 8)
+        {
+            // Prefix sum within 128 bit lanes, then carry low lane total into high lane.
+            __m256 v = _mm256_loadu_ps(cells + x);
+            v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 4)));
+            v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 8)));
+            
+            const __m256 lane_totals = _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3));
+            v = _mm256_add_ps(v, _mm256_permute2f128_ps(lane_totals, lane_totals, 0x08));
+            v = _mm256_add_ps(v, offset);
+
+            const __m256 last = _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3));
+            offset = _mm256_permute2f128_ps(last, last, 0x11);
+
+            const __m256 coverage = _mm256_mul_ps(_mm256_min_ps(_mm256_andnot_ps(sign_mask, v), one), max_value);
+            const __m256i values = _mm256_cvtps_epi32(coverage);
+            
+            __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+            packed = _mm_packus_epi16(packed, packed);
+            _mm_storel_epi64((__m128i*)(out + x), packed);
+        }
+        
+        sum = _mm256_cvtss_f32(offset);
+    }
+#endif
+    
+    {
+        const __m128 sign_mask = _mm_set1_ps(-0.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 max_value = _mm_set1_ps(255.0f);
+        __m128 offset = _mm_set1_ps(sum);
+        
+        for (; x + 4 <= w; x += 4)
+        {
+            __m128 v = _mm_loadu_ps(cells + x);
+            v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+            v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+            v = _mm_add_ps(v, offset);
+            offset = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+
+            const __m128 coverage = _mm_mul_ps(_mm_min_ps(_mm_andnot_ps(sign_mask, v), one), max_value);
+            __m128i values = _mm_cvtps_epi32(coverage);
+            values = _mm_packs_epi32(values, values);
+            values = _mm_packus_epi16(values, values);
+            
+            const s32 bytes = _mm_cvtsi128_si32(values);
+            memcpy(out + x, &bytes, sizeof(bytes));
         }
 
-        glyph->number_of_countours = total_component_countours;
+        sum = _mm_cvtss_f32(offset);
     }
     
-    return true;
+    for (; x < w; ++x)
+    {
+        sum += cells[x];
+        out[x] = (u8)(min(fabsf(sum), 1.0f) * 255.0f + 0.5f);
+    }
 }
 
-bool load_char(Font_Face* face, u32 character)
+void make_glyph_bitmap(const Font_Face* face, Arena* arena, u8* bitmap, s32 w, s32 h, s32 stride, f32 scale_x, f32 scale_y, u16 glyph_index)
 {
-    const u16 idx = get_glyph_index(face, character);
-    return load_glyph(face, idx);
+    if (w <= 0 || h <= 0) return;
+    
+    const u64 arena_used = arena->used;
+    
+    Glyph_Slot glyph;
+    init_glyph_slot(arena, face->dir, &glyph);
+
+    if (!load_glyph(face, glyph_index, &glyph))
+        glyph.number_of_countours = 0;
+    
+    make_outline_bitmap(&glyph, arena, bitmap, w, h, stride, scale_x, scale_y);
+    pop(arena, arena->used - arena_used);
+}
+
+void make_outline_bitmap(const Glyph_Slot* outline, Arena* arena, u8* bitmap, s32 w, s32 h, s32 stride, f32 scale_x, f32 scale_y)
+{
+    if (w <= 0 || h <= 0) return;
+    
+    if (outline->number_of_countours <= 0)
+    {
+        for (s32 y = 0; y < h; ++y) memset(bitmap + y * stride, 0, w);
+        return;
+    }
+    
+    const u64 arena_used = arena->used;
+    const Glyph_Slot& glyph = *outline;
+
+    // Same origin as get_glyph_bitmap_box.
+    const s32 x0 = (s32)floorf(glyph.x_min * scale_x);
+    const s32 y0 = (s32)floorf(-glyph.y_max * scale_y);
+    
+    Glyph_Raster raster;
+    raster.w = w;
+    raster.h = h;
+    raster.row_size = w + 2;
+    raster.cells = (f32*)push_zero(arena, raster.row_size * h * sizeof(f32));
+    
+    const u16 point_count = get_point_count(&glyph);
+    auto* points = push_array(arena, point_count, Raster_Point);
+    for (u16 i = 0; i < point_count; ++i)
+    {
+        points[i].x = glyph.x_coordinates[i] * scale_x - x0;
+        points[i].y = -glyph.y_coordinates[i] * scale_y - y0;
+    }
+
+    s32 contour_start = 0;
+    for (s16 i = 0; i < glyph.number_of_countours; ++i)
+    {
+        const s32 contour_end = glyph.end_pts_of_countours[i];
+        raster_contour(&raster, points + contour_start, glyph.on_curve + contour_start, contour_end - contour_start + 1);
+        contour_start = contour_end + 1;
+    }
+
+    for (s32 y = 0; y < h; ++y)
+        accumulate_row(raster.cells + y * raster.row_size, bitmap + y * stride, w);
+    
+    pop(arena, arena->used - arena_used);
 }
 
 void print_font_directory(Font_Directory* dir)
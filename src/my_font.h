@@ -1,5 +1,8 @@
 #pragma once
 
+#include "file.h"
+#include "memory_eater.h"
+
 inline constexpr u32 font_tag(char a, char b, char c, char d)
 {
     return a << 24 | b << 16 | c << 8 | d << 0;
@@ -101,20 +104,35 @@ struct Long_Hor_Metric
     s16 left_side_bearing;
 };
 
+template <>
+inline Long_Hor_Metric read_big_endian<Long_Hor_Metric>(const void* data)
+{
+    const u8* mem = (u8*)data;
+    return { read_big_endian<u16>(mem), read_big_endian<s16>(mem + 2) };
+}
+
+// Tables below are views into mapped font file, nothing is decoded until accessed.
+
 struct Hmtx
 {
-    Long_Hor_Metric* h_metrics;
-    s16* left_side_bearings;
+    Big_Endian_Array<Long_Hor_Metric> h_metrics;
+    Big_Endian_Array<s16> left_side_bearings;
 };
 
 struct Loca
 {
-    u32* offsets;
+    s16 index_to_loc_format; // 0 - short offsets divided by 2, 1 - long offsets
+
+    union
+    {
+        Big_Endian_Array<u16> short_offsets;
+        Big_Endian_Array<u32> long_offsets;
+    };
 };
 
 struct Glyf
 {
-    u8* data;
+    const u8* data;
 };
 
 struct Cmap_Encoding_Subtable
@@ -140,12 +158,12 @@ struct Format4
  	u16 search_range;
  	u16 entry_selector;
  	u16 range_shift;
-	u16* end_code;
+	Big_Endian_Array<u16> end_code;
     // u16 - reserved
-	u16* start_code;
-	u16* id_delta;
-	u16* id_range_offset;
-	u16* glyph_index_array;
+	Big_Endian_Array<u16> start_code;
+	Big_Endian_Array<u16> id_delta;
+	Big_Endian_Array<u16> id_range_offset;
+	Big_Endian_Array<u16> glyph_index_array;
 };
 
 struct Format12_Group
@@ -154,6 +172,13 @@ struct Format12_Group
     u32 end_char_code;
     u32 start_glyph_code;
 };
+
+template <>
+inline Format12_Group read_big_endian<Format12_Group>(const void* data)
+{
+    const u8* mem = (u8*)data;
+    return { read_big_endian<u32>(mem), read_big_endian<u32>(mem + 4), read_big_endian<u32>(mem + 8) };
+}
     
 struct Format12
 {
@@ -162,7 +187,16 @@ struct Format12
     u32 length;
     u32 language;
     u32 n_groups;
-    Format12_Group* groups;
+    Big_Endian_Array<Format12_Group> groups;
+};
+
+// Two level glyph index table for basic multilingual plane, high byte of codepoint
+// selects page of 256 glyph indices. Pages are built on first lookup into reserved
+// storage, pages without glyphs share one zero page.
+struct Cmap_Page_Table
+{
+    const u16* pages[256]; // null if not built yet
+    u16* page_storage;     // 256 pages, touched only for built ones
 };
 
 using Glyph_Outline_Flag = union
@@ -193,6 +227,7 @@ struct Font_Directory
     Loca loca;
     Cmap cmap;
     Glyf glyf;
+    Cmap_Page_Table* bmp_table; // filled from selected format on lookup
     u16 format_type;
 
     union
@@ -248,6 +283,7 @@ struct Glyph_Slot
     u16* end_pts_of_countours;
     s16* x_coordinates;
     s16* y_coordinates;
+    u8* on_curve; // 0 for quadratic bezier control points
 };
 
 inline s16 get_width(const Glyph_Slot* glyph)
@@ -265,18 +301,54 @@ inline u16 get_point_count(const Glyph_Slot* glyph)
     return glyph->end_pts_of_countours[glyph->number_of_countours - 1] + 1;
 }
 
+inline constexpr s32 MAX_GLYPH_COMPONENT_DEPTH    = 8;
+inline constexpr u32 GLYPH_OUTLINE_CACHE_SIZE     = 1024; // hash table slots, power of 2
+inline constexpr u32 GLYPH_OUTLINE_CACHE_CONTOURS = 4 * 1024;
+inline constexpr u32 GLYPH_OUTLINE_CACHE_POINTS   = 32 * 1024;
+inline constexpr u16 GLYPH_OUTLINE_EMPTY          = 0xFFFF;
+
+// Fully resolved glyph outlines keyed by glyph index. Points of all outlines
+// live in shared arrays, whole cache is flushed when table or arrays are full.
+struct Glyph_Outline_Cache
+{
+    u16* glyph_indices;  // GLYPH_OUTLINE_EMPTY for free slot
+    Glyph_Slot* outlines; // point into arrays below
+    u32 outline_count;
+    
+    u16* end_pts_of_countours;
+    s16* x_coordinates;
+    s16* y_coordinates;
+    u8* on_curve;
+    u32 contour_count;
+    u32 point_count;
+    u32 contour_capacity;
+    u32 point_capacity;
+};
+
 struct Font_Face
 {
+    Mapped_File file;
     Font_Directory* dir;
     Glyph_Slot* glyph;
+    Glyph_Outline_Cache* outline_cache;
 };
 
 struct Arena;
 
-void init_font_face(Arena* arena, const char* font_path, Font_Face* face);
-u16 get_glyph_index(Font_Face* face, u32 character);
+bool init_font_face(Arena* arena, const char* font_path, Font_Face* face);
+void close_font_face(Font_Face* face);
+u16 get_glyph_index(Font_Face* face, u32 character); // not thread safe, builds cmap pages lazily
+u16 get_glyph_index_scan(Font_Face* face, u32 character); // plain cmap scan, reference for benchmarks
 bool load_glyph(Font_Face* face, u16 glyph_index);
 bool load_char(Font_Face* face, u32 character);
+const Glyph_Slot* get_glyph_outline(Font_Face* face, u16 glyph_index); // cached, valid until next call, null on error
+
+// Rasterizer, same usage as stbtt counterparts, bitmap box y goes down.
+f32 scale_for_pixel_height(const Font_Face* face, f32 pixel_height);
+void get_glyph_h_metrics(const Font_Face* face, u16 glyph_index, s32* advance_width, s32* left_side_bearing);
+void get_glyph_bitmap_box(const Font_Face* face, u16 glyph_index, f32 scale_x, f32 scale_y, s32* x0, s32* y0, s32* x1, s32* y1);
+void make_glyph_bitmap(const Font_Face* face, Arena* arena, u8* bitmap, s32 w, s32 h, s32 stride, f32 scale_x, f32 scale_y, u16 glyph_index); // arena is scratch, so call is thread safe with arena per thread
+void make_outline_bitmap(const Glyph_Slot* outline, Arena* arena, u8* bitmap, s32 w, s32 h, s32 stride, f32 scale_x, f32 scale_y);
 
 void print_font_directory(Font_Directory* dir);
 void print_cmap(Cmap* cmap);
@@ -0,0 +1,190 @@
+#include "pch.h"
+#include "search.h"
+#include "simd.h"
+#include "arena.h"
+#include <string.h>
+
+Search_Pattern make_search_pattern(Arena* arena, const char* text, bool regex)
+{
+    Search_Pattern pattern = { text, (s32)strlen(text), regex, nullptr };
+    if (regex || pattern.size == 0) return pattern;
+
+    pattern.borders = push_array(arena, pattern.size, s32);
+    pattern.borders[0] = 0;
+    
+    s32 border = 0;
+    for (s32 i = 1; i < pattern.size; ++i)
+    {
+        while (border > 0 && text[i] != text[border]) border = pattern.borders[border - 1];
+        if (text[i] == text[border]) border++;
+        pattern.borders[i] = border;
+    }
+
+    return pattern;
+}
+
+// Size of first regex atom of pattern: char, escape or bracket class.
+static s32 atom_size(const char* re)
+{
+    if (re[0] == '\\' && re[1]) return 2;
+    if (re[0] != '[') return 1;
+
+    s32 i = 1;
+    if (re[i] == '^') i++;
+    if (re[i] == ']') i++; // leading ']' is literal
+    
+    for (; re[i] && re[i] != ']'; ++i)
+        if (re[i] == '\\' && re[i + 1]) i++;
+    
+    return re[i] ? i + 1 : i;
+}
+
+static bool escape_matches(char e, char c)
+{
+    switch (e)
+    {
+    case 'd': return c >= '0' && c <= '9';
+    case 'w': return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || (c >= '0' && c <= '9') || c == '_';
+    case 's': return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    case 'n': return c == '\n';
+    case 't': return c == '\t';
+    default:  return c == e;
+    }
+}
+
+static bool class_matches(const char* re, s32 size, char c)
+{
+    s32 i = 1;
+    const bool negate = re[i] == '^';
+    if (negate) i++;
+
+    bool matched = false;
+    for (s32 first = i; i < size - 1 && !matched; ++i)
+    {
+        if (re[i] == '\\')
+        {
+            matched = escape_matches(re[++i], c);
+        }
+        else if (re[i + 1] == '-' && i + 2 < size - 1)
+        {
+            matched = c >= re[i] && c <= re[i + 2];
+            i += 2;
+        }
+        else
+        {
+            matched = c == re[i] || (i == first && re[i] == ']' && c == ']');
+        }
+    }
+
+    return matched != negate;
+}
+
+static bool atom_matches(const char* re, s32 size, char c)
+{
+    switch (re[0])
+    {
+    case '.':  return c != '\n';
+    case '\\': return escape_matches(re[1], c);
+    case '[':  return class_matches(re, size, c) && c != '\n';
+    default:   return c == re[0];
+    }
+}
+
+// End of match of regex at pos, INVALID_INDEX if it does not match there.
+// Quantifiers are greedy and back off one char at a time, so match attempt may take time
+// of its whole run and search is not linear in text size in general.
+static s32 match_here(const char* re, const char* data, s32 pos, s32 size)
+{
+    if (re[0] == '\0') return pos;
+    if (re[0] == '$' && re[1] == '\0') return pos == size || data[pos] == '\n' ? pos : INVALID_INDEX;
+
+    const s32 atom = atom_size(re);
+    const char op = re[atom];
+    
+    if (op == '*' || op == '+' || op == '?')
+    {
+        const s32 min_count = op == '+' ? 1 : 0;
+        const s32 max_count = op == '?' ? min(1, size - pos) : size - pos;
+
+        s32 count = 0;
+        while (count < max_count && atom_matches(re, atom, data[pos + count]))
+            count++;
+
+        for (; count >= min_count; --count)
+        {
+            const s32 end = match_here(re + atom + 1, data, pos + count, size);
+            if (end != INVALID_INDEX) return end;
+        }
+
+        return INVALID_INDEX;
+    }
+
+    if (pos < size && atom_matches(re, atom, data[pos]))
+        return match_here(re + atom, data, pos + 1, size);
+    
+    return INVALID_INDEX;
+}
+
+// Literal search jumps to candidates by simd scan of first byte. Regex is tried at each
+// position, also jumping by first byte if pattern starts with plain char. Pattern like .*x
+// rescans rest of line from each position, \s*x may rescan across lines, so regex search
+// is quadratic in length of such runs at worst.
+bool find_match(const Search_Pattern* pattern, const char* data, s32 start, s32 size, Search_Match* match)
+{
+    const char* re = pattern->text;
+    if (pattern->size == 0) return false;
+    
+    // Knuth-Morris-Pratt, data is never read twice. Without partial match scan jumps to next
+    // occurrence of first pattern byte.
+    if (!pattern->regex)
+    {
+        const s32* borders = pattern->borders;
+        s32 matched = 0;
+        
+        for (s32 i = start; i < size; ++i)
+        {
+            if (matched == 0)
+            {
+                i = find_either_byte(data, i, size, re[0], re[0]);
+                if (i == size) break;
+            }
+
+            while (matched > 0 && data[i] != re[matched]) matched = borders[matched - 1];
+            if (data[i] == re[matched]) matched++;
+
+            if (matched == pattern->size)
+            {
+                *match = { i + 1 - matched, matched };
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    const bool line_start = re[0] == '^';
+    if (line_start) re++;
+
+    const s32 atom = atom_size(re);
+    const bool plain_first = re[0] && !strchr(".[\\$", re[0]) && !strchr("*+?", re[atom]);
+    
+    for (s32 i = start; i <= size; ++i)
+    {
+        if (plain_first)
+        {
+            i = find_either_byte(data, i, size, re[0], re[0]);
+            if (i == size) return false;
+        }
+
+        if (line_start && i > 0 && data[i - 1] != '\n') continue;
+
+        const s32 end = match_here(re, data, i, size);
+        if (end != INVALID_INDEX)
+        {
+            *match = { i, end - i };
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+struct Arena;
+
+struct Search_Match
+{
+    s32 start;
+    s32 size; // may be 0 for regex
+};
+
+// Literal pattern or tiny regex, which supports . [] [^] * + ? ^ $ and \ escapes, \d \w \s
+// among them. Regex never matches across line break except by \n or \s. Literal search is
+// linear (KMP), regex one backtracks and may be quadratic for patterns with quantified runs.
+struct Search_Pattern
+{
+    const char* text; // null-terminated
+    s32 size;
+    bool regex;
+    s32* borders; // literal only, longest proper border of each text prefix
+};
+
+Search_Pattern make_search_pattern(Arena* arena, const char* text, bool regex); // literal one keeps borders in arena
+bool find_match(const Search_Pattern* pattern, const char* data, s32 start, s32 size, Search_Match* match); // first match from start till size
@@ -5,6 +5,11 @@ inline constexpr s32 MAX_TAB_SIZE = 16;
 struct Ted_Settings
 {
     s32 tab_size;
+    u64 atlas_memory_budget; // bytes of gpu memory glyph cache texture may grow to
+    bool sdf_glyphs; // one distance field bitmap per glyph for every font size
+    bool kerning;
+    bool ligatures; // 'liga' substitutions of font
+    bool soft_wrap; // long lines continue on next visual line instead of horizontal scroll
 };
 
 inline Ted_Settings ted_settings;
@@ -0,0 +1,314 @@
+#include "pch.h"
+#include "shape.h"
+#include "font.h"
+#include "hash.h"
+#include "utf8.h"
+#include "arena.h"
+#include "settings.h"
+#include "memory_eater.h"
+#include <math.h>
+#include <string.h>
+
+// Marks tab during shaping, it is never kerned nor substituted.
+inline constexpr u32 TAB_GLYPH_ID = 0xFFFFFFFF;
+inline constexpr u32 GLYPH_INDEX_MASK = (1u << FONT_GLYPH_INDEX_BITS) - 1;
+
+void init_shape_cache(Shape_Cache* cache, Arena* arena, bool kerning, bool ligatures)
+{
+    cache->arena = arena;
+    cache->runs = (Shaped_Run*)push_zero(arena, SHAPE_CACHE_SIZE * sizeof(Shaped_Run));
+    cache->glyphs = push_array(arena, SHAPE_CACHE_MAX_GLYPHS, Shaped_Glyph);
+    cache->run_count = 0;
+    cache->glyph_count = 0;
+    memset(cache->ligatures, 0, sizeof(cache->ligatures));
+    cache->kerning = kerning;
+    cache->use_ligatures = ligatures;
+}
+
+static void flush_shape_cache(Shape_Cache* cache)
+{
+    memset(cache->runs, 0, SHAPE_CACHE_SIZE * sizeof(Shaped_Run));
+    cache->run_count = 0;
+    cache->glyph_count = 0;
+}
+
+static Shaped_Run* find_run_slot(Shape_Cache* cache, u64 key)
+{
+    // Hash table is kept at most half full, so there is always an empty slot.
+    u32 idx = (u32)(key >> 40) & (SHAPE_CACHE_SIZE - 1);
+    while (true)
+    {
+        auto* run = cache->runs + idx;
+        if (run->key == key || run->key == 0) return run;
+        idx = (idx + 1) & (SHAPE_CACHE_SIZE - 1);
+    }
+}
+
+static void add_ligature_subtable(Font_Ligatures* ligatures, const u8* subtable, u16 lookup_type)
+{
+    // Extension subtable only points to subtable of actual type.
+    if (lookup_type == 7)
+    {
+        lookup_type = read_big_endian<u16>(subtable + 2);
+        subtable += read_big_endian<u32>(subtable + 4);
+    }
+    
+    if (lookup_type != 4 || read_big_endian<u16>(subtable) != 1) return;
+    if (ligatures->subtable_count == MAX_LIGATURE_SUBTABLES) return;
+
+    // The same lookup is usually referenced by feature of every script.
+    for (s32 i = 0; i < ligatures->subtable_count; ++i)
+        if (ligatures->subtables[i] == subtable) return;
+    
+    ligatures->subtables[ligatures->subtable_count++] = subtable;
+}
+
+// Collect ligature substitutions of 'liga' feature of any script and language.
+static void parse_ligatures(Font_Ligatures* ligatures, const Font* font)
+{
+    ligatures->parsed = true;
+    
+    const u8* gsub = get_font_table(font, "GSUB");
+    if (!gsub) return;
+    
+    const u8* features = gsub + read_big_endian<u16>(gsub + 6);
+    const u8* lookups = gsub + read_big_endian<u16>(gsub + 8);
+    const u16 feature_count = read_big_endian<u16>(features);
+    const u16 lookup_count = read_big_endian<u16>(lookups);
+    
+    for (u16 i = 0; i < feature_count; ++i)
+    {
+        const u8* record = features + 2 + i * 6;
+        if (memcmp(record, "liga", 4) != 0) continue;
+
+        const u8* feature = features + read_big_endian<u16>(record + 4);
+        const u16 lookup_index_count = read_big_endian<u16>(feature + 2);
+        
+        for (u16 j = 0; j < lookup_index_count; ++j)
+        {
+            const u16 lookup_idx = read_big_endian<u16>(feature + 4 + j * 2);
+            if (lookup_idx >= lookup_count) continue;
+            
+            const u8* lookup = lookups + read_big_endian<u16>(lookups + 2 + lookup_idx * 2);
+            const u16 lookup_type = read_big_endian<u16>(lookup);
+            const u16 subtable_count = read_big_endian<u16>(lookup + 4);
+            
+            for (u16 k = 0; k < subtable_count; ++k)
+                add_ligature_subtable(ligatures, lookup + read_big_endian<u16>(lookup + 6 + k * 2), lookup_type);
+        }
+    }
+}
+
+static s32 get_coverage_index(const u8* coverage, u16 glyph_index)
+{
+    const u16 format = read_big_endian<u16>(coverage);
+    const u16 count = read_big_endian<u16>(coverage + 2);
+    
+    s32 low = 0;
+    s32 high = count;
+    
+    if (format == 1)
+    {
+        while (low < high)
+        {
+            const s32 mid = low + (high - low) / 2;
+            const u16 mid_glyph_index = read_big_endian<u16>(coverage + 4 + mid * 2);
+            
+            if (glyph_index < mid_glyph_index)       high = mid;
+            else if (glyph_index > mid_glyph_index)  low = mid + 1;
+            else return mid;
+        }
+    }
+    else if (format == 2)
+    {
+        while (low < high)
+        {
+            const s32 mid = low + (high - low) / 2;
+            const u8* range = coverage + 4 + mid * 6;
+            
+            if (glyph_index < read_big_endian<u16>(range))          high = mid;
+            else if (glyph_index > read_big_endian<u16>(range + 2)) low = mid + 1;
+            else return read_big_endian<u16>(range + 4) + glyph_index - read_big_endian<u16>(range);
+        }
+    }
+
+    return INVALID_INDEX;
+}
+
+// Replace glyph at idx with ligature of it and following glyphs of the same font,
+// return amount of glyphs ligature is made of, 1 if there is none.
+static s32 apply_ligature(const Font_Ligatures* ligatures, u32* glyph_ids, s32 count, s32 idx)
+{
+    const u32 font_bits = glyph_ids[idx] & ~GLYPH_INDEX_MASK;
+    const u16 glyph_index = (u16)(glyph_ids[idx] & GLYPH_INDEX_MASK);
+    
+    for (s32 i = 0; i < ligatures->subtable_count; ++i)
+    {
+        const u8* subtable = ligatures->subtables[i];
+        const s32 coverage_idx = get_coverage_index(subtable + read_big_endian<u16>(subtable + 2), glyph_index);
+        if (coverage_idx == INVALID_INDEX || coverage_idx >= read_big_endian<u16>(subtable + 4)) continue;
+
+        // Ligatures of set are ordered by preference, longest first.
+        const u8* ligature_set = subtable + read_big_endian<u16>(subtable + 6 + coverage_idx * 2);
+        const u16 ligature_count = read_big_endian<u16>(ligature_set);
+        
+        for (u16 j = 0; j < ligature_count; ++j)
+        {
+            const u8* ligature = ligature_set + read_big_endian<u16>(ligature_set + 2 + j * 2);
+            const u16 component_count = read_big_endian<u16>(ligature + 2);
+            if (component_count < 2 || idx + component_count > count) continue;
+
+            bool match = true;
+            for (u16 k = 1; k < component_count && match; ++k)
+                match = glyph_ids[idx + k] == (font_bits | read_big_endian<u16>(ligature + 4 + (k - 1) * 2));
+            
+            if (!match) continue;
+            
+            glyph_ids[idx] = font_bits | read_big_endian<u16>(ligature);
+            return component_count;
+        }
+    }
+
+    return 1;
+}
+
+const Shaped_Run* shape_line(Shape_Cache* cache, Font* font, const Font_Atlas* atlas, const char* line, s32 size)
+{
+    // Advances depend on font size only, so runs are shared by atlases of the same size.
+    const u64 seed = hash_bytes((const u8*)&atlas->font_size, sizeof(atlas->font_size));
+    u64 key = hash_bytes((const u8*)line, size, seed);
+    if (key == 0) key = 1;
+
+    Shaped_Run* run = find_run_slot(cache, key);
+    if (run->key == key && run->size == size) return run;
+
+    auto* arena = cache->arena;
+    const u64 arena_used = arena->used;
+
+    // Lines longer than whole glyph array are cut, they are far off screen anyway.
+    const s32 max_glyph_count = min(size, SHAPE_CACHE_MAX_GLYPHS);
+    auto* glyph_ids = push_array(arena, max_glyph_count, u32);
+    auto* clusters = push_array(arena, max_glyph_count, s32);
+    s32 glyph_count = 0;
+
+    for (s32 i = 0; i < size && glyph_count < max_glyph_count;)
+    {
+        s32 sequence_size;
+        const u32 codepoint = next_codepoint(line + i, size - i, &sequence_size);
+        glyph_ids[glyph_count] = codepoint == '\t' ? TAB_GLYPH_ID : get_glyph_index(font, codepoint);
+        clusters[glyph_count] = i;
+        glyph_count++;
+        
+        i += sequence_size;
+    }
+
+    if (cache->use_ligatures)
+    {
+        s32 ligated_count = 0;
+        for (s32 i = 0; i < glyph_count;)
+        {
+            s32 component_count = 1;
+            if (glyph_ids[i] != TAB_GLYPH_ID)
+            {
+                auto* ligatures = cache->ligatures + (glyph_ids[i] >> FONT_GLYPH_INDEX_BITS);
+                if (!ligatures->parsed)
+                {
+                    u32 glyph_index;
+                    parse_ligatures(ligatures, get_glyph_font(font, glyph_ids[i], &glyph_index));
+                }
+                
+                component_count = apply_ligature(ligatures, glyph_ids, glyph_count, i);
+            }
+
+            glyph_ids[ligated_count] = glyph_ids[i];
+            clusters[ligated_count] = clusters[i];
+            ligated_count++;
+            i += component_count;
+        }
+        
+        glyph_count = ligated_count;
+    }
+
+    if (cache->run_count + 1 > SHAPE_CACHE_SIZE / 2 || cache->glyph_count + glyph_count > SHAPE_CACHE_MAX_GLYPHS)
+    {
+        flush_shape_cache(cache);
+        run = find_run_slot(cache, key);
+    }
+    
+    run->key = key;
+    run->glyphs = cache->glyphs + cache->glyph_count;
+    run->glyph_count = glyph_count;
+    run->size = size;
+    cache->glyph_count += glyph_count;
+    cache->run_count++;
+
+    const u32 space_id = get_glyph_index(font, ' ');
+    const s32 tab_advance = ted_settings.tab_size * get_glyph_advance(font, atlas, space_id);
+    
+    f32 pen = 0.0f;
+    u32 prev_glyph_id = TAB_GLYPH_ID;
+    
+    for (s32 i = 0; i < glyph_count; ++i)
+    {
+        auto* glyph = run->glyphs + i;
+        const u32 glyph_id = glyph_ids[i];
+        glyph->cluster = clusters[i];
+
+        if (glyph_id == TAB_GLYPH_ID)
+        {
+            glyph->glyph_id = space_id;
+            glyph->x = (s32)roundf(pen);
+            pen += tab_advance;
+        }
+        else
+        {
+            if (cache->kerning && prev_glyph_id != TAB_GLYPH_ID)
+                pen += get_glyph_kern_advance(font, atlas, prev_glyph_id, glyph_id);
+
+            glyph->glyph_id = glyph_id;
+            glyph->x = (s32)roundf(pen);
+            pen += get_glyph_advance(font, atlas, glyph_id);
+        }
+
+        prev_glyph_id = glyph_id;
+    }
+
+    run->width = (s32)roundf(pen);
+    
+    pop(arena, arena->used - arena_used);
+    return run;
+}
+
+bool has_ligatures(Shape_Cache* cache, const Font* font)
+{
+    if (!cache->use_ligatures) return false;
+    
+    auto* ligatures = cache->ligatures;
+    if (!ligatures->parsed) parse_ligatures(ligatures, font);
+    
+    return ligatures->subtable_count > 0;
+}
+
+s32 caret_x(const Shaped_Run* run, s32 offset)
+{
+    // Last glyph that starts at or before offset.
+    s32 low = 0;
+    s32 high = run->glyph_count;
+    while (low < high)
+    {
+        const s32 mid = low + (high - low) / 2;
+        if (run->glyphs[mid].cluster <= offset) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low == 0) return 0;
+
+    const auto* glyph = run->glyphs + low - 1;
+    if (glyph->cluster == offset) return glyph->x;
+    
+    const s32 next_x = low < run->glyph_count ? run->glyphs[low].x : run->width;
+    const s32 next_cluster = low < run->glyph_count ? run->glyphs[low].cluster : run->size;
+    if (offset >= next_cluster) return next_x;
+    
+    return glyph->x + (next_x - glyph->x) * (offset - glyph->cluster) / (next_cluster - glyph->cluster);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "font.h"
+
+struct Arena;
+
+inline constexpr s32 SHAPE_CACHE_SIZE = 2048; // hash table slots, must be power of two
+inline constexpr s32 SHAPE_CACHE_MAX_GLYPHS = 64 * 1024;
+inline constexpr s32 MAX_LIGATURE_SUBTABLES = 32;
+
+struct Shaped_Glyph
+{
+    u32 glyph_id;
+    s32 x; // pen position from line start
+    s32 cluster; // byte offset in line of first character glyph was made of
+};
+
+// Glyphs of one line of text laid out for one atlas.
+struct Shaped_Run
+{
+    u64 key; // 0 if hash table slot is free
+    Shaped_Glyph* glyphs;
+    s32 glyph_count;
+    s32 size; // in bytes
+    s32 width;
+};
+
+// Ligature substitution subtables of 'liga' feature of one font, parsed on first use.
+struct Font_Ligatures
+{
+    const u8* subtables[MAX_LIGATURE_SUBTABLES];
+    s32 subtable_count;
+    bool parsed;
+};
+
+// Shaped runs keyed by line contents and atlas, so line is shaped again only when it
+// changes. Glyphs of all runs share one array, whole cache is flushed when it is full.
+struct Shape_Cache
+{
+    Arena* arena; // scratch memory for shaping
+    Shaped_Run* runs; // open addressing hash table
+    Shaped_Glyph* glyphs;
+    s32 run_count;
+    s32 glyph_count;
+    Font_Ligatures ligatures[MAX_FALLBACK_FONTS + 1]; // per font of fallback chain
+    bool kerning;
+    bool use_ligatures;
+};
+
+void init_shape_cache(Shape_Cache* cache, Arena* arena, bool kerning, bool ligatures);
+const Shaped_Run* shape_line(Shape_Cache* cache, Font* font, const Font_Atlas* atlas, const char* line, s32 size); // valid until next call
+bool has_ligatures(Shape_Cache* cache, const Font* font); // primary font ligatures are enabled and it has some
+s32 caret_x(const Shaped_Run* run, s32 offset); // pen position at byte offset, split evenly inside ligatures
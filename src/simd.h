@@ -0,0 +1,113 @@
+#pragma once
+
+#include <emmintrin.h>
+
+#if _MSC_VER
+#include <intrin.h>
+#endif
+
+// Scans over byte arrays 16 bytes per iteration, tail is scanned one byte at a time.
+
+inline s32 lowest_set_bit(u32 mask)
+{
+#if _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (s32)idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Index of first byte equal to a or b starting from given one, size if there is none.
+inline s32 find_either_byte(const char* data, s32 start, s32 size, char a, char b)
+{
+    s32 i = start;
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        const u32 mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) return i + lowest_set_bit(mask);
+    }
+
+    for (; i < size; ++i)
+        if (data[i] == a || data[i] == b) return i;
+    
+    return size;
+}
+
+// Amount of bytes equal to given one. Matches are summed in byte lanes for up to 255
+// iterations, so lanes do not overflow, then lanes are summed by sad.
+inline s32 count_byte(const char* data, s32 size, char c)
+{
+    s32 count = 0;
+    s32 i = 0;
+    const __m128i vc = _mm_set1_epi8(c);
+
+    while (i + 16 <= size)
+    {
+        __m128i sums = _mm_setzero_si128();
+        for (s32 n = 0; n < 255 && i + 16 <= size; ++n, i += 16)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            sums = _mm_sub_epi8(sums, _mm_cmpeq_epi8(v, vc));
+        }
+
+        const __m128i total = _mm_sad_epu8(sums, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(total) + _mm_extract_epi16(total, 4);
+    }
+
+    for (; i < size; ++i)
+        count += data[i] == c;
+    
+    return count;
+}
+
+// Index of first byte with high bit set starting from given one, size if there is none.
+inline s32 find_high_bit_byte(const u8* data, s32 start, s32 size)
+{
+    s32 i = start;
+    for (; i + 16 <= size; i += 16)
+    {
+        const u32 mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i)));
+        if (mask) return i + lowest_set_bit(mask);
+    }
+
+    for (; i < size; ++i)
+        if (data[i] & 0x80) return i;
+    
+    return size;
+}
+
+// Index of first byte that can not be part of identifier starting from given one, size if
+// there is none. Letters, digits, '_' and utf8 bytes are taken as identifier ones.
+inline s32 skip_identifier_bytes(const char* data, s32 start, s32 size)
+{
+    s32 i = start;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        
+        const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        const __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        const __m128i utf8 = _mm_cmplt_epi8(v, _mm_setzero_si128());
+        
+        const __m128i ident = _mm_or_si128(_mm_or_si128(letter, digit), _mm_or_si128(underscore, utf8));
+        const u32 mask = ~_mm_movemask_epi8(ident) & 0xFFFF;
+        if (mask) return i + lowest_set_bit(mask);
+    }
+
+    for (; i < size; ++i)
+    {
+        const u8 c = data[i];
+        const u8 lower = c | 0x20;
+        if (!((lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80)) return i;
+    }
+
+    return size;
+}
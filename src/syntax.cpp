@@ -0,0 +1,260 @@
+#include "pch.h"
+#include "syntax.h"
+#include "hash.h"
+#include "simd.h"
+#include <string.h>
+
+static const char* C_KEYWORDS[] = {
+    "alignas", "alignof", "break", "case", "catch", "class", "const", "consteval", "constexpr", "constinit",
+    "const_cast", "continue", "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit",
+    "export", "extern", "false", "for", "friend", "goto", "if", "inline", "mutable", "namespace", "new",
+    "noexcept", "nullptr", "null", "operator", "private", "protected", "public", "register", "reinterpret_cast",
+    "return", "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this",
+    "thread_local", "throw", "true", "try", "typedef", "typename", "union", "using", "virtual", "volatile", "while",
+};
+
+static const char* C_TYPES[] = {
+    "auto", "bool", "char", "char8_t", "char16_t", "char32_t", "double", "float", "int", "long", "short", "signed",
+    "unsigned", "void", "wchar_t", "size_t", "ptrdiff_t", "intptr_t", "uintptr_t",
+    "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    "s8", "s16", "s32", "s64", "u8", "u16", "u32", "u64", "f32", "f64",
+};
+
+static const char* C_EXTENSIONS[] = { ".c", ".h", ".cpp", ".hpp", ".cc", ".hh", ".cxx", ".inl" };
+
+static void add_keyword(Syntax_Grammar* grammar, const char* word, Token_Kind kind)
+{
+    const s32 size = (s32)strlen(word);
+    u32 idx = (u32)hash_bytes((const u8*)word, size) & (SYNTAX_KEYWORD_TABLE_SIZE - 1);
+    while (grammar->keywords[idx].word)
+        idx = (idx + 1) & (SYNTAX_KEYWORD_TABLE_SIZE - 1);
+
+    grammar->keywords[idx] = { word, size, kind };
+}
+
+static Token_Kind find_keyword(const Syntax_Grammar* grammar, const char* word, s32 size)
+{
+    u32 idx = (u32)hash_bytes((const u8*)word, size) & (SYNTAX_KEYWORD_TABLE_SIZE - 1);
+    while (true)
+    {
+        const auto* keyword = grammar->keywords + idx;
+        if (!keyword->word) return TOKEN_TEXT;
+        if (keyword->size == size && memcmp(keyword->word, word, size) == 0) return keyword->kind;
+        idx = (idx + 1) & (SYNTAX_KEYWORD_TABLE_SIZE - 1);
+    }
+}
+
+void init_c_grammar(Syntax_Grammar* grammar)
+{
+    memset(grammar, 0, sizeof(Syntax_Grammar));
+    
+    for (s32 c = 0; c < 256; ++c)
+    {
+        auto* char_class = grammar->char_classes + c;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') *char_class = CHAR_SPACE;
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') *char_class = CHAR_IDENTIFIER;
+        else if (c == '_' || c >= 0x80) *char_class = CHAR_IDENTIFIER;
+        else if (c >= '0' && c <= '9') *char_class = CHAR_DIGIT;
+        else if (c == '"' || c == '\'') *char_class = CHAR_QUOTE;
+        else if (c == '/') *char_class = CHAR_COMMENT;
+        else if (c == '#') *char_class = CHAR_PREPROCESSOR;
+        else if (c > ' ' && c < 0x7F) *char_class = CHAR_PUNCTUATION;
+        else *char_class = CHAR_TEXT;
+    }
+
+    for (const char* word : C_KEYWORDS) add_keyword(grammar, word, TOKEN_KEYWORD);
+    for (const char* word : C_TYPES) add_keyword(grammar, word, TOKEN_TYPE);
+
+    grammar->line_comment = "//";
+    grammar->block_comment_begin = "/*";
+    grammar->block_comment_end = "*/";
+}
+
+const Syntax_Grammar* find_grammar(const Syntax_Grammar* c_grammar, const char* path)
+{
+    const char* extension = strrchr(path, '.');
+    if (!extension) return null;
+
+    for (const char* c_extension : C_EXTENSIONS)
+        if (strcmp(extension, c_extension) == 0) return c_grammar;
+
+    return null;
+}
+
+static bool starts_with(const char* line, s32 i, s32 size, const char* prefix)
+{
+    const s32 prefix_size = (s32)strlen(prefix);
+    return i + prefix_size <= size && memcmp(line + i, prefix, prefix_size) == 0;
+}
+
+static void set_kind(Token_Kind* kinds, s32 start, s32 end, Token_Kind kind)
+{
+    if (kinds) memset(kinds + start, kind, end - start);
+}
+
+// End of block comment, its end delimiter is searched 16 bytes at a time.
+static s32 lex_block_comment(const Syntax_Grammar* grammar, const char* line, s32 i, s32 size, bool* closed)
+{
+    const char* end = grammar->block_comment_end;
+    while (true)
+    {
+        i = find_either_byte(line, i, size, end[0], end[0]);
+        if (i == size)
+        {
+            *closed = false;
+            return size;
+        }
+
+        if (starts_with(line, i, size, end))
+        {
+            *closed = true;
+            return i + (s32)strlen(end);
+        }
+
+        i++;
+    }
+}
+
+// End of string or char literal, backslash at line end continues it on next line.
+static s32 lex_string(const char* line, s32 i, s32 size, char quote, bool* continued)
+{
+    *continued = false;
+    while (true)
+    {
+        i = find_either_byte(line, i, size, quote, '\\');
+        if (i == size) return size;
+        if (line[i] == quote) return i + 1;
+
+        // Escaped char is skipped, line break of it continues literal.
+        if (i + 1 == size)
+        {
+            *continued = true;
+            return size;
+        }
+        
+        i += 2;
+    }
+}
+
+static s32 lex_number(const char* line, s32 i, s32 size)
+{
+    while (i < size)
+    {
+        i = skip_identifier_bytes(line, i, size);
+        if (i == size) break;
+
+        // Fraction and sign of exponent, like 1.5e+3 or 0x1p-2.
+        const char c = line[i];
+        const char prev = line[i - 1] | 0x20;
+        if (c == '.' || c == '\'') i++;
+        else if ((c == '+' || c == '-') && (prev == 'e' || prev == 'p')) i++;
+        else break;
+    }
+
+    return i;
+}
+
+u8 lex_line(const Syntax_Grammar* grammar, const char* line, s32 size, u8 state, Token_Kind* kinds)
+{
+    s32 i = 0;
+    
+    // Finish token that continues from previous line.
+    if (state == LEX_BLOCK_COMMENT)
+    {
+        bool closed;
+        i = lex_block_comment(grammar, line, 0, size, &closed);
+        set_kind(kinds, 0, i, TOKEN_COMMENT);
+        if (!closed) return LEX_BLOCK_COMMENT;
+    }
+    else if (state == LEX_LINE_COMMENT)
+    {
+        set_kind(kinds, 0, size, TOKEN_COMMENT);
+        return size > 0 && line[size - 1] == '\\' ? LEX_LINE_COMMENT : LEX_CODE;
+    }
+    else if (state == LEX_STRING)
+    {
+        bool continued;
+        i = lex_string(line, 0, size, '"', &continued);
+        set_kind(kinds, 0, i, TOKEN_STRING);
+        if (continued) return LEX_STRING;
+    }
+
+    // Words and punctuation of directive take its color, strings and comments in it keep theirs.
+    bool preprocessor = state == LEX_PREPROCESSOR;
+    bool line_start = i == 0;
+    
+    while (i < size)
+    {
+        const s32 start = i;
+        const char c = line[i];
+        Token_Kind kind = TOKEN_TEXT;
+        
+        switch (grammar->char_classes[(u8)c])
+        {
+        case CHAR_SPACE:
+            while (i < size && grammar->char_classes[(u8)line[i]] == CHAR_SPACE) i++;
+            set_kind(kinds, start, i, TOKEN_TEXT);
+            continue;
+            
+        case CHAR_IDENTIFIER:
+            i = skip_identifier_bytes(line, i, size);
+            kind = find_keyword(grammar, line + start, i - start);
+            break;
+
+        case CHAR_DIGIT:
+            i = lex_number(line, i, size);
+            kind = TOKEN_NUMBER;
+            break;
+
+        case CHAR_QUOTE:
+        {
+            bool continued;
+            i = lex_string(line, i + 1, size, c, &continued);
+            set_kind(kinds, start, i, TOKEN_STRING);
+            if (continued) return LEX_STRING;
+            line_start = false;
+            continue;
+        }
+        
+        case CHAR_COMMENT:
+            if (starts_with(line, i, size, grammar->line_comment))
+            {
+                set_kind(kinds, start, size, TOKEN_COMMENT);
+                return line[size - 1] == '\\' ? LEX_LINE_COMMENT : LEX_CODE;
+            }
+
+            if (starts_with(line, i, size, grammar->block_comment_begin))
+            {
+                bool closed;
+                i = lex_block_comment(grammar, line, i + (s32)strlen(grammar->block_comment_begin), size, &closed);
+                set_kind(kinds, start, i, TOKEN_COMMENT);
+                if (!closed) return LEX_BLOCK_COMMENT;
+                continue;
+            }
+
+            i++;
+            kind = TOKEN_PUNCTUATION;
+            break;
+
+        case CHAR_PREPROCESSOR:
+            preprocessor = preprocessor || line_start;
+            i++;
+            kind = TOKEN_PUNCTUATION;
+            break;
+
+        case CHAR_PUNCTUATION:
+            i++;
+            kind = TOKEN_PUNCTUATION;
+            break;
+
+        default:
+            i++;
+            break;
+        }
+
+        set_kind(kinds, start, i, preprocessor ? TOKEN_PREPROCESSOR : kind);
+        line_start = false;
+    }
+
+    return preprocessor && size > 0 && line[size - 1] == '\\' ? LEX_PREPROCESSOR : LEX_CODE;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+inline constexpr s32 SYNTAX_KEYWORD_TABLE_SIZE = 512; // hash table slots, must be power of two
+inline constexpr u8 LEX_STATE_DIRTY = 0x80; // set on line end state when line was edited since lexing
+inline constexpr s32 SYNTAX_BRACKET_COLORS = 3;
+
+// Kinds of tokens, they are also indices of highlight colors.
+enum Token_Kind : u8
+{
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_TYPE,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROCESSOR,
+    TOKEN_PUNCTUATION,
+    TOKEN_BRACKET, // first of bracket colors cycled by nesting depth, set by editor not lexer
+    TOKEN_KIND_COUNT = TOKEN_BRACKET + SYNTAX_BRACKET_COLORS
+};
+
+// Lexer state at line end, so each line is lexed alone given state of previous one.
+enum Lex_State : u8
+{
+    LEX_CODE,
+    LEX_BLOCK_COMMENT,
+    LEX_LINE_COMMENT, // continued by backslash
+    LEX_STRING,       // continued by backslash
+    LEX_PREPROCESSOR, // continued by backslash
+};
+
+// Lexer dispatches on class of first byte of token.
+enum Char_Class : u8
+{
+    CHAR_TEXT,
+    CHAR_SPACE,
+    CHAR_IDENTIFIER,
+    CHAR_DIGIT,
+    CHAR_QUOTE,
+    CHAR_COMMENT, // first byte of comment delimiter, punctuation if the rest does not match
+    CHAR_PREPROCESSOR,
+    CHAR_PUNCTUATION,
+};
+
+struct Syntax_Keyword
+{
+    const char* word; // null if hash table slot is free
+    s32 size;
+    Token_Kind kind;
+};
+
+// Tables of one language, lexer itself knows nothing about it.
+struct Syntax_Grammar
+{
+    Char_Class char_classes[256];
+    Syntax_Keyword keywords[SYNTAX_KEYWORD_TABLE_SIZE]; // open addressing hash table
+    const char* line_comment;
+    const char* block_comment_begin;
+    const char* block_comment_end;
+};
+
+void init_c_grammar(Syntax_Grammar* grammar); // C and C++
+const Syntax_Grammar* find_grammar(const Syntax_Grammar* c_grammar, const char* path); // by file extension, null for plain text
+u8 lex_line(const Syntax_Grammar* grammar, const char* line, s32 size, u8 state, Token_Kind* kinds); // return end state, kinds of bytes are filled if not null
@@ -2,11 +2,22 @@
 #include "ted.h"
 #include "gl.h"
 #include "file.h"
+#include "fenwick.h"
+#include "max_tree.h"
+#include "job.h"
+#include "utf8.h"
 #include "font.h"
+#include "shape.h"
+#include "syntax.h"
+#include "simd.h"
+#include "search.h"
+#include "font_bench.h"
 #include "arena.h"
 #include "matrix.h"
+#include "latency.h"
 #include "settings.h"
 #include <math.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
@@ -20,12 +31,41 @@ static void on_framebuffer_resize(u32 program, s32 w, s32 h)
     glUseProgram(0);
 }
 
+static void resize_frame_target(Ted_Context* ctx, s32 w, s32 h)
+{
+    // Minimized window reports zero sized framebuffer, keep previous target.
+    if (w <= 0 || h <= 0) return;
+
+    if (!ctx->frame_fbo)
+    {
+        glGenFramebuffers(1, &ctx->frame_fbo);
+        glGenTextures(1, &ctx->frame_texture);
+    }
+
+    ctx->frame_w = w;
+    ctx->frame_h = h;
+    
+    glBindTexture(GL_TEXTURE_2D, ctx->frame_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, null);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->frame_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ctx->frame_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 static void framebuffer_size_callback(GLFWwindow* window, s32 width, s32 height)
 {
     auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
     on_framebuffer_resize(ctx->font_render_ctx->program, width, height);
     on_framebuffer_resize(ctx->cursor_render_ctx->program, width, height);
     glViewport(0, 0, width, height);
+
+    // Texture contents are lost on resize, so whole frame has to be redrawn.
+    resize_frame_target(ctx, width, height);
+    damage_window(ctx);
 }
 
 static void window_size_callback(GLFWwindow* window, s32 width, s32 height)
@@ -38,28 +78,56 @@ static void window_size_callback(GLFWwindow* window, s32 width, s32 height)
 
     ctx->window_w = width;
     ctx->window_h = height;
+
+    damage_window(ctx);
+}
+
+static void window_refresh_callback(GLFWwindow* window)
+{
+    auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
+
+    // May come before fonts are baked and first buffer is opened, main loop draws it then.
+    if (ctx->atlas_count == 0 || ctx->buffer_count == 0) return;
+
+    // Window contents were lost (exposed, or resized inside modal loop on Win32, where main
+    // loop does not run), so frame is redrawn right away.
+    damage_window(ctx);
+    update_frame(ctx);
+}
+
+static void track_input(Ted_Context* ctx, f64 input_time)
+{
+    // Events that did not change anything on screen have no frame to wait for.
+    if (has_damage(ctx)) track_input(ctx->latency, input_time, glfwGetTime());
 }
 
 static void char_callback(GLFWwindow* window, u32 character)
 {
     //printf("Window char (%c) as key (%u)\n", character, character);
 
+    const f64 input_time = glfwGetTime();
     auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
-    push_char(ctx, ctx->active_buffer_idx, (char)character);
+
+    char utf8[4];
+    const s32 size = encode_utf8(character, utf8);
+    push_str(ctx, ctx->active_buffer_idx, utf8, size);
+    
+    track_input(ctx, input_time);
 }
 
-static void overwrite_file(Arena* arena, const Ted_Buffer* buffer)
+// Contents are written in place, gap is moved to their end instead of copying them.
+static void overwrite_file(Ted_Buffer* buffer)
 {
     const s32 buffer_data_size = data_size(&buffer->display_buffer);
-    char* utf8 = push_array(arena, buffer_data_size, char);
-    fill_utf8(&buffer->display_buffer, utf8);
-    overwrite_file(buffer->path, (u8*)utf8, buffer_data_size);
+    const char* utf8 = contiguous_string(&buffer->display_buffer, 0, buffer_data_size);
+    overwrite_file(buffer->path, (const u8*)utf8, buffer_data_size);
 }
 
 static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action, s32 mods)
 {
     //printf("Window key (%d) as char (%c)\n", key, key);
 
+    const f64 input_time = glfwGetTime();
     auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
     const s16 buffer_idx = ctx->active_buffer_idx;
     auto* buffer = ctx->buffers + buffer_idx;
@@ -67,7 +135,12 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
     switch (key)
     {
     case GLFW_KEY_ESCAPE: 
-        if (action == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
+        if (action == GLFW_PRESS)
+        {
+            if (buffer->extra_cursor_count > 0) clear_extra_cursors(ctx, buffer_idx);
+            else glfwSetWindowShouldClose(window, true);
+        }
+        
         break;
 
     case GLFW_KEY_TAB:
@@ -96,7 +169,27 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
         
     case GLFW_KEY_S:
         if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
-            overwrite_file(&ctx->arena, buffer);
+            overwrite_file(buffer);
+        break;
+
+    case GLFW_KEY_A:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            select_all(ctx, buffer_idx);
+        break;
+        
+    case GLFW_KEY_C:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            copy_selection(ctx, buffer_idx);
+        break;
+        
+    case GLFW_KEY_X:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            cut_selection(ctx, buffer_idx);
+        break;
+        
+    case GLFW_KEY_V:
+        if ((action == GLFW_PRESS || action == GLFW_REPEAT) && mods & GLFW_MOD_CONTROL)
+            paste_clipboard(ctx, buffer_idx);
         break;
         
     case GLFW_KEY_ENTER:
@@ -118,6 +211,7 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
         if (action == GLFW_PRESS || action == GLFW_REPEAT)
         {
             if (mods & GLFW_MOD_ALT) open_prev_buffer(ctx);
+            else if (mods & GLFW_MOD_SHIFT) extend_selection(ctx, buffer_idx, -1, 0);
             else move_cursor_horizontally(ctx, buffer_idx, -1);
         }
         
@@ -127,6 +221,7 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
         if (action == GLFW_PRESS || action == GLFW_REPEAT)
         {
             if (mods & GLFW_MOD_ALT) open_next_buffer(ctx);
+            else if (mods & GLFW_MOD_SHIFT) extend_selection(ctx, buffer_idx, 1, 0);
             else move_cursor_horizontally(ctx, buffer_idx, 1);
         }
         
@@ -134,12 +229,22 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
 
     case GLFW_KEY_UP:
         if (action == GLFW_PRESS || action == GLFW_REPEAT)
-            move_cursor_vertically(ctx, buffer_idx, -1);
+        {
+            if (mods & GLFW_MOD_CONTROL && mods & GLFW_MOD_ALT) add_cursor_vertically(ctx, buffer_idx, -1);
+            else if (mods & GLFW_MOD_SHIFT) extend_selection(ctx, buffer_idx, 0, -1);
+            else move_cursor_vertically(ctx, buffer_idx, -1);
+        }
+        
         break;
 
     case GLFW_KEY_DOWN:
         if (action == GLFW_PRESS || action == GLFW_REPEAT)
-            move_cursor_vertically(ctx, buffer_idx, 1);
+        {
+            if (mods & GLFW_MOD_CONTROL && mods & GLFW_MOD_ALT) add_cursor_vertically(ctx, buffer_idx, 1);
+            else if (mods & GLFW_MOD_SHIFT) extend_selection(ctx, buffer_idx, 0, 1);
+            else move_cursor_vertically(ctx, buffer_idx, 1);
+        }
+        
         break;
         
     case GLFW_KEY_EQUAL:
@@ -151,11 +256,46 @@ static void key_callback(GLFWwindow* window, s32 key, s32 scancode, s32 action,
         if ((action == GLFW_PRESS || action == GLFW_REPEAT) && mods & GLFW_MOD_CONTROL)
             decrease_font_size(ctx);
         break;
+
+    case GLFW_KEY_Z:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_ALT)
+            toggle_soft_wrap(ctx);
+        else if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            undo_buffer_edit(ctx, buffer_idx);
+        break;
+
+    case GLFW_KEY_LEFT_BRACKET:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            toggle_fold(ctx, buffer_idx);
+        break;
+
+    case GLFW_KEY_RIGHT_BRACKET:
+        if (action == GLFW_PRESS && mods & GLFW_MOD_CONTROL)
+            jump_to_matching_bracket(ctx, buffer_idx);
+        break;
+
+#if TED_DEBUG
+    case GLFW_KEY_F11:
+        if (action == GLFW_PRESS)
+        {
+            bench_glyph_rasterizers(&ctx->arena, ctx->font);
+            bench_cmap_lookup(&ctx->arena, ctx->font);
+        }
+        break;
+        
+    case GLFW_KEY_F12:
+        if (action == GLFW_PRESS)
+            dump_latency(ctx->latency, &ctx->arena, "ted_latency.txt");
+        break;
+#endif
     }
+
+    track_input(ctx, input_time);
 }
 
 static void scroll_callback(GLFWwindow* window, f64 xoffset, f64 yoffset)
 {    
+    const f64 input_time = glfwGetTime();
     auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
     auto* atlas = active_atlas(ctx);
     auto* buffer = active_buffer(ctx);
@@ -167,7 +307,57 @@ static void scroll_callback(GLFWwindow* window, f64 xoffset, f64 yoffset)
             buffer->x += (s16)yoffset * atlas->font_size;
         else
             buffer->y -= (s16)yoffset * atlas->line_height;
+
+        damage_window(ctx);
+    }
+
+    track_input(ctx, input_time);
+}
+
+static void mouse_button_callback(GLFWwindow* window, s32 button, s32 action, s32 mods)
+{
+    if (button != GLFW_MOUSE_BUTTON_LEFT) return;
+    
+    const f64 input_time = glfwGetTime();
+    auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
+    const s16 buffer_idx = ctx->active_buffer_idx;
+
+    if (action == GLFW_PRESS)
+    {
+        f64 x, y;
+        glfwGetCursorPos(window, &x, &y);
+
+        s32 row, col;
+        hit_test(ctx, buffer_idx, x, y, &row, &col);
+        
+        if (mods & GLFW_MOD_SHIFT) select_to(ctx, buffer_idx, row, col);
+        else set_cursor(ctx, buffer_idx, row, col);
+        
+        ctx->mouse_selecting = true;
     }
+    else if (action == GLFW_RELEASE)
+    {
+        ctx->mouse_selecting = false;
+    }
+
+    track_input(ctx, input_time);
+}
+
+static void cursor_pos_callback(GLFWwindow* window, f64 x, f64 y)
+{
+    auto* ctx = (Ted_Context*)glfwGetWindowUserPointer(window);
+    if (!ctx->mouse_selecting) return;
+    
+    const f64 input_time = glfwGetTime();
+    const s16 buffer_idx = ctx->active_buffer_idx;
+    const auto* cursor = &ctx->buffers[buffer_idx].cursor;
+
+    s32 row, col;
+    hit_test(ctx, buffer_idx, x, y, &row, &col);
+    if (row == cursor->row && col == cursor->col) return;
+    
+    select_to(ctx, buffer_idx, row, col);
+    track_input(ctx, input_time);
 }
 
 static s32 find_buffer_by_file(const Ted_Context* ctx, const char* path)
@@ -224,22 +414,48 @@ void init_ted_context(Ted_Context* ctx, void* memory, u32 size)
     ctx->font = push_struct(&ctx->arena, Font);
     ctx->font_render_ctx = push_struct(&ctx->arena, Font_Render_Context);
     ctx->cursor_render_ctx = push_struct(&ctx->arena, Ted_Cursor_Render_Context);
+    ctx->latency = (Latency_Tracker*)push_zero(&ctx->arena, sizeof(Latency_Tracker));
+    ctx->jobs = push_struct(&ctx->arena, Job_Queue);
+    ctx->glyph_cache = push_struct(&ctx->arena, Glyph_Cache);
+    ctx->shape_cache = push_struct(&ctx->arena, Shape_Cache);
+    ctx->line_layouts = (Ted_Line_Layout_Cache*)push_zero(&ctx->arena, sizeof(Ted_Line_Layout_Cache));
+    // @Cleanup: offsets are on heap like gap buffers until arenas can grow.
+    ctx->line_layouts->offsets = (Ted_Line_Offset*)malloc(TED_LINE_LAYOUT_OFFSETS * sizeof(Ted_Line_Offset));
+    ctx->line_layouts->offset_capacity = TED_LINE_LAYOUT_OFFSETS;
     ctx->atlases = push_array(&ctx->arena, TED_MAX_ATLASES, Font_Atlas);
     ctx->buffers = push_array(&ctx->arena, TED_MAX_BUFFERS, Ted_Buffer);
     ctx->bg_color = vec3{2.0f / 255.0f, 26.0f / 255.0f, 25.0f / 255.0f};
     ctx->text_color = vec3{255.0f / 255.0f, 220.0f / 255.0f, 194.0f / 255.0f};
+    ctx->selection_color = vec3{20.0f / 255.0f, 70.0f / 255.0f, 90.0f / 255.0f};
+    ctx->token_colors[TOKEN_TEXT] = ctx->text_color;
+    ctx->token_colors[TOKEN_KEYWORD] = vec3{255.0f / 255.0f, 255.0f / 255.0f, 255.0f / 255.0f};
+    ctx->token_colors[TOKEN_TYPE] = vec3{140.0f / 255.0f, 220.0f / 255.0f, 180.0f / 255.0f};
+    ctx->token_colors[TOKEN_NUMBER] = vec3{170.0f / 255.0f, 200.0f / 255.0f, 255.0f / 255.0f};
+    ctx->token_colors[TOKEN_STRING] = vec3{190.0f / 255.0f, 230.0f / 255.0f, 120.0f / 255.0f};
+    ctx->token_colors[TOKEN_COMMENT] = vec3{110.0f / 255.0f, 140.0f / 255.0f, 120.0f / 255.0f};
+    ctx->token_colors[TOKEN_PREPROCESSOR] = vec3{220.0f / 255.0f, 170.0f / 255.0f, 230.0f / 255.0f};
+    ctx->token_colors[TOKEN_PUNCTUATION] = vec3{200.0f / 255.0f, 190.0f / 255.0f, 170.0f / 255.0f};
+    ctx->token_colors[TOKEN_BRACKET + 0] = vec3{230.0f / 255.0f, 200.0f / 255.0f, 110.0f / 255.0f};
+    ctx->token_colors[TOKEN_BRACKET + 1] = vec3{200.0f / 255.0f, 140.0f / 255.0f, 220.0f / 255.0f};
+    ctx->token_colors[TOKEN_BRACKET + 2] = vec3{110.0f / 255.0f, 180.0f / 255.0f, 240.0f / 255.0f};
+    ctx->c_grammar = push_struct(&ctx->arena, Syntax_Grammar);
+    init_c_grammar(ctx->c_grammar);
     ctx->buffer_max_x = 4; // @Todo: make it customizable constant.
 
 #if TED_DEBUG
     ctx->debug_atlas = push_struct(&ctx->arena, Font_Atlas);
 #endif
+
+    // Main thread takes part in jobs while waiting for them.
+    init_job_queue(ctx->jobs, max(cpu_core_count() - 1, 0));
 }
 
 void destroy(Ted_Context* ctx)
 {    
     // @Cleanup: these frees should not be here after gap buffer will use memory arena.
     for (s16 i = 0; i < ctx->buffer_count; ++i)
-        free(&ctx->buffers[i].display_buffer);
+        kill_buffer(ctx, i);
+    free(ctx->line_layouts->offsets);
 
     clear(&ctx->arena);
     glfwTerminate();
@@ -275,13 +491,16 @@ void create_window(Ted_Context* ctx, s16 w, s16 h, s16 x, s16 y)
     glfwSetWindowUserPointer(ctx->window, ctx);
     
     glfwMakeContextCurrent(ctx->window);
-    glfwSwapInterval(0);
+    glfwSwapInterval(1);
 
     glfwSetWindowSizeCallback(ctx->window, window_size_callback);
     glfwSetFramebufferSizeCallback(ctx->window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(ctx->window, window_refresh_callback);
     glfwSetCharCallback(ctx->window, char_callback);
     glfwSetKeyCallback(ctx->window, key_callback);
     glfwSetScrollCallback(ctx->window, scroll_callback);
+    glfwSetMouseButtonCallback(ctx->window, mouse_button_callback);
+    glfwSetCursorPosCallback(ctx->window, cursor_pos_callback);
     glfwSetDropCallback(ctx->window, drop_callback);
 }
 
@@ -290,6 +509,11 @@ void load_font(Ted_Context* ctx, const char* path)
     init_font(ctx->font, &ctx->arena, path);
 }
 
+void add_fallback_font(Ted_Context* ctx, const char* path)
+{
+    add_fallback_font(ctx->font, &ctx->arena, path);
+}
+
 static void init_cursor_render_context(Ted_Cursor_Render_Context* ctx, Arena* arena)
 {
     ctx->program = gl_load_program(arena, DIR_SHADERS "cursor.vs", DIR_SHADERS "cursor.fs");
@@ -331,40 +555,125 @@ void init_render_context(Ted_Context* ctx)
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    init_font_render_context(ctx->font_render_ctx, &ctx->arena, ctx->window_w, ctx->window_h);
+    init_font_render_context(ctx->font_render_ctx, &ctx->arena, ctx->window_w, ctx->window_h, ted_settings.sdf_glyphs);
     init_cursor_render_context(ctx->cursor_render_ctx, &ctx->arena);
+    init_glyph_cache(ctx->glyph_cache, &ctx->arena, ctx->font, ted_settings.atlas_memory_budget, ted_settings.sdf_glyphs);
+    init_shape_cache(ctx->shape_cache, &ctx->arena, ted_settings.kerning, ted_settings.ligatures);
 
     on_framebuffer_resize(ctx->font_render_ctx->program, ctx->window_w, ctx->window_h);
     on_framebuffer_resize(ctx->cursor_render_ctx->program, ctx->window_w, ctx->window_h);
+
+    s32 frame_w, frame_h;
+    glfwGetFramebufferSize(ctx->window, &frame_w, &frame_h);
+    resize_frame_target(ctx, frame_w, frame_h);
+    damage_window(ctx);
 }
 
+// Only register atlases, they are baked on first use, see use_active_atlas and prefetch_atlas.
 void bake_font(Ted_Context* ctx, u32 start_charcode, u32 end_charcode, s16 min_font_size, s16 max_font_size, s16 font_size_stride)
 {
     s16 i = 0;
     for (s16 font_size = min_font_size; font_size <= max_font_size; font_size += font_size_stride, ++i)
     {
         if (i >= TED_MAX_ATLASES) break;
-        bake_font_atlas(ctx->atlases + i, &ctx->arena, ctx->font, start_charcode, end_charcode, font_size);
+        init_font_atlas(ctx->atlases + i, ctx->font, start_charcode, end_charcode, font_size);
     }
 
     ctx->atlas_count = i;
     ctx->active_atlas_idx = i / 2;
 
 #if TED_DEBUG
-    bake_font_atlas(ctx->debug_atlas, &ctx->arena, ctx->font, 0, 127, 16);
+    init_font_atlas(ctx->debug_atlas, ctx->font, 0, 127, 16);
+    bake_font_atlas(ctx->debug_atlas, ctx->glyph_cache, ctx->jobs);
 #endif
 }
 
+// Grow heap array of count elements of given size, new elements are zero.
+static void grow_array(void** data, s32 count, s32 new_count, s32 element_size)
+{
+    *data = realloc(*data, (u64)new_count * element_size);
+    memset((u8*)*data + (u64)count * element_size, 0, (u64)(new_count - count) * element_size);
+}
+
+// Per line arrays and trees grow to power of two capacity that fits given line count, so
+// bracket tree keeps its shape. One line past last one is always kept zero, line shifts read it.
+// Fenwick trees do not depend on capacity and stay valid, others are rebuilt on next query.
+static void reserve_lines(Ted_Buffer* buffer, s32 count)
+{
+    assert(count <= TED_MAX_LINE_COUNT);
+    if (count < buffer->line_capacity) return;
+
+    const s32 prev_capacity = buffer->line_capacity;
+    s32 capacity = max(prev_capacity, TED_MIN_LINE_CAPACITY);
+    while (capacity <= count) capacity *= 2;
+    
+    // @Cleanup: line info is on heap like gap buffers until arenas can grow.
+    grow_array((void**)&buffer->line_lengths, prev_capacity, capacity, sizeof(s32));
+    grow_array((void**)&buffer->line_tree, prev_capacity + 1, capacity + 1, sizeof(s32));
+    grow_array((void**)&buffer->wrap_counts, prev_capacity, capacity, sizeof(s32));
+    grow_array((void**)&buffer->visual_tree, prev_capacity + 1, capacity + 1, sizeof(s32));
+    grow_array((void**)&buffer->fold_sizes, prev_capacity, capacity, sizeof(s32));
+    grow_array((void**)&buffer->folded, prev_capacity, capacity, sizeof(bool));
+    grow_array((void**)&buffer->line_widths, prev_capacity, capacity, sizeof(s32));
+    grow_array((void**)&buffer->width_tree, 2 * prev_capacity, 2 * capacity, sizeof(s32));
+    grow_array((void**)&buffer->lex_states, prev_capacity, capacity, sizeof(u8));
+    grow_array((void**)&buffer->line_brackets, prev_capacity, capacity, sizeof(Depth_Summary));
+    grow_array((void**)&buffer->bracket_tree, 2 * prev_capacity, 2 * capacity, sizeof(Depth_Summary));
+
+    buffer->line_capacity = capacity;
+    buffer->width_tree_stale_row = 0;
+    buffer->width_tree_end = capacity;
+    buffer->bracket_tree_stale_row = 0;
+    buffer->bracket_tree_end = capacity;
+}
+
+static void free_array(void** data)
+{
+    free(*data);
+    *data = null;
+}
+
+static void free_lines(Ted_Buffer* buffer)
+{
+    free_array((void**)&buffer->line_lengths);
+    free_array((void**)&buffer->line_tree);
+    free_array((void**)&buffer->wrap_counts);
+    free_array((void**)&buffer->visual_tree);
+    free_array((void**)&buffer->fold_sizes);
+    free_array((void**)&buffer->folded);
+    free_array((void**)&buffer->line_widths);
+    free_array((void**)&buffer->width_tree);
+    free_array((void**)&buffer->lex_states);
+    free_array((void**)&buffer->line_brackets);
+    free_array((void**)&buffer->bracket_tree);
+    buffer->line_capacity = 0;
+}
+
 s16 create_buffer(Ted_Context* ctx)
 {
-    if (ctx->buffer_count > TED_MAX_BUFFERS) return INVALID_INDEX;
+    if (ctx->buffer_count >= TED_MAX_BUFFERS) return INVALID_INDEX;
+    if (ctx->arena.used + TED_MAX_BUFFER_SIZE > ctx->arena.size)
+    {
+        printf("Not enough memory for new buffer\n");
+        return INVALID_INDEX;
+    }
 
     auto* atlas = active_atlas(ctx);
     auto* buffer = ctx->buffers + ctx->buffer_count;
+    *buffer = {};
     buffer->arena = subarena(&ctx->arena, TED_MAX_BUFFER_SIZE);
-    buffer->path = push_array(&buffer->arena, 256, char);
-    buffer->line_lengths = push_array(&buffer->arena, TED_MAX_LINE_COUNT, s32);
+    buffer->path = push_array(&buffer->arena, TED_MAX_FILE_NAME_SIZE, char);
+    reserve_lines(buffer, 1);
+    buffer->wrap_atlas = null;
+    buffer->width_atlas = null;
+    buffer->lex_states[0] = LEX_CODE | LEX_STATE_DIRTY;
+    buffer->lex_next_row = 0;
+    buffer->extra_cursors = push_array(&buffer->arena, TED_MAX_CURSORS, s32);
+    buffer->extra_cursor_count = 0;
+    buffer->undo_buffer = {};
+    buffer->anchor_row = INVALID_INDEX;
     buffer->x = ctx->buffer_max_x;
+    buffer->cursor.preferred_x = INVALID_INDEX;
 
     strcpy(buffer->path, "dummy");
         
@@ -380,12 +689,17 @@ void load_file_contents(Ted_Context* ctx, s16 buffer_idx, const char* path)
 
     auto* buffer = ctx->buffers + buffer_idx;
     strcpy(buffer->path, path);
+    buffer->grammar = find_grammar(ctx->c_grammar, path);
 
-    s32 size = 0; // includes null-termination character
-    u8* data = read_entire_file(&buffer->arena, path, &size);
-
-    // @Todo: handle non-ascii?
-    push_str(ctx, buffer_idx, (char*)data, size - 1);
+    // File is mapped and copied straight into gap buffer, so its size is not bound by buffer arena.
+    Mapped_File file;
+    if (map_file(&file, path))
+    {
+        assert(file.size < 0x7FFFFFFF);
+        push_str(ctx, buffer_idx, (const char*)file.data, (s32)file.size);
+        unmap_file(&file);
+    }
+    
     set_cursor(ctx, buffer_idx, 0, 0);
 }
 
@@ -397,6 +711,8 @@ void kill_buffer(Ted_Context* ctx, s16 buffer_idx)
     clear(&buffer->arena);
     // @Cleanup: this gap buffer free should be removed as arena must handle buffer memory.
     free(&buffer->display_buffer);
+    if (buffer->undo_buffer.start) free(&buffer->undo_buffer);
+    free_lines(buffer);
 }
 
 void set_active_buffer(Ted_Context* ctx, s16 buffer_idx)
@@ -405,6 +721,7 @@ void set_active_buffer(Ted_Context* ctx, s16 buffer_idx)
     ctx->active_buffer_idx = buffer_idx;
 
     glfwSetWindowTitle(ctx->window, active_buffer(ctx)->path);
+    damage_window(ctx);
 }
 
 void open_next_buffer(Ted_Context* ctx)
@@ -414,6 +731,7 @@ void open_next_buffer(Ted_Context* ctx)
         ctx->active_buffer_idx = 0;
 
     glfwSetWindowTitle(ctx->window, active_buffer(ctx)->path);
+    damage_window(ctx);
 }
 
 void open_prev_buffer(Ted_Context* ctx)
@@ -423,337 +741,2415 @@ void open_prev_buffer(Ted_Context* ctx)
         ctx->active_buffer_idx = ctx->buffer_count - 1;
 
     glfwSetWindowTitle(ctx->window, active_buffer(ctx)->path);
+    damage_window(ctx);
+}
+
+static void use_active_atlas(Ted_Context* ctx)
+{
+    auto* atlas = active_atlas(ctx);
+    if (!atlas->baked) bake_font_atlas(atlas, ctx->glyph_cache, ctx->jobs);
+}
+
+// Bake one not yet baked neighbour of active atlas, so next zoom step does not stall.
+// Baking never evicts glyphs, so prefetch can't push out glyphs that are in use.
+static bool prefetch_atlas(Ted_Context* ctx)
+{
+    const s16 neighbour_idxs[2] = { (s16)(ctx->active_atlas_idx + 1), (s16)(ctx->active_atlas_idx - 1) };
+    for (s16 idx : neighbour_idxs)
+    {
+        if (idx < 0 || idx >= ctx->atlas_count) continue;
+
+        auto* atlas = ctx->atlases + idx;
+        if (atlas->baked) continue;
+        
+        bake_font_atlas(atlas, ctx->glyph_cache, ctx->jobs);
+        return true;
+    }
+
+    return false;
 }
 
 // @Fixme
 void increase_font_size(Ted_Context* ctx)
 {
     ctx->active_atlas_idx = min(ctx->atlas_count - 1, ctx->active_atlas_idx + 1);
+    damage_window(ctx);
 }
 
 // @Fixme
 void decrease_font_size(Ted_Context* ctx)
 {
     ctx->active_atlas_idx = max(0, ctx->active_atlas_idx - 1);
+    damage_window(ctx);
 }
 
-static void insert_line(Ted_Buffer* buffer, s32 idx, s32 line_length)
+// Glyphs of render_buffer are drawn in batches of FONT_RENDER_BATCH_SIZE.
+struct Glyph_Batch
 {
-    buffer->last_line_idx++;
-    for (s32 i = buffer->last_line_idx; i > idx; --i)
-        buffer->line_lengths[i] = buffer->line_lengths[i - 1];
+    Font_Render_Context* render_ctx;
+    Glyph_Cache* cache;
+    const Font_Atlas* atlas;
+    const vec3* colors; // of each token kind
+    s32 count;
+};
+
+static void push_glyph(Glyph_Batch* batch, u32 glyph_id, s32 x, s32 y, Token_Kind kind)
+{
+    const Cached_Glyph* glyph = get_glyph(batch->cache, batch->atlas, glyph_id);
+    if (!glyph || glyph->shelf_idx == INVALID_INDEX) return;
 
-    buffer->line_lengths[idx] = line_length;
+    push_glyph(batch->render_ctx, glyph, batch->count, (f32)x, (f32)y, 1.0f, batch->colors + kind);
+            
+    if (++batch->count >= FONT_RENDER_BATCH_SIZE)
+    {
+        render_glyph_batch(batch->render_ctx, batch->cache, batch->count);
+        batch->count = 0;
+    }
 }
 
-static void remove_line(Ted_Buffer* buffer, s32 idx)
+// Layout policies of buffer text, render_buffer is specialized for each of them.
+// Glyphs of monospace font sit on column grid, so x is column * advance and no
+// shaping is needed, only glyphs from fallback fonts keep their own advance.
+// Monospace fonts are not kerned and ones with ligatures take shaped path.
+struct Monospace_Layout
 {
-    for (s32 i = idx; i <= buffer->last_line_idx; ++i)
-        buffer->line_lengths[i] = buffer->line_lengths[i + 1];
-
-    buffer->line_lengths[buffer->last_line_idx] = 0;
-    buffer->last_line_idx--;
-}
+    Font* font;
+    const Font_Atlas* atlas;
+    s32 advance;
+    s32 tab_advance;
+};
+
+// Kerned and ligated runs of shape cache, general path for any font.
+struct Shaped_Layout
+{
+    Shape_Cache* cache;
+    Font* font;
+    const Font_Atlas* atlas;
+};
 
-void push_char(Ted_Context* ctx, s16 buffer_idx, char c)
+// Glyph takes color of token kind of its first byte.
+static void render_line(const Monospace_Layout* layout, Glyph_Batch* batch, const char* line, const Token_Kind* kinds, s32 size, s32 x, s32 y)
 {
-    assert(buffer_idx < ctx->buffer_count);
-    
-    auto* buffer = ctx->buffers + buffer_idx;
-    push_char(&buffer->display_buffer, c);
-    
-    if (c == '\n')
-    {   
-        if (buffer->last_line_idx >= TED_MAX_LINE_COUNT)
+    for (s32 i = 0; i < size;)
+    {
+        const char c = line[i];
+        if (c == '\t')
         {
-            printf("Reached max line count (%d)\n", TED_MAX_LINE_COUNT);
-            return;
+            x += layout->tab_advance;
+            i++;
+        }
+        else if ((u8)c < 0x80)
+        {
+            push_glyph(batch, get_glyph_index(layout->font, c), x, y, kinds[i]);
+            x += layout->advance;
+            i++;
+        }
+        else
+        {
+            s32 sequence_size;
+            const u32 glyph_id = get_glyph_index(layout->font, next_codepoint(line + i, size - i, &sequence_size));
+            push_glyph(batch, glyph_id, x, y, kinds[i]);
+            x += get_glyph_advance(layout->font, layout->atlas, glyph_id);
+            i += sequence_size;
         }
+    }
+}
 
-        const s32 right_line_part_length = buffer->line_lengths[buffer->cursor.row] - buffer->cursor.col;
+static void render_line(const Shaped_Layout* layout, Glyph_Batch* batch, const char* line, const Token_Kind* kinds, s32 size, s32 x, s32 y)
+{
+    // Shaped once per line contents, so unchanged lines only look up their run.
+    const Shaped_Run* run = shape_line(layout->cache, layout->font, layout->atlas, line, size);
+    for (s32 i = 0; i < run->glyph_count; ++i)
+    {
+        const Shaped_Glyph* glyph = run->glyphs + i;
+        push_glyph(batch, glyph->glyph_id, x + glyph->x, y, kinds[glyph->cluster]);
+    }
+}
+
+
+// Fill x of lead bytes of line and of line end.
+static void fill_line_x(const Monospace_Layout* layout, const char* line, s32 size, Ted_Line_Offset* offsets)
+{
+    s32 x = 0;
+    for (s32 i = 0; i < size;)
+    {
+        offsets[i].x = x;
         
-        buffer->line_lengths[buffer->cursor.row] -= right_line_part_length;
-        insert_line(buffer, buffer->cursor.row + 1, right_line_part_length);
+        const char c = line[i];
+        if ((u8)c < 0x80)
+        {
+            x += c == '\t' ? layout->tab_advance : layout->advance;
+            i++;
+            continue;
+        }
 
-        buffer->cursor.row++;
-        buffer->cursor.col = 0;
+        s32 sequence_size;
+        const u32 glyph_id = get_glyph_index(layout->font, next_codepoint(line + i, size - i, &sequence_size));
+        x += get_glyph_advance(layout->font, layout->atlas, glyph_id);
+        i += sequence_size;
     }
-    else
-    {
-        buffer->cursor.col++;
-        buffer->line_lengths[buffer->cursor.row] += 1;
-    }    
+
+    offsets[size].x = x;
 }
 
-void push_str(Ted_Context* ctx, s16 buffer_idx, const char* str, s32 size)
+static void fill_line_x(const Shaped_Layout* layout, const char* line, s32 size, Ted_Line_Offset* offsets)
 {
-    // @Cleanup: brute-force implementation for now.
-    // @Speed: this will be very slow if string has several lines.
-    for (s32 i = 0; i < size; ++i)
-        push_char(ctx, buffer_idx, str[i]);
+    const Shaped_Run* run = shape_line(layout->cache, layout->font, layout->atlas, line, size);
+    for (s32 i = 0; i <= size; ++i)
+        offsets[i].x = caret_x(run, i);
 }
 
-void delete_char(Ted_Context* ctx, s16 buffer_idx)
+static bool is_monospace_layout(Ted_Context* ctx, const Font_Atlas* atlas)
 {
-    assert(buffer_idx < ctx->buffer_count);
-    
-    auto* buffer = ctx->buffers + buffer_idx;
-    auto* display_buffer = &buffer->display_buffer;
+    // Ligatures of monospace font still need shaping.
+    return atlas->monospace_advance && !has_ligatures(ctx->shape_cache, ctx->font);
+}
 
-    const char c_deleted = delete_char(display_buffer);
-    if (c_deleted == '\n')
-    {   
-        const s32 deleted_line_length = buffer->line_lengths[buffer->cursor.row];
-        const s32 prev_line_length = buffer->line_lengths[buffer->cursor.row - 1];
-        buffer->line_lengths[buffer->cursor.row - 1] += deleted_line_length;
-        remove_line(buffer, buffer->cursor.row);
- 
-        buffer->cursor.row--;
-        buffer->cursor.col = prev_line_length;
-    }
-    else if (c_deleted != INVALID_CHAR)
+static Monospace_Layout make_monospace_layout(Ted_Context* ctx, const Font_Atlas* atlas)
+{
+    return { ctx->font, atlas, atlas->monospace_advance, ted_settings.tab_size * atlas->monospace_advance };
+}
+
+static Shaped_Layout make_shaped_layout(Ted_Context* ctx, const Font_Atlas* atlas)
+{
+    return { ctx->shape_cache, ctx->font, atlas };
+}
+
+static void drop_line_layouts(Ted_Context* ctx, s16 buffer_idx, s32 first_row, s32 last_row)
+{
+    for (s32 i = 0; i < TED_LINE_LAYOUT_CACHE_SIZE; ++i)
     {
-        buffer->cursor.col--;
-        buffer->line_lengths[buffer->cursor.row] -= 1;
+        auto* line = ctx->line_layouts->lines + i;
+        if (line->buffer_idx == buffer_idx && line->row >= first_row && line->row <= last_row)
+            line->atlas = null;
     }
 }
 
-void delete_char_overwrite(Ted_Context* ctx, s16 buffer_idx)
+// Layout of buffer line that starts at given pointer position, valid until next call.
+static const Ted_Line_Layout* get_line_layout(Ted_Context* ctx, s16 buffer_idx, const Font_Atlas* atlas, s32 row, s32 pos)
 {
-    assert(buffer_idx < ctx->buffer_count);
+    auto* cache = ctx->line_layouts;
+    auto* line = cache->lines + (row & (TED_LINE_LAYOUT_CACHE_SIZE - 1));
+    if (line->atlas == atlas && line->buffer_idx == buffer_idx && line->row == row) return line;
+
+    const auto* buffer = ctx->buffers + buffer_idx;
+    const s32 size = buffer->line_lengths[row];
     
-    auto* buffer = ctx->buffers + buffer_idx;
-    auto* display_buffer = &buffer->display_buffer;
+    if (cache->offset_count + size + 1 > cache->offset_capacity)
+    {
+        memset(cache->lines, 0, sizeof(cache->lines));
+        cache->offset_count = 0;
 
-    const char c_deleted = delete_char_overwrite(display_buffer);
+        // Edits and pastes may make line longer than any loaded file, flushed array grows to fit it.
+        if (size + 1 > cache->offset_capacity)
+        {
+            cache->offset_capacity = max(size + 1, 2 * cache->offset_capacity);
+            cache->offsets = (Ted_Line_Offset*)realloc(cache->offsets, cache->offset_capacity * sizeof(Ted_Line_Offset));
+        }
+    }
 
-    if (c_deleted == '\n')
+    line->atlas = atlas;
+    line->row = row;
+    line->size = size;
+    line->buffer_idx = buffer_idx;
+    line->offsets = cache->offsets + cache->offset_count;
+    cache->offset_count += size + 1;
+
+    // Line may be split by gap, layout wants it in one piece.
+    char* text = (char*)push(&ctx->arena, size);
+    copy_data(&buffer->display_buffer, pos, size, text);
+    
+    if (is_monospace_layout(ctx, atlas))
     {
-        const s32 deleted_line_length = buffer->line_lengths[buffer->cursor.row + 1];
-        buffer->line_lengths[buffer->cursor.row] += deleted_line_length;
-        remove_line(buffer, buffer->cursor.row + 1);
+        const Monospace_Layout layout = make_monospace_layout(ctx, atlas);
+        fill_line_x(&layout, text, size, line->offsets);
     }
-    else if (c_deleted != INVALID_CHAR)
+    else
     {
-        buffer->line_lengths[buffer->cursor.row] -= 1;
+        const Shaped_Layout layout = make_shaped_layout(ctx, atlas);
+        fill_line_x(&layout, text, size, line->offsets);
     }
-}
-
-// Set cursor position and update gap buffer pointer according to new cursor.
-void set_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
-{
-    assert(buffer_idx < ctx->buffer_count);
-
-    auto* buffer = ctx->buffers + buffer_idx;
-    auto* display_buffer = &buffer->display_buffer;
 
-    if (row < 0 || row > buffer->last_line_idx)
+    s32 column = 0;
+    for (s32 i = 0; i < size;)
     {
-        printf("Incorrect cursor row position (%d)\n", row);
-        return;
+        s32 sequence_size;
+        const u32 codepoint = next_codepoint(text + i, size - i, &sequence_size);
+
+        line->offsets[i].column = column;
+        for (s32 j = 1; j < sequence_size; ++j)
+            line->offsets[i + j] = line->offsets[i];
+        
+        column += codepoint == '\t' ? ted_settings.tab_size : 1;
+        i += sequence_size;
     }
 
-    const s32 line_length = buffer->line_lengths[row];
-    if (col < 0 || col > line_length)
+    line->offsets[size].column = column;
+
+    pop(&ctx->arena, size);
+    return line;
+}
+
+// First byte with x not less than given one.
+static s32 lower_bound_x(const Ted_Line_Layout* line, s32 x)
+{
+    s32 low = 0;
+    s32 high = line->size + 1;
+    while (low < high)
     {
-        printf("Incorrect cursor col position (%d)\n", col);
-        return;
+        const s32 mid = low + (high - low) / 2;
+        if (line->offsets[mid].x < x) low = mid + 1;
+        else high = mid;
     }
 
-    s32 pos = 0;
-    for (s32 i = 0; i < row; ++i)
-        pos += buffer->line_lengths[i] + 1; // include '\n' for pointer position
-    pos += col;
-    
-    set_pointer(display_buffer, pos);
-    
-    buffer->cursor.row = row;
-    buffer->cursor.col = col;
+    return low;
 }
 
-void move_cursor_horizontally(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+// Char boundary closest to given pixel x, never inside utf8 sequence.
+static s32 line_byte_at_x(const Ted_Line_Layout* line, s32 x)
 {
-    assert(buffer_idx < ctx->buffer_count);
-    const auto* buffer = ctx->buffers + buffer_idx;
+    const s32 next = lower_bound_x(line, x);
+    if (next == 0) return 0;
+    if (next > line->size) return line->size;
+
+    // Continuation bytes share x of their lead, so lower bound lands on it.
+    const s32 prev = lower_bound_x(line, line->offsets[next - 1].x);
+    return x - line->offsets[prev].x < line->offsets[next].x - x ? prev : next;
+}
+
+// Lines above stale row kept their sizes, so only nodes of lines from it are rebuilt.
+static const s32* get_line_tree(Ted_Buffer* buffer)
+{
+    const s32 count = buffer->last_line_idx + 1;
+    const s32 stale_row = buffer->line_tree_stale_row;
+    if (stale_row < count)
+    {
+        for (s32 i = stale_row; i < count; ++i)
+            buffer->line_tree[i + 1] = buffer->line_lengths[i] + 1;
+        
+        build_fenwick_tree(buffer->line_tree, count, stale_row);
+        buffer->line_tree_stale_row = INT32_MAX;
+    }
+
+    return buffer->line_tree;
+}
+
+// Pointer position of first char of line.
+static s32 line_start_pos(Ted_Buffer* buffer, s32 row)
+{
+    return fenwick_prefix_sum(get_line_tree(buffer), row);
+}
+
+// Line of pointer position, line end belongs to its line.
+static s32 row_at_pos(Ted_Buffer* buffer, s32 pos)
+{
+    s32 sum = pos;
+    return fenwick_lower_bound(get_line_tree(buffer), buffer->last_line_idx + 1, &sum);
+}
+
+static s32 get_wrap_width(const Ted_Context* ctx)
+{
+    return max(ctx->window_w - 2 * ctx->buffer_max_x, 1);
+}
+
+// Not measured lines take one visual line, stale ones keep previous count until measured again.
+static s32 effective_wrap_count(s32 wrap_count)
+{
+    return wrap_count == 0 ? 1 : abs(wrap_count);
+}
+
+// Visual lines line takes on screen, lines hidden by fold take none.
+static s32 visual_line_count(const Ted_Buffer* buffer, s32 row)
+{
+    if (buffer->folded[row]) return 0;
+    return ted_settings.soft_wrap ? effective_wrap_count(buffer->wrap_counts[row]) : 1;
+}
+
+// Visual rows differ from buffer rows only with soft wrap or folds.
+static bool has_visual_rows(const Ted_Buffer* buffer)
+{
+    return ted_settings.soft_wrap || buffer->fold_count > 0;
+}
+
+static const s32* get_visual_tree(Ted_Buffer* buffer)
+{
+    const s32 count = buffer->last_line_idx + 1;
+    const s32 stale_row = buffer->visual_tree_stale_row;
+    if (stale_row < count)
+    {
+        for (s32 i = stale_row; i < count; ++i)
+            buffer->visual_tree[i + 1] = visual_line_count(buffer, i);
+        
+        build_fenwick_tree(buffer->visual_tree, count, stale_row);
+        buffer->visual_tree_stale_row = INT32_MAX;
+    }
+    
+    return buffer->visual_tree;
+}
+
+// Visual row of first visual line of buffer line, rows past the end take one visual line each.
+static s32 first_visual_row(Ted_Buffer* buffer, s32 row)
+{
+    if (!has_visual_rows(buffer)) return row;
+    
+    const s32 count = buffer->last_line_idx + 1;
+    if (row > count) return fenwick_prefix_sum(get_visual_tree(buffer), count) + row - count;
+    
+    return fenwick_prefix_sum(get_visual_tree(buffer), row);
+}
+
+static s32 visual_row_count(Ted_Buffer* buffer)
+{
+    return first_visual_row(buffer, buffer->last_line_idx + 1);
+}
+
+// Buffer line of visual row clamped to buffer and index of visual line in it.
+// Hidden lines take no visual rows, so lower bound lands on visible line.
+static s32 find_visual_row(Ted_Buffer* buffer, s32 visual_row, s32* segment)
+{
+    visual_row = clamp(visual_row, 0, visual_row_count(buffer) - 1);
+    if (!has_visual_rows(buffer))
+    {
+        *segment = 0;
+        return visual_row;
+    }
+
+    *segment = visual_row;
+    return fenwick_lower_bound(get_visual_tree(buffer), buffer->last_line_idx + 1, segment);
+}
+
+// Visual rows with baseline inside window, they are of equal height so no line above is walked.
+static void get_visible_rows(const Ted_Context* ctx, Ted_Buffer* buffer, const Font_Atlas* atlas, s32* first_row, s32* last_row)
+{
+    const s32 line_height = atlas->line_height;
+    *first_row = max(0, (buffer->y - ctx->window_h + line_height - 1) / line_height);
+    *last_row = buffer->y < 0 ? -1 : min(visual_row_count(buffer) - 1, buffer->y / line_height);
+}
+
+// Wrap counts depend on width and atlas, all lines are measured again when they change.
+static void sync_wrap_index(Ted_Context* ctx, Ted_Buffer* buffer)
+{
+    const auto* atlas = active_atlas(ctx);
+    const s32 width = get_wrap_width(ctx);
+    if (buffer->wrap_atlas == atlas && buffer->wrap_width == width) return;
+
+    memset(buffer->wrap_counts, 0, (buffer->last_line_idx + 1) * sizeof(s32));
+    buffer->visual_tree_stale_row = 0;
+    buffer->wrap_atlas = atlas;
+    buffer->wrap_width = width;
+    buffer->wrap_next_row = 0;
+}
+
+static void set_wrap_count(Ted_Context* ctx, Ted_Buffer* buffer, s32 row, s32 count)
+{
+    const s32 prev_count = effective_wrap_count(buffer->wrap_counts[row]);
+    if (count == prev_count || buffer->folded[row])
+    {
+        buffer->wrap_counts[row] = count;
+        return;
+    }
+
+    // Placement is taken before count changes, tree is valid after these queries.
+    s32 first_visible_row, last_visible_row;
+    get_visible_rows(ctx, buffer, buffer->wrap_atlas, &first_visible_row, &last_visible_row);
+    const s32 visual_row = first_visual_row(buffer, row);
+    
+    buffer->wrap_counts[row] = count;
+    add_fenwick_value(buffer->visual_tree, buffer->last_line_idx + 1, row, count - prev_count);
+
+    // Keep text on screen in place when line above it changes height, lines below only move.
+    if (visual_row < first_visible_row) buffer->y += (count - prev_count) * buffer->wrap_atlas->line_height;
+    else if (visual_row <= last_visible_row) damage_window(ctx);
+}
+
+static void mark_wrap_stale(Ted_Buffer* buffer, s32 row)
+{
+    buffer->wrap_counts[row] = -effective_wrap_count(buffer->wrap_counts[row]);
+    buffer->wrap_next_row = min(buffer->wrap_next_row, row);
+}
+
+// Line widths depend on atlas, all lines are measured again when it changes.
+static void sync_width_index(Ted_Context* ctx, Ted_Buffer* buffer)
+{
+    const auto* atlas = active_atlas(ctx);
+    if (buffer->width_atlas == atlas) return;
+
+    memset(buffer->line_widths, 0xFF, (buffer->last_line_idx + 1) * sizeof(s32)); // INVALID_INDEX
+    buffer->width_tree_stale_row = 0;
+    buffer->width_atlas = atlas;
+    buffer->width_next_row = 0;
+}
+
+// Line is lexed again from its start state, lines below keep their states until it changes.
+static void mark_lex_stale(Ted_Buffer* buffer, s32 row)
+{
+    buffer->lex_states[row] |= LEX_STATE_DIRTY;
+    buffer->lex_next_row = min(buffer->lex_next_row, row);
+}
+
+// Stale lines keep their previous width in tree until they are measured again.
+static void mark_width_stale(Ted_Buffer* buffer, s32 row)
+{
+    buffer->line_widths[row] = INVALID_INDEX;
+    buffer->width_next_row = min(buffer->width_next_row, row);
+}
+
+static void measure_line_width(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 pos)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* line = get_line_layout(ctx, buffer_idx, buffer->width_atlas, row, pos);
+    const s32 width = line->offsets[line->size].x;
+    
+    buffer->line_widths[row] = width;
+    if (row < buffer->width_tree_stale_row)
+        set_max_tree_value(buffer->width_tree, buffer->line_capacity, row, width);
+}
+
+// Leaves of lines above stale row are in place, ones below it are set again together with
+// leaves of removed lines, then only their ancestors are updated.
+static s32 longest_line_width(Ted_Buffer* buffer)
+{
+    const s32 count = buffer->last_line_idx + 1;
+    const s32 first = buffer->width_tree_stale_row;
+    const s32 end = max(count, buffer->width_tree_end);
+    if (first < end)
+    {
+        auto* leaves = buffer->width_tree + buffer->line_capacity;
+        for (s32 i = first; i < end; ++i)
+            leaves[i] = i < count ? max(buffer->line_widths[i], 0) : 0;
+        
+        build_max_tree(buffer->width_tree, buffer->line_capacity, first, end);
+        buffer->width_tree_stale_row = INT32_MAX;
+        buffer->width_tree_end = count;
+    }
+
+    return max_tree_root(buffer->width_tree);
+}
+
+static void resize_line(Ted_Buffer* buffer, s32 row, s32 delta)
+{
+    buffer->line_lengths[row] += delta;
+    mark_wrap_stale(buffer, row);
+    mark_width_stale(buffer, row);
+    mark_lex_stale(buffer, row);
+    
+    if (row < buffer->line_tree_stale_row)
+        add_fenwick_value(buffer->line_tree, buffer->last_line_idx + 1, row, delta);
+}
+
+// Hide lines below header, folds are not nested. Visual tree is rebuilt from header on next
+// query, after that hidden lines are skipped by its lookups in log time.
+static void fold_lines(Ted_Buffer* buffer, s32 header_row, s32 size)
+{
+    assert(buffer->fold_sizes[header_row] == 0 && !buffer->folded[header_row]);
+    
+    buffer->fold_sizes[header_row] = size;
+    for (s32 i = header_row + 1; i <= header_row + size; ++i)
+        buffer->folded[i] = true;
+
+    buffer->fold_count++;
+    buffer->visual_tree_stale_row = min(buffer->visual_tree_stale_row, header_row + 1);
+}
+
+static void unfold_lines(Ted_Buffer* buffer, s32 header_row)
+{
+    if (header_row < 0 || buffer->fold_sizes[header_row] == 0) return;
+    
+    for (s32 i = header_row + 1; i <= header_row + buffer->fold_sizes[header_row]; ++i)
+        buffer->folded[i] = false;
+    
+    buffer->fold_sizes[header_row] = 0;
+    buffer->fold_count--;
+    buffer->visual_tree_stale_row = min(buffer->visual_tree_stale_row, header_row + 1);
+}
+
+// Fold header of hidden line, it is last visible line above.
+static s32 find_fold_header(Ted_Buffer* buffer, s32 row)
+{
+    s32 segment;
+    return find_visual_row(buffer, first_visual_row(buffer, row) - 1, &segment);
+}
+
+// Open fold that starts at line or hides it, so edited text never stays hidden.
+static void unfold_line(Ted_Buffer* buffer, s32 row)
+{
+    if (row < 0) return;
+    unfold_lines(buffer, buffer->folded[row] ? find_fold_header(buffer, row) : row);
+}
+
+// Advance to next visible line and its start position, fold below line is skipped as a whole.
+static void next_visible_line(Ted_Buffer* buffer, s32* row, s32* pos)
+{
+    const s32 next_row = *row + 1 + buffer->fold_sizes[*row];
+    *pos = next_row == *row + 1 ? *pos + buffer->line_lengths[*row] + 1 : line_start_pos(buffer, next_row);
+    *row = next_row;
+}
+
+// Line trees are rebuilt from given row on next query, lines above keep their nodes.
+static void mark_lines_moved(Ted_Buffer* buffer, s32 row)
+{
+    row = max(row, 0);
+    buffer->line_tree_stale_row = min(buffer->line_tree_stale_row, row);
+    buffer->visual_tree_stale_row = min(buffer->visual_tree_stale_row, row);
+    buffer->width_tree_stale_row = min(buffer->width_tree_stale_row, row);
+    buffer->bracket_tree_stale_row = min(buffer->bracket_tree_stale_row, row);
+}
+
+// Rows below line above given one are shifted, its length is set by caller.
+// Line split or merged with fold header or hidden line opens its fold, new lines never get hidden.
+static void insert_line(Ted_Buffer* buffer, s32 idx, s32 line_length)
+{
+    unfold_line(buffer, idx - 1);
+    reserve_lines(buffer, buffer->last_line_idx + 2);
+    
+    buffer->last_line_idx++;
+    for (s32 i = buffer->last_line_idx; i > idx; --i)
+    {
+        buffer->line_lengths[i] = buffer->line_lengths[i - 1];
+        buffer->wrap_counts[i] = buffer->wrap_counts[i - 1];
+        buffer->line_widths[i] = buffer->line_widths[i - 1];
+        buffer->fold_sizes[i] = buffer->fold_sizes[i - 1];
+        buffer->folded[i] = buffer->folded[i - 1];
+        buffer->lex_states[i] = buffer->lex_states[i - 1];
+        buffer->line_brackets[i] = buffer->line_brackets[i - 1];
+    }
+
+    buffer->line_lengths[idx] = line_length;
+    buffer->wrap_counts[idx] = 0;
+    buffer->fold_sizes[idx] = 0;
+    buffer->folded[idx] = false;
+    buffer->line_brackets[idx] = {};
+    mark_wrap_stale(buffer, idx - 1);
+    mark_width_stale(buffer, idx - 1);
+    mark_width_stale(buffer, idx);
+    mark_lex_stale(buffer, idx - 1);
+    mark_lex_stale(buffer, idx);
+    mark_lines_moved(buffer, idx - 1);
+}
+
+static void remove_line(Ted_Buffer* buffer, s32 idx)
+{
+    unfold_line(buffer, idx - 1);
+    unfold_line(buffer, idx);
+    
+    for (s32 i = idx; i <= buffer->last_line_idx; ++i)
+    {
+        buffer->line_lengths[i] = buffer->line_lengths[i + 1];
+        buffer->wrap_counts[i] = buffer->wrap_counts[i + 1];
+        buffer->line_widths[i] = buffer->line_widths[i + 1];
+        buffer->fold_sizes[i] = buffer->fold_sizes[i + 1];
+        buffer->folded[i] = buffer->folded[i + 1];
+        buffer->lex_states[i] = buffer->lex_states[i + 1];
+        buffer->line_brackets[i] = buffer->line_brackets[i + 1];
+    }
+
+    buffer->line_lengths[buffer->last_line_idx] = 0;
+    buffer->wrap_counts[buffer->last_line_idx] = 0;
+    buffer->line_brackets[buffer->last_line_idx] = {};
+    buffer->last_line_idx--;
+    mark_wrap_stale(buffer, idx - 1);
+    mark_width_stale(buffer, idx - 1);
+    mark_lex_stale(buffer, idx - 1);
+    mark_lines_moved(buffer, idx - 1);
+}
+
+// Move per line info of count lines starting from given one by delta rows.
+static void shift_lines(Ted_Buffer* buffer, s32 row, s32 count, s32 delta)
+{
+    memmove(buffer->line_lengths + row + delta, buffer->line_lengths + row, count * sizeof(s32));
+    memmove(buffer->wrap_counts + row + delta, buffer->wrap_counts + row, count * sizeof(s32));
+    memmove(buffer->line_widths + row + delta, buffer->line_widths + row, count * sizeof(s32));
+    memmove(buffer->fold_sizes + row + delta, buffer->fold_sizes + row, count * sizeof(s32));
+    memmove(buffer->folded + row + delta, buffer->folded + row, count * sizeof(bool));
+    memmove(buffer->lex_states + row + delta, buffer->lex_states + row, count * sizeof(u8));
+    memmove(buffer->line_brackets + row + delta, buffer->line_brackets + row, count * sizeof(Depth_Summary));
+}
+
+// Replace lines first_row..last_row with lines of text of given size at pos, which is start
+// of first_row. Text is scanned in place by simd, lines below are shifted once however many
+// lines were inserted or removed. New lines are stale in all indices, folds around them are opened.
+static void splice_lines(Ted_Buffer* buffer, s32 first_row, s32 last_row, s32 pos, s32 size)
+{
+    const auto* display_buffer = &buffer->display_buffer;
+    for (s32 row = first_row - 1; row <= last_row; ++row)
+        unfold_line(buffer, row);
+
+    const s32 new_count = count_char(display_buffer, pos, size, '\n') + 1;
+
+    const s32 delta = new_count - (last_row - first_row + 1);
+    reserve_lines(buffer, buffer->last_line_idx + 1 + max(delta, 0));
+
+    // Last new line ends where old last line did, so lexing goes on below it only if its state changes.
+    const u8 end_state = buffer->lex_states[last_row] & ~LEX_STATE_DIRTY;
+    
+    shift_lines(buffer, last_row + 1, buffer->last_line_idx - last_row, delta);
+    buffer->last_line_idx += delta;
+    
+    const s32 end = pos + size;
+    s32 line_pos = pos;
+    for (s32 row = first_row; row < first_row + new_count; ++row)
+    {
+        const s32 line_end = find_char(display_buffer, line_pos, end - line_pos, '\n');
+        buffer->line_lengths[row] = line_end - line_pos;
+        buffer->wrap_counts[row] = 0;
+        buffer->line_widths[row] = INVALID_INDEX;
+        buffer->fold_sizes[row] = 0;
+        buffer->folded[row] = false;
+        buffer->lex_states[row] = LEX_CODE | LEX_STATE_DIRTY;
+        buffer->line_brackets[row] = {};
+        line_pos = line_end + 1;
+    }
+
+    buffer->lex_states[first_row + new_count - 1] = end_state | LEX_STATE_DIRTY;
+
+    // Removed lines past new last line keep no info.
+    for (s32 row = buffer->last_line_idx + 1; row <= buffer->last_line_idx - delta; ++row)
+    {
+        buffer->line_lengths[row] = 0;
+        buffer->wrap_counts[row] = 0;
+        buffer->line_brackets[row] = {};
+    }
+    
+    buffer->wrap_next_row = min(buffer->wrap_next_row, first_row);
+    buffer->width_next_row = min(buffer->width_next_row, first_row);
+    buffer->lex_next_row = min(buffer->lex_next_row, first_row);
+    mark_lines_moved(buffer, first_row);
+}
+
+// All lines got new lengths at once, other line info is stale and folds are gone.
+// Lines past new last one up to given previous last one keep no info.
+static void reset_line_info(Ted_Buffer* buffer, s32 prev_last_line_idx)
+{
+    const s32 count = buffer->last_line_idx + 1;
+    memset(buffer->wrap_counts, 0, count * sizeof(s32));
+    memset(buffer->line_widths, 0xFF, count * sizeof(s32)); // INVALID_INDEX
+    memset(buffer->fold_sizes, 0, count * sizeof(s32));
+    memset(buffer->folded, 0, count * sizeof(bool));
+    memset(buffer->lex_states, LEX_CODE | LEX_STATE_DIRTY, count * sizeof(u8));
+    memset(buffer->line_brackets, 0, count * sizeof(Depth_Summary));
+
+    for (s32 row = count; row <= prev_last_line_idx; ++row)
+    {
+        buffer->line_lengths[row] = 0;
+        buffer->wrap_counts[row] = 0;
+        buffer->line_brackets[row] = {};
+    }
+    
+    buffer->fold_count = 0;
+    buffer->wrap_next_row = 0;
+    buffer->width_next_row = 0;
+    buffer->lex_next_row = 0;
+    mark_lines_moved(buffer, 0);
+}
+
+// Greedy wrap after last whitespace that fits, word wider than width is split at char boundary.
+// Fill starts of visual lines and return their amount.
+static s32 wrap_line(const Ted_Line_Layout* line, const char* text, s32 width, s32* starts)
+{
+    const auto* offsets = line->offsets;
+    s32 count = 0;
+    s32 start = 0;
+    s32 last_break = 0;
+    starts[count++] = 0;
+
+    for (s32 i = 0; i < line->size;)
+    {
+        s32 next = i + 1;
+        while (next < line->size && is_utf8_continuation((u8)text[next])) next++;
+
+        if (i > start && offsets[next].x - offsets[start].x > width)
+        {
+            start = last_break > start ? last_break : i;
+            starts[count++] = start;
+            continue;
+        }
+
+        if (text[i] == ' ' || text[i] == '\t') last_break = next;
+        i = next;
+    }
+
+    return count;
+}
+
+// Buffer line with its layout split into visual lines, a single one without soft wrap.
+struct Visual_Lines
+{
+    const Ted_Line_Layout* layout;
+    s32* starts; // byte offset of each visual line, one more entry for line end
+    s32 count;
+    u64 scratch_size;
+};
+
+// Soft wrap index is updated with measured line. Scratch memory is taken from ctx arena
+// till end_visual_lines, so calls have to be nested.
+static Visual_Lines begin_visual_lines(Ted_Context* ctx, s16 buffer_idx, const Font_Atlas* atlas, s32 row, s32 pos)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    const s32 size = buffer->line_lengths[row];
+    const u64 arena_used = ctx->arena.used;
+
+    Visual_Lines lines;
+    lines.starts = push_array(&ctx->arena, size + 2, s32);
+    lines.starts[0] = 0;
+    lines.count = 1;
+    
+    if (ted_settings.soft_wrap)
+    {
+        // Line may be split by gap, wrap wants it in one piece.
+        char* text = (char*)push(&ctx->arena, size);
+        copy_data(&buffer->display_buffer, pos, size, text);
+
+        sync_wrap_index(ctx, buffer);
+        lines.layout = get_line_layout(ctx, buffer_idx, atlas, row, pos);
+        lines.count = wrap_line(lines.layout, text, buffer->wrap_width, lines.starts);
+        set_wrap_count(ctx, buffer, row, lines.count);
+    }
+    else
+    {
+        lines.layout = get_line_layout(ctx, buffer_idx, atlas, row, pos);
+    }
+
+    lines.starts[lines.count] = size;
+    lines.scratch_size = ctx->arena.used - arena_used;
+    return lines;
+}
+
+static void end_visual_lines(Ted_Context* ctx, const Visual_Lines* lines)
+{
+    pop(&ctx->arena, lines->scratch_size);
+}
+
+// Visual line of byte offset, offset at wrap point belongs to following visual line.
+static s32 find_segment(const Visual_Lines* lines, s32 col)
+{
+    s32 segment = 0;
+    while (segment + 1 < lines->count && lines->starts[segment + 1] <= col) segment++;
+    return segment;
+}
+
+// Char boundary of visual line closest to x from start of visual line.
+static s32 segment_byte_at_x(const Visual_Lines* lines, s32 segment, s32 x)
+{
+    const auto* line = lines->layout;
+    const s32 start = lines->starts[segment];
+    const s32 col = line_byte_at_x(line, line->offsets[start].x + x);
+    
+    if (col < start) return start;
+    if (segment + 1 < lines->count && col >= lines->starts[segment + 1])
+        return max(start, lower_bound_x(line, line->offsets[lines->starts[segment + 1] - 1].x));
+    
+    return col;
+}
+
+// Measure wrap of visible lines before frame is drawn, so its damage covers lines that moved.
+// Return whether any line was measured, lines may come into view after that.
+static bool measure_visible_lines(Ted_Context* ctx, s16 buffer_idx)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* atlas = active_atlas(ctx);
+    sync_wrap_index(ctx, buffer);
+
+    s32 first_row, last_row;
+    get_visible_rows(ctx, buffer, atlas, &first_row, &last_row);
+    
+    s32 segment;
+    s32 row = find_visual_row(buffer, first_row, &segment);
+    s32 pos = line_start_pos(buffer, row);
+    bool measured = false;
+    
+    for (s32 visual_row = first_row - segment; visual_row <= last_row && row <= buffer->last_line_idx;)
+    {
+        if (buffer->wrap_counts[row] <= 0)
+        {
+            const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, row, pos);
+            end_visual_lines(ctx, &lines);
+            measured = true;
+        }
+
+        visual_row += visual_line_count(buffer, row);
+        next_visible_line(buffer, &row, &pos);
+    }
+
+    return measured;
+}
+
+// Measure lines below in idle time, batch at a time to keep input responsive.
+// Measured lines are skipped without layout, so batch goes over stale ones only.
+static bool measure_wrap_index(Ted_Context* ctx)
+{
+    if (!ted_settings.soft_wrap || ctx->buffer_count == 0) return false;
+
+    const s16 buffer_idx = ctx->active_buffer_idx;
+    auto* buffer = ctx->buffers + buffer_idx;
+    sync_wrap_index(ctx, buffer);
+    
+    if (buffer->wrap_next_row > buffer->last_line_idx) return false;
+
+    const auto* atlas = active_atlas(ctx);
+    s32 row = buffer->wrap_next_row;
+    s32 pos = line_start_pos(buffer, row);
+    
+    for (s32 measured = 0; measured < TED_MEASURE_BATCH && row <= buffer->last_line_idx; ++row)
+    {
+        if (buffer->wrap_counts[row] <= 0)
+        {
+            const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, row, pos);
+            end_visual_lines(ctx, &lines);
+            measured++;
+        }
+        
+        pos += buffer->line_lengths[row] + 1;
+    }
+
+    buffer->wrap_next_row = row;
+    return true;
+}
+
+// Same as measure_wrap_index for line widths, they are not needed with soft wrap.
+static bool measure_width_index(Ted_Context* ctx)
+{
+    if (ted_settings.soft_wrap || ctx->buffer_count == 0) return false;
+
+    const s16 buffer_idx = ctx->active_buffer_idx;
+    auto* buffer = ctx->buffers + buffer_idx;
+    sync_width_index(ctx, buffer);
+    
+    if (buffer->width_next_row > buffer->last_line_idx) return false;
+
+    s32 row = buffer->width_next_row;
+    s32 pos = line_start_pos(buffer, row);
+    
+    for (s32 measured = 0; measured < TED_MEASURE_BATCH && row <= buffer->last_line_idx; ++row)
+    {
+        if (buffer->line_widths[row] == INVALID_INDEX)
+        {
+            measure_line_width(ctx, buffer_idx, row, pos);
+            measured++;
+        }
+        
+        pos += buffer->line_lengths[row] + 1;
+    }
+
+    buffer->width_next_row = row;
+    return true;
+}
+
+// Depth change of byte, brackets in strings and comments do not count.
+static s32 bracket_delta(const Ted_Buffer* buffer, const char* text, const Token_Kind* kinds, s32 i)
+{
+    if (buffer->grammar && kinds[i] != TOKEN_PUNCTUATION) return 0;
+    
+    switch (text[i])
+    {
+    case '(': case '[': case '{': return 1;
+    case ')': case ']': case '}': return -1;
+    default:                      return 0;
+    }
+}
+
+static Depth_Summary summarize_brackets(const Ted_Buffer* buffer, const char* text, const Token_Kind* kinds, s32 size)
+{
+    Depth_Summary summary = {};
+    for (s32 i = 0; i < size; ++i)
+    {
+        summary.net += bracket_delta(buffer, text, kinds, i);
+        summary.min = min(summary.min, summary.net);
+    }
+
+    return summary;
+}
+
+static void set_line_brackets(Ted_Buffer* buffer, s32 row, Depth_Summary summary)
+{
+    buffer->line_brackets[row] = summary;
+    if (row < buffer->bracket_tree_stale_row)
+        set_depth_tree_value(buffer->bracket_tree, buffer->line_capacity, row, summary);
+}
+
+// Valid for lexed lines, leaves past last line stay zero. Leaves from stale row are copied
+// again, summaries of removed lines are zero already, then only their ancestors are updated.
+static const Depth_Summary* get_bracket_tree(Ted_Buffer* buffer)
+{
+    const s32 count = buffer->last_line_idx + 1;
+    const s32 first = buffer->bracket_tree_stale_row;
+    const s32 end = max(count, buffer->bracket_tree_end);
+    if (first < end)
+    {
+        const s32 capacity = buffer->line_capacity;
+        memcpy(buffer->bracket_tree + capacity + first, buffer->line_brackets + first, (end - first) * sizeof(Depth_Summary));
+        build_depth_tree(buffer->bracket_tree, capacity, first, end);
+        buffer->bracket_tree_stale_row = INT32_MAX;
+        buffer->bracket_tree_end = count;
+    }
+
+    return buffer->bracket_tree;
+}
+
+// Copy line text and fill kinds of its bytes, lines above have to be lexed.
+// Text is followed by kinds on arena, caller pops both.
+static char* read_line_tokens(Ted_Context* ctx, const Ted_Buffer* buffer, s32 row, s32 pos, Token_Kind** kinds)
+{
+    const s32 size = buffer->line_lengths[row];
+    
+    // Line may be split by gap, lexer and layout want it in one piece.
+    char* text = (char*)push(&ctx->arena, size);
+    copy_data(&buffer->display_buffer, pos, size, text);
+
+    *kinds = push_array(&ctx->arena, size, Token_Kind);
+    if (buffer->grammar)
+    {
+        const u8 state = row > 0 ? buffer->lex_states[row - 1] & ~LEX_STATE_DIRTY : LEX_CODE;
+        lex_line(buffer->grammar, text, size, state, *kinds);
+    }
+    else
+    {
+        memset(*kinds, TOKEN_TEXT, size);
+    }
+    
+    return text;
+}
+
+// Lex stale lines till given row, at most budget of them. Once end state of line did not
+// change, lines below keep their states and lexing jumps to next edited line, so edit costs
+// lines till state converges. Lines whose start state changed are redrawn. Bracket summary
+// of each lexed line is updated in the same pass, plain text is lexed as one code state.
+static bool lex_lines(Ted_Context* ctx, s16 buffer_idx, s32 last_row, s32 budget)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    last_row = min(last_row, buffer->last_line_idx);
+    
+    if (buffer->lex_next_row > last_row) return false;
+
+    s32 row = buffer->lex_next_row;
+    s32 pos = line_start_pos(buffer, row);
+    u8 state = row > 0 ? buffer->lex_states[row - 1] : LEX_CODE;
+    s32 first_changed_row = INVALID_INDEX;
+    s32 last_changed_row = INVALID_INDEX;
+    s32 first_depth_row = INVALID_INDEX;
+    
+    for (s32 lexed = 0; lexed < budget && row <= last_row; ++lexed)
+    {
+        const s32 size = buffer->line_lengths[row];
+        char* text = (char*)push(&ctx->arena, size);
+        copy_data(&buffer->display_buffer, pos, size, text);
+
+        auto* kinds = push_array(&ctx->arena, size, Token_Kind);
+        const u8 end_state = buffer->grammar ? lex_line(buffer->grammar, text, size, state, kinds) : LEX_CODE;
+        const u8 prev_end_state = buffer->lex_states[row] & ~LEX_STATE_DIRTY;
+        buffer->lex_states[row] = end_state;
+
+        // Depth of lines below changed, so do their bracket colors.
+        const Depth_Summary brackets = summarize_brackets(buffer, text, kinds, size);
+        if (brackets.net != buffer->line_brackets[row].net && first_depth_row == INVALID_INDEX)
+            first_depth_row = row + 1;
+        
+        set_line_brackets(buffer, row, brackets);
+        pop(&ctx->arena, size * (sizeof(char) + sizeof(Token_Kind)));
+        
+        pos += size + 1;
+        row++;
+        state = end_state;
+
+        if (end_state != prev_end_state)
+        {
+            if (first_changed_row == INVALID_INDEX) first_changed_row = row;
+            last_changed_row = row;
+            continue;
+        }
+        
+        // Converged, next stale line is found 16 states at a time.
+        const s32 next_row = find_high_bit_byte(buffer->lex_states, row, buffer->last_line_idx + 1);
+        if (next_row != row)
+        {
+            row = next_row;
+            pos = line_start_pos(buffer, row);
+            state = buffer->lex_states[row - 1];
+        }
+    }
+
+    buffer->lex_next_row = row;
+    if (first_changed_row != INVALID_INDEX)
+        damage_buffer_rows(ctx, buffer_idx, first_changed_row, last_changed_row);
+    if (buffer->grammar && first_depth_row != INVALID_INDEX && first_depth_row <= buffer->last_line_idx)
+        damage_buffer_rows(ctx, buffer_idx, first_depth_row, buffer->last_line_idx);
+    
+    return true;
+}
+
+// Lex lines below visible ones in idle time.
+static bool lex_background(Ted_Context* ctx)
+{
+    if (ctx->buffer_count == 0) return false;
+    return lex_lines(ctx, ctx->active_buffer_idx, ctx->buffers[ctx->active_buffer_idx].last_line_idx, TED_LEX_BATCH);
+}
+
+void toggle_soft_wrap(Ted_Context* ctx)
+{
+    auto* buffer = active_buffer(ctx);
+    const auto* atlas = active_atlas(ctx);
+    const s32 line_pos = pointer_pos(&buffer->display_buffer) - buffer->cursor.col;
+
+    // Cursor stays at the same height in window, lines around it are laid out again.
+    Visual_Lines lines = begin_visual_lines(ctx, ctx->active_buffer_idx, atlas, buffer->cursor.row, line_pos);
+    const s32 prev_visual_row = first_visual_row(buffer, buffer->cursor.row) + find_segment(&lines, buffer->cursor.col);
+    end_visual_lines(ctx, &lines);
+
+    ted_settings.soft_wrap = !ted_settings.soft_wrap;
+
+    // Visual line counts of all buffers change.
+    for (s32 i = 0; i < ctx->buffer_count; ++i)
+        ctx->buffers[i].visual_tree_stale_row = 0;
+
+    lines = begin_visual_lines(ctx, ctx->active_buffer_idx, atlas, buffer->cursor.row, line_pos);
+    const s32 visual_row = first_visual_row(buffer, buffer->cursor.row) + find_segment(&lines, buffer->cursor.col);
+    end_visual_lines(ctx, &lines);
+
+    buffer->x = ctx->buffer_max_x;
+    buffer->y += (visual_row - prev_visual_row) * atlas->line_height;
+    buffer->cursor.preferred_x = INVALID_INDEX;
+    damage_window(ctx);
+}
+
+static void clear_selection(Ted_Context* ctx, s16 buffer_idx)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (buffer->anchor_row == INVALID_INDEX) return;
+
+    damage_buffer_rows(ctx, buffer_idx, min(buffer->anchor_row, buffer->cursor.row), max(buffer->anchor_row, buffer->cursor.row));
+    buffer->anchor_row = INVALID_INDEX;
+}
+
+// Line is edited, its layout, cursor x, selection and undo snapshot are stale.
+static void edit_buffer_rows(Ted_Context* ctx, s16 buffer_idx, s32 first_row, s32 last_row)
+{
+    auto* undo_buffer = &ctx->buffers[buffer_idx].undo_buffer;
+    if (undo_buffer->start) free(undo_buffer);
+    
+    clear_selection(ctx, buffer_idx);
+    drop_line_layouts(ctx, buffer_idx, first_row, last_row);
+    damage_buffer_rows(ctx, buffer_idx, first_row, last_row);
+    ctx->buffers[buffer_idx].cursor.preferred_x = INVALID_INDEX;
+}
+
+// Main cursor after edit, its rows are damaged by edit itself.
+static void put_cursor_at_pos(Ted_Buffer* buffer, s32 pos)
+{
+    set_pointer(&buffer->display_buffer, pos);
+    buffer->cursor.row = row_at_pos(buffer, pos);
+    buffer->cursor.col = pos - line_start_pos(buffer, buffer->cursor.row);
+    buffer->cursor.preferred_x = INVALID_INDEX;
+}
+
+// Same edit at main and extra cursors, delete_before utf8 chars before and delete_after chars
+// after each cursor are replaced with string. Gap buffer applies all edits in one sweep and line
+// table is updated once, by line resizes if no line breaks are involved, else by one splice
+// of lines between first and last cursor. Cursors whose range is out of buffer or overlaps
+// range of previous cursor do not edit.
+static void edit_at_cursors(Ted_Context* ctx, s16 buffer_idx, s32 delete_before, s32 delete_after, const char* str, s32 size)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+    const s32 main_pos = pointer_pos(display_buffer);
+    const s32 cursor_count = buffer->extra_cursor_count + 1;
+
+    // Main cursor is merged into sorted extra ones.
+    auto* cursors = push_array(&ctx->arena, cursor_count, s32);
+    auto* edits = push_array(&ctx->arena, cursor_count, s32);
+    auto* starts = push_array(&ctx->arena, cursor_count, s32);
+    auto* ends = push_array(&ctx->arena, cursor_count, s32);
+    auto* edit_rows = push_array(&ctx->arena, cursor_count, s32);
+    s32 edit_count = 0;
+
+    s32 new_lines = 0;
+    for (s32 i = 0; i < size; ++i)
+        new_lines += str[i] == '\n';
+    
+    bool breaks_lines = new_lines > 0;
+    
+    for (s32 i = 0, j = 0; i < cursor_count; ++i)
+    {
+        const bool main = j == buffer->extra_cursor_count || (i == j && main_pos < buffer->extra_cursors[j]);
+        cursors[i] = main ? main_pos : buffer->extra_cursors[j++];
+
+        const s32 pos = cursors[i];
+        const s32 start = step_chars(display_buffer, pos, -delete_before);
+        const s32 end = step_chars(display_buffer, pos, delete_after);
+        if ((delete_before > 0 && start == pos) || (delete_after > 0 && end == pos)) continue;
+        if (edit_count > 0 && start < ends[edit_count - 1]) continue;
+
+        breaks_lines |= find_char(display_buffer, start, end - start, '\n') < end;
+        
+        edits[edit_count] = pos;
+        starts[edit_count] = start;
+        ends[edit_count] = end;
+        edit_count++;
+    }
+
+    if (buffer->last_line_idx + new_lines * edit_count >= TED_MAX_LINE_COUNT)
+    {
+        printf("Reached max line count (%d)\n", TED_MAX_LINE_COUNT);
+        pop(&ctx->arena, 5 * cursor_count * sizeof(s32));
+        return;
+    }
+
+    if (edit_count > 0)
+    {
+        if (!breaks_lines)
+        {
+            for (s32 i = 0; i < edit_count; ++i)
+                edit_rows[i] = row_at_pos(buffer, edits[i]);
+        }
+        
+        const s32 first_row = row_at_pos(buffer, starts[0]);
+        const s32 last_row = row_at_pos(buffer, ends[edit_count - 1]);
+        const s32 prev_last_line_idx = buffer->last_line_idx;
+        const s32 span_pos = line_start_pos(buffer, first_row);
+        const s32 span_end = line_start_pos(buffer, last_row) + buffer->line_lengths[last_row];
+
+        s32 total_shift = 0;
+        for (s32 i = 0; i < edit_count; ++i)
+            total_shift += size - (ends[i] - starts[i]);
+        
+        replace_ranges(display_buffer, starts, ends, edit_count, str, size);
+
+        if (breaks_lines)
+        {
+            splice_lines(buffer, first_row, last_row, span_pos, span_end + total_shift - span_pos);
+            edit_buffer_rows(ctx, buffer_idx, first_row, max(prev_last_line_idx, buffer->last_line_idx));
+        }
+        else
+        {
+            for (s32 i = 0; i < edit_count; ++i)
+                resize_line(buffer, edit_rows[i], size - (ends[i] - starts[i]));
+            edit_buffer_rows(ctx, buffer_idx, first_row, last_row);
+        }
+        
+        // Cursors are moved by edits before them, edited ones go after inserted string.
+        // Cursor that did not edit as its range was taken by previous one meets it.
+        s32 shift = 0;
+        for (s32 i = 0, e = 0; i < cursor_count; ++i)
+        {
+            if (e < edit_count && edits[e] == cursors[i])
+            {
+                cursors[i] = starts[e] + shift + size;
+                shift += size - (ends[e] - starts[e]);
+                e++;
+            }
+            else
+            {
+                cursors[i] += shift;
+            }
+
+            if (i > 0) cursors[i] = max(cursors[i], cursors[i - 1]);
+        }
+    }
+
+    // Cursors that met are merged, main one stays.
+    s32 new_main_pos = main_pos;
+    for (s32 i = 0, j = 0; i < cursor_count; ++i)
+    {
+        const bool main = j == buffer->extra_cursor_count || (i == j && main_pos < buffer->extra_cursors[j]);
+        if (main) new_main_pos = cursors[i];
+        else j++;
+    }
+
+    buffer->extra_cursor_count = 0;
+    for (s32 i = 0; i < cursor_count; ++i)
+    {
+        const s32 pos = cursors[i];
+        if (pos == new_main_pos) continue;
+        if (buffer->extra_cursor_count > 0 && buffer->extra_cursors[buffer->extra_cursor_count - 1] == pos) continue;
+        buffer->extra_cursors[buffer->extra_cursor_count++] = pos;
+    }
+
+    pop(&ctx->arena, 5 * cursor_count * sizeof(s32));
+    put_cursor_at_pos(buffer, new_main_pos);
+}
+
+// Byte range of selection, false if nothing is selected.
+static bool get_selection_range(Ted_Buffer* buffer, s32* start, s32* end)
+{
+    if (buffer->anchor_row == INVALID_INDEX) return false;
+
+    const s32 anchor_pos = line_start_pos(buffer, buffer->anchor_row) + buffer->anchor_col;
+    const s32 cursor_pos = pointer_pos(&buffer->display_buffer);
+    *start = min(anchor_pos, cursor_pos);
+    *end = max(anchor_pos, cursor_pos);
+    
+    return *start < *end;
+}
+
+static bool delete_selection(Ted_Context* ctx, s16 buffer_idx)
+{
+    s32 start, end;
+    if (!get_selection_range(ctx->buffers + buffer_idx, &start, &end)) return false;
+
+    delete_range(ctx, buffer_idx, start, end);
+    return true;
+}
+
+void push_char(Ted_Context* ctx, s16 buffer_idx, char c)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (buffer->extra_cursor_count > 0)
+    {
+        edit_at_cursors(ctx, buffer_idx, 0, 0, &c, 1);
+        return;
+    }
+    
+    push_char(&buffer->display_buffer, c);
+    
+    if (c == '\n')
+    {   
+        if (buffer->last_line_idx >= TED_MAX_LINE_COUNT)
+        {
+            printf("Reached max line count (%d)\n", TED_MAX_LINE_COUNT);
+            return;
+        }
+
+        const s32 right_line_part_length = buffer->line_lengths[buffer->cursor.row] - buffer->cursor.col;
+        
+        buffer->line_lengths[buffer->cursor.row] -= right_line_part_length;
+        insert_line(buffer, buffer->cursor.row + 1, right_line_part_length);
+
+        // Lines below are shifted down, redraw till the end of buffer.
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->last_line_idx);
+
+        buffer->cursor.row++;
+        buffer->cursor.col = 0;
+    }
+    else
+    {
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.row);
+        
+        buffer->cursor.col++;
+        resize_line(buffer, buffer->cursor.row, 1);
+    }    
+}
+
+void push_str(Ted_Context* ctx, s16 buffer_idx, const char* str, s32 size)
+{
+    if (ctx->buffers[buffer_idx].extra_cursor_count > 0)
+    {
+        edit_at_cursors(ctx, buffer_idx, 0, 0, str, size);
+        return;
+    }
+    
+    // One bulk insert, line table is updated once however many lines string has.
+    const s32 pos = pointer_pos(&ctx->buffers[buffer_idx].display_buffer);
+    replace_range(ctx, buffer_idx, pos, pos, str, size);
+}
+
+void delete_char(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+
+    if (buffer->extra_cursor_count > 0)
+    {
+        edit_at_cursors(ctx, buffer_idx, 1, 0, null, 0);
+        return;
+    }
+
+    if (delete_selection(ctx, buffer_idx)) return;
+
+    // Multibyte char is removed as a whole, byte path below handles line merges.
+    const s32 pos = pointer_pos(display_buffer);
+    const s32 char_pos = step_chars(display_buffer, pos, -1);
+    if (pos - char_pos > 1)
+    {
+        delete_range(ctx, buffer_idx, char_pos, pos);
+        return;
+    }
+
+    const char c_deleted = delete_char(display_buffer);
+    if (c_deleted == '\n')
+    {   
+        const s32 deleted_line_length = buffer->line_lengths[buffer->cursor.row];
+        const s32 prev_line_length = buffer->line_lengths[buffer->cursor.row - 1];
+        buffer->line_lengths[buffer->cursor.row - 1] += deleted_line_length;
+        remove_line(buffer, buffer->cursor.row);
+ 
+        // Lines below are shifted up, include previous last line as well.
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row - 1, buffer->last_line_idx + 1);
+        
+        buffer->cursor.row--;
+        buffer->cursor.col = prev_line_length;
+    }
+    else if (c_deleted != INVALID_CHAR)
+    {
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.row);
+        
+        buffer->cursor.col--;
+        resize_line(buffer, buffer->cursor.row, -1);
+    }
+}
+
+void delete_char_overwrite(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+
+    if (buffer->extra_cursor_count > 0)
+    {
+        edit_at_cursors(ctx, buffer_idx, 0, 1, null, 0);
+        return;
+    }
+
+    if (delete_selection(ctx, buffer_idx)) return;
+
+    const s32 pos = pointer_pos(display_buffer);
+    const s32 char_end = step_chars(display_buffer, pos, 1);
+    if (char_end - pos > 1)
+    {
+        delete_range(ctx, buffer_idx, pos, char_end);
+        return;
+    }
+
+    const char c_deleted = delete_char_overwrite(display_buffer);
+
+    if (c_deleted == '\n')
+    {
+        const s32 deleted_line_length = buffer->line_lengths[buffer->cursor.row + 1];
+        buffer->line_lengths[buffer->cursor.row] += deleted_line_length;
+        remove_line(buffer, buffer->cursor.row + 1);
+
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->last_line_idx + 1);
+    }
+    else if (c_deleted != INVALID_CHAR)
+    {
+        resize_line(buffer, buffer->cursor.row, -1);
+        edit_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.row);
+    }
+}
+
+// Lines of replaced range are found by simd newline count, so line table is spliced once
+// and range costs the same as memmove of data and line info below it.
+void replace_range(Ted_Context* ctx, s16 buffer_idx, s32 start, s32 end, const char* str, s32 size)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+    
+    assert(start >= 0);
+    assert(start <= end);
+    assert(end <= data_size(display_buffer));
+
+    const s32 removed_lines = count_char(display_buffer, start, end - start, '\n');
+    const s32 inserted_lines = count_byte(str, size, '\n');
+    if (buffer->last_line_idx - removed_lines + inserted_lines >= TED_MAX_LINE_COUNT)
+    {
+        printf("Reached max line count (%d)\n", TED_MAX_LINE_COUNT);
+        return;
+    }
+
+    // Extra cursor positions would be shifted by range, they are dropped instead.
+    clear_extra_cursors(ctx, buffer_idx);
+    damage_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.row);
+
+    const s32 first_row = row_at_pos(buffer, start);
+    const s32 last_row = first_row + removed_lines;
+    const s32 prev_last_line_idx = buffer->last_line_idx;
+    const s32 span_pos = line_start_pos(buffer, first_row);
+    const s32 span_end = line_start_pos(buffer, last_row) + buffer->line_lengths[last_row];
+    const s32 shift = size - (end - start);
+    
+    replace_range(display_buffer, start, end, str, size);
+
+    if (removed_lines == 0 && inserted_lines == 0)
+    {
+        resize_line(buffer, first_row, shift);
+        edit_buffer_rows(ctx, buffer_idx, first_row, first_row);
+    }
+    else
+    {
+        splice_lines(buffer, first_row, last_row, span_pos, span_end + shift - span_pos);
+        edit_buffer_rows(ctx, buffer_idx, first_row, max(prev_last_line_idx, buffer->last_line_idx));
+    }
+
+    put_cursor_at_pos(buffer, start + size);
+}
+
+void delete_range(Ted_Context* ctx, s16 buffer_idx, s32 start, s32 end)
+{
+    replace_range(ctx, buffer_idx, start, end, null, 0);
+}
+
+// Line break positions of buffer that is built by replace_all, heap array grows by doubling
+// as line count of result is known only after whole pass.
+struct Line_Ends
+{
+    s32* positions;
+    s32 count;
+    s32 capacity;
+};
+
+// Append text to buffer that is built by replace_all and record positions of its line breaks.
+// Gap grows by half of buffer at least, so appends are amortized. False if there are too many lines.
+static bool append_lines(Gap_Buffer* buffer, const char* str, s32 size, Line_Ends* line_ends)
+{
+    if (size > gap_data_size(buffer)) expand(buffer, max(size, total_data_size(buffer) / 2));
+
+    const s32 pos = data_size(buffer);
+    for (s32 i = find_either_byte(str, 0, size, '\n', '\n'); i < size; i = find_either_byte(str, i + 1, size, '\n', '\n'))
+    {
+        if (line_ends->count + 1 >= TED_MAX_LINE_COUNT) return false;
+        
+        if (line_ends->count == line_ends->capacity)
+        {
+            const s32 capacity = max(TED_MIN_LINE_CAPACITY, 2 * line_ends->capacity);
+            grow_array((void**)&line_ends->positions, line_ends->capacity, capacity, sizeof(s32));
+            line_ends->capacity = capacity;
+        }
+        
+        line_ends->positions[line_ends->count++] = pos + i;
+    }
+    
+    push_str(buffer, str, size);
+    return true;
+}
+
+// Contents are scanned as one contiguous snapshot and streamed into fresh buffer with matches
+// replaced, so rebuild cost does not depend on match count. Line lengths are taken from the
+// same pass, then all line info is reset at once. Old contents are kept for undo_buffer_edit.
+// Search itself is linear for literal patterns only, see find_match. Its tables live in arena
+// till the scan is over.
+s32 replace_all(Ted_Context* ctx, s16 buffer_idx, const char* pattern, const char* replacement, bool regex)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+    
+    const s32 size = data_size(display_buffer);
+    const char* data = contiguous_string(display_buffer, 0, size);
+    const s32 replacement_size = (s32)strlen(replacement);
+    const u64 arena_used = ctx->arena.used;
+    const Search_Pattern search = make_search_pattern(&ctx->arena, pattern, regex);
+    
+    Search_Match match;
+    if (!find_match(&search, data, 0, size, &match))
+    {
+        pop(&ctx->arena, ctx->arena.used - arena_used);
+        return 0;
+    }
+
+    Gap_Buffer fresh;
+    init_gap_buffer(&fresh, size);
+    
+    Line_Ends line_ends = {};
+    s32 match_count = 0;
+    s32 pos = 0;
+    bool fits = true;
+    
+    do
+    {
+        fits = append_lines(&fresh, data + pos, match.start - pos, &line_ends)
+            && append_lines(&fresh, replacement, replacement_size, &line_ends);
+        
+        match_count++;
+        pos = match.start + match.size;
+
+        // Empty match would be found again at same position, so one char is skipped.
+        if (match.size == 0)
+        {
+            if (pos == size) break;
+            fits = fits && append_lines(&fresh, data + pos, 1, &line_ends);
+            pos++;
+        }
+    }
+    while (fits && find_match(&search, data, pos, size, &match));
+    pop(&ctx->arena, ctx->arena.used - arena_used);
+
+    fits = fits && append_lines(&fresh, data + pos, size - pos, &line_ends);
+    
+    if (!fits)
+    {
+        printf("Reached max line count (%d)\n", TED_MAX_LINE_COUNT);
+        free(&fresh);
+        free(line_ends.positions);
+        return 0;
+    }
+
+    const s32 cursor_pos = pointer_pos(display_buffer);
+    const s32 prev_last_line_idx = buffer->last_line_idx;
+    
+    if (buffer->undo_buffer.start) free(&buffer->undo_buffer);
+    buffer->undo_buffer = *display_buffer;
+    buffer->display_buffer = fresh;
+    reserve_lines(buffer, line_ends.count + 1);
+
+    s32 line_start = 0;
+    for (s32 i = 0; i < line_ends.count; ++i)
+    {
+        buffer->line_lengths[i] = line_ends.positions[i] - line_start;
+        line_start = line_ends.positions[i] + 1;
+    }
+
+    buffer->line_lengths[line_ends.count] = data_size(&fresh) - line_start;
+    buffer->last_line_idx = line_ends.count;
+    free(line_ends.positions);
+
+    reset_line_info(buffer, prev_last_line_idx);
+
+    clear_extra_cursors(ctx, buffer_idx);
+    clear_selection(ctx, buffer_idx);
+    drop_line_layouts(ctx, buffer_idx, 0, max(prev_last_line_idx, buffer->last_line_idx));
+    damage_window(ctx);
+    put_cursor_at_pos(buffer, min(cursor_pos, data_size(&fresh)));
+    
+    return match_count;
+}
+
+// Swap contents with ones before last replace_all, so second call redoes it.
+void undo_buffer_edit(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (!buffer->undo_buffer.start) return;
+
+    const Gap_Buffer contents = buffer->display_buffer;
+    const s32 cursor_pos = pointer_pos(&contents);
+    const s32 prev_last_line_idx = buffer->last_line_idx;
+    
+    buffer->display_buffer = buffer->undo_buffer;
+    buffer->undo_buffer = contents;
+
+    splice_lines(buffer, 0, buffer->last_line_idx, 0, data_size(&buffer->display_buffer));
+    
+    clear_extra_cursors(ctx, buffer_idx);
+    clear_selection(ctx, buffer_idx);
+    drop_line_layouts(ctx, buffer_idx, 0, max(prev_last_line_idx, buffer->last_line_idx));
+    damage_window(ctx);
+    put_cursor_at_pos(buffer, min(cursor_pos, data_size(&buffer->display_buffer)));
+}
+
+// First extra cursor at or after given position.
+static s32 lower_bound_cursor(const Ted_Buffer* buffer, s32 pos)
+{
+    s32 low = 0;
+    s32 high = buffer->extra_cursor_count;
+    while (low < high)
+    {
+        const s32 mid = low + (high - low) / 2;
+        if (buffer->extra_cursors[mid] < pos) low = mid + 1;
+        else high = mid;
+    }
+
+    return low;
+}
+
+// Remove extra cursor that main one stepped on.
+static void merge_main_cursor(Ted_Buffer* buffer)
+{
+    const s32 pos = pointer_pos(&buffer->display_buffer);
+    const s32 idx = lower_bound_cursor(buffer, pos);
+    if (idx == buffer->extra_cursor_count || buffer->extra_cursors[idx] != pos) return;
+    
+    memmove(buffer->extra_cursors + idx, buffer->extra_cursors + idx + 1, (buffer->extra_cursor_count - idx - 1) * sizeof(s32));
+    buffer->extra_cursor_count--;
+}
+
+// Set main cursor position and update gap buffer pointer according to it, extra cursors stay.
+static void place_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
+{
+
+    auto* buffer = ctx->buffers + buffer_idx;
+    auto* display_buffer = &buffer->display_buffer;
+
+    if (row < 0 || row > buffer->last_line_idx)
+    {
+        printf("Incorrect cursor row position (%d)\n", row);
+        return;
+    }
+
+    const s32 line_length = buffer->line_lengths[row];
+    if (col < 0 || col > line_length)
+    {
+        printf("Incorrect cursor col position (%d)\n", col);
+        return;
+    }
+
+    // Cursor never stays on hidden line, fold around it is opened.
+    if (buffer->folded[row])
+    {
+        unfold_lines(buffer, find_fold_header(buffer, row));
+        damage_window(ctx);
+    }
+
+    set_pointer(display_buffer, line_start_pos(buffer, row) + col);
+    clear_selection(ctx, buffer_idx);
+
+    // Cursor is drawn over text, so both old and new rows have to be redrawn.
+    damage_buffer_rows(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.row);
+    damage_buffer_rows(ctx, buffer_idx, row, row);
+    
+    buffer->cursor.row = row;
+    buffer->cursor.col = col;
+    buffer->cursor.preferred_x = INVALID_INDEX;
+    merge_main_cursor(buffer);
+}
+
+void set_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    clear_extra_cursors(ctx, buffer_idx);
+    place_cursor(ctx, buffer_idx, row, col);
+}
+
+void add_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    if (row < 0 || row > buffer->last_line_idx || col < 0 || col > buffer->line_lengths[row]) return;
+    
+    if (buffer->extra_cursor_count >= TED_MAX_CURSORS)
+    {
+        printf("Reached max cursor count (%d)\n", TED_MAX_CURSORS);
+        return;
+    }
+
+    if (buffer->folded[row])
+    {
+        unfold_lines(buffer, find_fold_header(buffer, row));
+        damage_window(ctx);
+    }
+
+    const s32 pos = line_start_pos(buffer, row) + col;
+    if (pos == pointer_pos(&buffer->display_buffer)) return;
+
+    const s32 idx = lower_bound_cursor(buffer, pos);
+    if (idx < buffer->extra_cursor_count && buffer->extra_cursors[idx] == pos) return;
+
+    memmove(buffer->extra_cursors + idx + 1, buffer->extra_cursors + idx, (buffer->extra_cursor_count - idx) * sizeof(s32));
+    buffer->extra_cursors[idx] = pos;
+    buffer->extra_cursor_count++;
+
+    damage_buffer_rows(ctx, buffer_idx, row, row);
+}
+
+// New cursor takes column of main one, backed off to char boundary.
+void add_cursor_vertically(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* display_buffer = &buffer->display_buffer;
+
+    s32 pos = pointer_pos(display_buffer);
+    if (buffer->extra_cursor_count > 0)
+    {
+        if (delta > 0) pos = max(pos, buffer->extra_cursors[buffer->extra_cursor_count - 1]);
+        else           pos = min(pos, buffer->extra_cursors[0]);
+    }
+
+    // Folds are stepped over like by main cursor.
+    s32 row = row_at_pos(buffer, pos);
+    if (delta > 0) row += 1 + buffer->fold_sizes[row];
+    else if (row > 0) row = buffer->folded[row - 1] ? find_fold_header(buffer, row - 1) : row - 1;
+    else return;
+    
+    if (row > buffer->last_line_idx) return;
+
+    const s32 line_pos = line_start_pos(buffer, row);
+    s32 col = min(buffer->cursor.col, buffer->line_lengths[row]);
+    while (col > 0 && is_utf8_continuation((u8)char_at(display_buffer, line_pos + col)))
+        col--;
+    
+    add_cursor(ctx, buffer_idx, row, col);
+}
+
+void clear_extra_cursors(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (buffer->extra_cursor_count == 0) return;
+
+    const s32 first_row = row_at_pos(buffer, buffer->extra_cursors[0]);
+    const s32 last_row = row_at_pos(buffer, buffer->extra_cursors[buffer->extra_cursor_count - 1]);
+    damage_buffer_rows(ctx, buffer_idx, first_row, last_row);
+    
+    buffer->extra_cursor_count = 0;
+}
+
+// Extra cursors move by bytes over line ends, ones that meet are merged.
+// Main cursor is merged by caller after it moves too.
+static void move_extra_cursors(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (buffer->extra_cursor_count == 0) return;
+
+    s32 first_row = row_at_pos(buffer, buffer->extra_cursors[0]);
+    s32 last_row = row_at_pos(buffer, buffer->extra_cursors[buffer->extra_cursor_count - 1]);
+
+    s32 count = 0;
+    for (s32 i = 0; i < buffer->extra_cursor_count; ++i)
+    {
+        const s32 pos = step_chars(&buffer->display_buffer, buffer->extra_cursors[i], delta);
+        if (count > 0 && buffer->extra_cursors[count - 1] == pos) continue;
+        buffer->extra_cursors[count++] = pos;
+    }
+
+    buffer->extra_cursor_count = count;
+    if (count > 0)
+    {
+        first_row = min(first_row, row_at_pos(buffer, buffer->extra_cursors[0]));
+        last_row = max(last_row, row_at_pos(buffer, buffer->extra_cursors[count - 1]));
+    }
+    
+    damage_buffer_rows(ctx, buffer_idx, first_row, last_row);
+}
+
+void move_cursor_horizontally(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+    move_extra_cursors(ctx, buffer_idx, delta);
+
+    // Delta is in utf8 chars, cursor never lands inside sequence.
+    const s32 pos = line_start_pos(buffer, buffer->cursor.row) + buffer->cursor.col;
+    const s32 char_pos = step_chars(&buffer->display_buffer, pos, delta);
+    if (char_pos == pos)
+    {
+        merge_main_cursor(buffer);
+        return;
+    }
+    
+    delta = char_pos - pos;
+
+    s32 new_row = buffer->cursor.row;
+    s32 new_col = buffer->cursor.col + delta;
+    
+    const s32 current_line_length = buffer->line_lengths[buffer->cursor.row];
+    if (new_col > current_line_length)
+    {
+        if (++new_row > buffer->last_line_idx)
+        {
+            merge_main_cursor(buffer);
+            return;
+        }
+        
+        new_col -= (current_line_length + 1); // include '\n'
+    }
+    else if (new_col < 0)
+    {
+        if (--new_row < 0)
+        {
+            merge_main_cursor(buffer);
+            return;
+        }
+        
+        new_col += buffer->line_lengths[new_row] + 1; // include '\n'
+    }
+
+    // Cursor steps over fold instead of opening it.
+    if (buffer->folded[new_row])
+    {
+        if (new_row > buffer->cursor.row)
+        {
+            new_row = buffer->cursor.row + 1 + buffer->fold_sizes[buffer->cursor.row];
+            new_col = 0;
+            if (new_row > buffer->last_line_idx)
+            {
+                merge_main_cursor(buffer);
+                return;
+            }
+        }
+        else
+        {
+            new_row = find_fold_header(buffer, new_row);
+            new_col = buffer->line_lengths[new_row];
+        }
+    }
+    
+    place_cursor(ctx, buffer_idx, new_row, new_col);
+}
+
+void move_cursor_vertically(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    // Cursor keeps its pixel x across lines of different widths, tabs and utf8.
+    // With soft wrap it moves over visual lines and x is taken from visual line start.
+    const auto* atlas = active_atlas(ctx);
+    const s32 line_pos = pointer_pos(&buffer->display_buffer) - buffer->cursor.col;
+    
+    Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, buffer->cursor.row, line_pos);
+    const s32 segment = find_segment(&lines, buffer->cursor.col);
+    
+    s32 preferred_x = buffer->cursor.preferred_x;
+    if (preferred_x == INVALID_INDEX)
+        preferred_x = lines.layout->offsets[buffer->cursor.col].x - lines.layout->offsets[lines.starts[segment]].x;
+
+    end_visual_lines(ctx, &lines);
+
+    const s32 visual_row = first_visual_row(buffer, buffer->cursor.row) + segment + delta;
+    if (visual_row < 0 || visual_row >= visual_row_count(buffer)) return;
+
+    s32 new_segment;
+    const s32 new_row = find_visual_row(buffer, visual_row, &new_segment);
+    
+    lines = begin_visual_lines(ctx, buffer_idx, atlas, new_row, line_start_pos(buffer, new_row));
+    const s32 new_col = segment_byte_at_x(&lines, min(new_segment, lines.count - 1), preferred_x);
+    end_visual_lines(ctx, &lines);
+    
+    set_cursor(ctx, buffer_idx, new_row, new_col);
+    buffer->cursor.preferred_x = preferred_x;
+}
+
+// Indentation width of line in columns, INVALID_INDEX for blank line.
+static s32 line_indent(const Ted_Buffer* buffer, s32 row, s32 pos)
+{
+    s32 indent = 0;
+    for (s32 i = 0; i < buffer->line_lengths[row]; ++i)
+    {
+        const char c = char_at(&buffer->display_buffer, pos + i);
+        if (c == ' ') indent++;
+        else if (c == '\t') indent += ted_settings.tab_size;
+        else return indent;
+    }
+
+    return INVALID_INDEX;
+}
+
+// Fold block of lines indented deeper than header, block below cursor line if it opens one,
+// else block cursor is in. Open fold if cursor is on its header.
+void toggle_fold(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    s32 header_row = buffer->cursor.row;
+    if (buffer->fold_sizes[header_row] > 0)
+    {
+        unfold_lines(buffer, header_row);
+        damage_window(ctx);
+        return;
+    }
 
-    s32 new_row = buffer->cursor.row;
-    s32 new_col = buffer->cursor.col + delta;
+    s32 header_pos = pointer_pos(&buffer->display_buffer) - buffer->cursor.col;
+    const s32 cursor_indent = line_indent(buffer, header_row, header_pos);
+    if (cursor_indent == INVALID_INDEX) return;
+
+    s32 row = header_row + 1;
+    s32 pos = header_pos + buffer->line_lengths[header_row] + 1;
+    s32 indent = INVALID_INDEX;
     
-    const s32 current_line_length = buffer->line_lengths[buffer->cursor.row];
-    if (new_col > current_line_length)
+    for (; row <= buffer->last_line_idx && indent == INVALID_INDEX; ++row)
     {
-        if (++new_row > buffer->last_line_idx) return;
-        new_col -= (current_line_length + 1); // include '\n'
+        indent = line_indent(buffer, row, pos);
+        pos += buffer->line_lengths[row] + 1;
     }
-    else if (new_col < 0)
+
+    if (indent <= cursor_indent)
     {
-        if (--new_row < 0) return;
-        new_col += buffer->line_lengths[new_row] + 1; // include '\n'
+        // Cursor line does not open block, take nearest less indented line above as header.
+        indent = INVALID_INDEX;
+        while (header_row > 0 && (indent == INVALID_INDEX || indent >= cursor_indent))
+        {
+            header_row--;
+            header_pos -= buffer->line_lengths[header_row] + 1;
+            indent = line_indent(buffer, header_row, header_pos);
+        }
+
+        if (indent == INVALID_INDEX || indent >= cursor_indent || buffer->folded[header_row]) return;
     }
+
+    // Block ends at last deeper line, trailing blank lines stay visible.
+    const s32 header_indent = line_indent(buffer, header_row, header_pos);
+    s32 last_row = header_row;
     
-    set_cursor(ctx, buffer_idx, new_row, new_col);
+    row = header_row + 1;
+    pos = header_pos + buffer->line_lengths[header_row] + 1;
+    for (; row <= buffer->last_line_idx; ++row)
+    {
+        indent = line_indent(buffer, row, pos);
+        pos += buffer->line_lengths[row] + 1;
+        
+        if (indent == INVALID_INDEX) continue;
+        if (indent <= header_indent) break;
+        last_row = row;
+    }
+
+    if (last_row == header_row) return;
+
+    // Folds are not nested, inner ones and previous fold of header are merged into new one.
+    for (row = header_row; row <= last_row; ++row)
+        unfold_lines(buffer, row);
+
+    if (buffer->cursor.row != header_row)
+        set_cursor(ctx, buffer_idx, header_row, buffer->line_lengths[header_row]);
+    
+    fold_lines(buffer, header_row, last_row - header_row);
+    damage_window(ctx);
 }
 
-void move_cursor_vertically(Ted_Context* ctx, s16 buffer_idx, s32 delta)
+// Byte of line from start one whose bracket brings depth down to target, INVALID_INDEX
+// if there is none. Depth is the one before start byte and is advanced by scanned bytes.
+static s32 scan_depth_drop_after(const Ted_Buffer* buffer, const char* text, const Token_Kind* kinds, s32 start, s32 size, s32* depth, s32 target)
+{
+    for (s32 i = start; i < size; ++i)
+    {
+        *depth += bracket_delta(buffer, text, kinds, i);
+        if (*depth <= target) return i;
+    }
+
+    return INVALID_INDEX;
+}
+
+// Last byte of line before end one with depth at most target before it, INVALID_INDEX
+// if there is none. Depth is the one at line start.
+static s32 scan_depth_drop_before(const Ted_Buffer* buffer, const char* text, const Token_Kind* kinds, s32 end, s32 depth, s32 target)
+{
+    s32 found = INVALID_INDEX;
+    for (s32 i = 0; i < end; ++i)
+    {
+        if (depth <= target) found = i;
+        depth += bracket_delta(buffer, text, kinds, i);
+    }
+
+    return found;
+}
+
+s32 bracket_depth(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
 {
     assert(buffer_idx < ctx->buffer_count);
     auto* buffer = ctx->buffers + buffer_idx;
 
-    const s32 new_line_idx = buffer->cursor.row + delta;
-    if (new_line_idx < 0 || new_line_idx > buffer->last_line_idx) return;
-    
-    const s32 current_line_length = buffer->line_lengths[buffer->cursor.row];
-    buffer->cursor.col = clamp(buffer->cursor.col, 0, buffer->line_lengths[new_line_idx]);
-    
-    set_cursor(ctx, buffer_idx, new_line_idx, buffer->cursor.col);
+    lex_lines(ctx, buffer_idx, row, INT32_MAX);
+    s32 depth = depth_before(get_bracket_tree(buffer), buffer->line_capacity, row);
+
+    Token_Kind* kinds;
+    const char* text = read_line_tokens(ctx, buffer, row, line_start_pos(buffer, row), &kinds);
+    for (s32 i = 0; i < col; ++i)
+        depth += bracket_delta(buffer, text, kinds, i);
+
+    pop(&ctx->arena, buffer->line_lengths[row] * (sizeof(char) + sizeof(Token_Kind)));
+    return depth;
 }
 
-static s32 line_width_px_till_pointer(const Font_Atlas* atlas, const Gap_Buffer* buffer, s32 start_pos)
+// Bracket pair is found by depth, not by bracket kind. Only bracket line and match line are
+// scanned, lines between are skipped by depth tree in log time.
+bool find_matching_bracket(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col, s32* match_row, s32* match_col)
 {
-    s32 width = 0;
-    const s32 end_pos = pointer_pos(buffer);
-    for (s32 i = start_pos; i < end_pos; ++i)
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    // Match may be anywhere, so all lines need summaries. After first call only edited ones are lexed.
+    lex_lines(ctx, buffer_idx, buffer->last_line_idx, INT32_MAX);
+    const auto* tree = get_bracket_tree(buffer);
+
+    const s32 size = buffer->line_lengths[row];
+    Token_Kind* kinds;
+    const char* text = read_line_tokens(ctx, buffer, row, line_start_pos(buffer, row), &kinds);
+    
+    s32 delta = col < size ? bracket_delta(buffer, text, kinds, col) : 0;
+    if (delta == 0 && col > 0) delta = bracket_delta(buffer, text, kinds, --col);
+
+    const s32 line_depth = depth_before(tree, buffer->line_capacity, row);
+    s32 depth = line_depth;
+    for (s32 i = 0; i < col; ++i)
+        depth += bracket_delta(buffer, text, kinds, i);
+
+    s32 found_row = INVALID_INDEX;
+    s32 found_col = INVALID_INDEX;
+    s32 target = INVALID_INDEX;
+    
+    if (delta > 0)
     {
-        const char c = char_at(buffer, i);
-        if (c != INVALID_CHAR)
+        // Closing bracket is the first one that brings depth back to one before opening bracket.
+        target = depth;
+        depth++;
+        
+        found_col = scan_depth_drop_after(buffer, text, kinds, col + 1, size, &depth, target);
+        if (found_col != INVALID_INDEX)
+        {
+            found_row = row;
+        }
+        else
         {
-            const u32 ci = c - atlas->start_charcode; // correctly shifted index
-            const Font_Glyph_Metric* metric = atlas->metrics + ci;
-            width += metric->advance_width;
+            found_row = find_depth_drop_after(tree, buffer->line_capacity, row + 1, depth, target);
+            if (found_row > buffer->last_line_idx) found_row = INVALID_INDEX;
         }
     }
-    return width;
+    else if (delta < 0)
+    {
+        // Opening bracket is the last one with depth before it equal to one after closing bracket.
+        target = depth - 1;
+        
+        found_col = scan_depth_drop_before(buffer, text, kinds, col, line_depth, target);
+        if (found_col != INVALID_INDEX)
+            found_row = row;
+        else if (row > 0)
+            found_row = find_depth_drop_before(tree, buffer->line_capacity, row - 1, line_depth, target);
+    }
+    
+    pop(&ctx->arena, size * (sizeof(char) + sizeof(Token_Kind)));
+
+    if (found_row != INVALID_INDEX && found_col == INVALID_INDEX)
+    {
+        // Match is on other line, tree found the line and it is scanned alone.
+        const s32 found_size = buffer->line_lengths[found_row];
+        const char* found_text = read_line_tokens(ctx, buffer, found_row, line_start_pos(buffer, found_row), &kinds);
+        s32 found_depth = depth_before(tree, buffer->line_capacity, found_row);
+        
+        if (delta > 0) found_col = scan_depth_drop_after(buffer, found_text, kinds, 0, found_size, &found_depth, target);
+        else           found_col = scan_depth_drop_before(buffer, found_text, kinds, found_size, found_depth, target);
+        
+        pop(&ctx->arena, found_size * (sizeof(char) + sizeof(Token_Kind)));
+    }
+
+    if (found_col == INVALID_INDEX) return false;
+    
+    *match_row = found_row;
+    *match_col = found_col;
+    return true;
 }
 
-static s32 line_start_pointer_pos(const Ted_Buffer* buffer)
+void jump_to_matching_bracket(Ted_Context* ctx, s16 buffer_idx)
 {
-    s32 pos = 0;
-    for (s32 i = 0; i < buffer->cursor.row; ++i)
-        pos += buffer->line_lengths[i] + 1;
-    return pos;
+    assert(buffer_idx < ctx->buffer_count);
+    const auto* buffer = ctx->buffers + buffer_idx;
+
+    s32 row, col;
+    if (find_matching_bracket(ctx, buffer_idx, buffer->cursor.row, buffer->cursor.col, &row, &col))
+        set_cursor(ctx, buffer_idx, row, col);
 }
 
-static void render_batch_glyphs(Font_Render_Context* render_ctx, s32 count)
+void select_to(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col)
 {
-    glUniformMatrix4fv(render_ctx->u_transforms, count, GL_FALSE, (f32*)render_ctx->transforms);
-    glUniform1uiv(render_ctx->u_charmap, count, render_ctx->charmap);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    const s32 prev_row = buffer->cursor.row;
+    const s32 anchor_row = buffer->anchor_row == INVALID_INDEX ? buffer->cursor.row : buffer->anchor_row;
+    const s32 anchor_col = buffer->anchor_row == INVALID_INDEX ? buffer->cursor.col : buffer->anchor_col;
+
+    // Selection only changes on rows cursor went over, do not let set_cursor clear it.
+    buffer->anchor_row = INVALID_INDEX;
+    set_cursor(ctx, buffer_idx, row, col);
+    damage_buffer_rows(ctx, buffer_idx, min(prev_row, row), max(prev_row, row));
+    
+    buffer->anchor_row = anchor_row;
+    buffer->anchor_col = anchor_col;
 }
 
-static void render_buffer(Ted_Context* ctx, s16 buffer_idx)
+void extend_selection(Ted_Context* ctx, s16 buffer_idx, s32 delta_col, s32 delta_row)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    const s32 prev_row = buffer->cursor.row;
+    const s32 anchor_row = buffer->anchor_row == INVALID_INDEX ? buffer->cursor.row : buffer->anchor_row;
+    const s32 anchor_col = buffer->anchor_row == INVALID_INDEX ? buffer->cursor.col : buffer->anchor_col;
+
+    // Same as select_to, cursor moves must not clear selection.
+    buffer->anchor_row = INVALID_INDEX;
+    if (delta_row != 0) move_cursor_vertically(ctx, buffer_idx, delta_row);
+    else move_cursor_horizontally(ctx, buffer_idx, delta_col);
+    damage_buffer_rows(ctx, buffer_idx, min(prev_row, buffer->cursor.row), max(prev_row, buffer->cursor.row));
+    
+    buffer->anchor_row = anchor_row;
+    buffer->anchor_col = anchor_col;
+}
+
+void select_all(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    set_cursor(ctx, buffer_idx, buffer->last_line_idx, buffer->line_lengths[buffer->last_line_idx]);
+    buffer->anchor_row = 0;
+    buffer->anchor_col = 0;
+    damage_window(ctx);
+}
+
+// Selection is handed to clipboard in place, gap buffer only moves its gap out of it.
+void copy_selection(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    s32 start, end;
+    if (!get_selection_range(buffer, &start, &end)) return;
+
+    glfwSetClipboardString(ctx->window, contiguous_string(&buffer->display_buffer, start, end - start));
+}
+
+void cut_selection(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    
+    s32 start, end;
+    if (!get_selection_range(ctx->buffers + buffer_idx, &start, &end)) return;
+
+    copy_selection(ctx, buffer_idx);
+    delete_range(ctx, buffer_idx, start, end);
+}
+
+// Clipboard string goes to gap buffer by one copy, line table is spliced once.
+void paste_clipboard(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
+    auto* buffer = ctx->buffers + buffer_idx;
+
+    const char* str = glfwGetClipboardString(ctx->window);
+    if (!str) return;
+
+    const s32 size = (s32)strlen(str);
+    
+    s32 start, end;
+    if (buffer->extra_cursor_count == 0 && get_selection_range(buffer, &start, &end))
+        replace_range(ctx, buffer_idx, start, end, str, size);
+    else
+        push_str(ctx, buffer_idx, str, size);
+}
+
+void hit_test(Ted_Context* ctx, s16 buffer_idx, f64 x, f64 y, s32* row, s32* col)
 {
     assert(buffer_idx < ctx->buffer_count);
     
     auto* buffer = ctx->buffers + buffer_idx;
-    const auto* display_buffer = &buffer->display_buffer;
     const auto* atlas = active_atlas(ctx);
+    sync_wrap_index(ctx, buffer);
+
+    // Visual rows are of equal height and placed like cursor in render_buffer, y goes up there.
+    const s32 descent = (s32)(ctx->font->descent * atlas->px_h_scale);
+    const s32 row_top_offset = buffer->y + descent + atlas->line_height - (ctx->window_h - (s32)y);
+
+    s32 segment;
+    *row = find_visual_row(buffer, row_top_offset < 0 ? 0 : row_top_offset / atlas->line_height, &segment);
+
+    // Only hit line is laid out, its x offsets are searched in log time.
+    const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, *row, line_start_pos(buffer, *row));
+    *col = segment_byte_at_x(&lines, min(segment, lines.count - 1), (s32)x - buffer->x);
+    end_visual_lines(ctx, &lines);
+}
+
+// Brackets take color of their nesting depth, so both brackets of pair share one.
+static void color_brackets(const Ted_Buffer* buffer, const char* text, Token_Kind* kinds, s32 size, s32 depth)
+{
+    for (s32 i = 0; i < size; ++i)
+    {
+        const s32 delta = bracket_delta(buffer, text, kinds, i);
+        if (delta == 0) continue;
+
+        if (delta < 0) depth--;
+        kinds[i] = (Token_Kind)(TOKEN_BRACKET + (depth % SYNTAX_BRACKET_COLORS + SYNTAX_BRACKET_COLORS) % SYNTAX_BRACKET_COLORS);
+        if (delta > 0) depth++;
+    }
+}
+
+template <typename Layout>
+static void render_buffer_text(Ted_Context* ctx, s16 buffer_idx, const Layout* layout, s32 first_row, s32 last_row)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* atlas = layout->atlas;
+    auto* render_ctx = ctx->font_render_ctx;
 
     // Render buffer contents.
-    glUseProgram(ctx->font_render_ctx->program);
-    glBindVertexArray(ctx->font_render_ctx->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, ctx->font_render_ctx->vbo);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas->texture_array);
+    glUseProgram(render_ctx->program);
+    glBindVertexArray(render_ctx->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, render_ctx->vbo);
     
     glActiveTexture(GL_TEXTURE0);
-    glUniform3f(ctx->font_render_ctx->u_text_color, ctx->text_color.r, ctx->text_color.g, ctx->text_color.b);
-    
-    const s32 buffer_data_size = data_size(&buffer->display_buffer);
-    const s32 prefix_size = prefix_data_size(&buffer->display_buffer);
     
-    s16 work_idx = 0;
-    s32 x = buffer->x;
-    s32 y = buffer->y;
+    Glyph_Batch batch = { render_ctx, ctx->glyph_cache, atlas, ctx->token_colors, 0 };
+    const auto* bracket_tree = get_bracket_tree(buffer);
 
-    for (s32 i = 0; i < buffer_data_size; ++i)
+    // Visible rows are visual ones, first of them may be in the middle of wrapped line.
+    s32 segment;
+    s32 row = find_visual_row(buffer, first_row, &segment);
+    s32 line_pos = line_start_pos(buffer, row);
+    
+    for (s32 visual_row = first_row - segment; visual_row <= last_row && row <= buffer->last_line_idx;)
     {
-        if (y < 0) break;
-
-        const char c = char_at(&buffer->display_buffer, i);
+        const s32 line_length = buffer->line_lengths[row];
+        const s32 pos = line_pos;
 
-        // @Cleanup: super straightforward text culling,
-        // don't like it, but it gets the job done for now, refactor later.
-        if (y > ctx->window_h)
-        {
-            if (c == '\n') y -= atlas->line_height;
-            continue;
-        }
+        // Lines above visible ones are lexed before frame, so start state and depth are known.
+        Token_Kind* kinds;
+        char* line = read_line_tokens(ctx, buffer, row, pos, &kinds);
+        if (buffer->grammar)
+            color_brackets(buffer, line, kinds, line_length, depth_before(bracket_tree, buffer->line_capacity, row));
 
-        if (c == '\n')
+        const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, row, pos);
+        for (s32 i = 0; i < lines.count; ++i, ++visual_row)
         {
-            x = buffer->x;
-            y -= atlas->line_height;
-            continue;
+            if (visual_row < first_row || visual_row > last_row) continue;
+            
+            const s32 start = lines.starts[i];
+            render_line(layout, &batch, line + start, kinds + start, lines.starts[i + 1] - start, buffer->x, buffer->y - visual_row * atlas->line_height);
         }
         
-        assert((u32)c >= atlas->start_charcode);
-        assert((u32)c <= atlas->end_charcode);
+        end_visual_lines(ctx, &lines);
+        pop(&ctx->arena, line_length * (sizeof(char) + sizeof(Token_Kind)));
+        next_visible_line(buffer, &row, &line_pos);
+    }
+    
+    render_glyph_batch(render_ctx, batch.cache, batch.count);
+    
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-        const u32 ci = c - atlas->start_charcode; // correctly shifted index
-        const Font_Glyph_Metric* metric = atlas->metrics + ci;
+// Fill selected part of visible rows behind text, line break of row is shown as narrow cell.
+static void render_selection(Ted_Context* ctx, s16 buffer_idx, s32 first_row, s32 last_row)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    if (buffer->anchor_row == INVALID_INDEX) return;
+    
+    const auto* atlas = active_atlas(ctx);
+    const auto* cursor = &buffer->cursor;
+    const auto* render_ctx = ctx->cursor_render_ctx;
 
-        if (c == ' ')
-        {
-            x += metric->advance_width;
-            continue;
-        }
+    const bool anchor_first = buffer->anchor_row < cursor->row || (buffer->anchor_row == cursor->row && buffer->anchor_col < cursor->col);
+    const s32 start_row = anchor_first ? buffer->anchor_row : cursor->row;
+    const s32 start_col = anchor_first ? buffer->anchor_col : cursor->col;
+    const s32 end_row = anchor_first ? cursor->row : buffer->anchor_row;
+    const s32 end_col = anchor_first ? cursor->col : buffer->anchor_col;
 
-        if (c == '\t')
-        {
-            // @Todo: handle different tab sizes, 4 by default for now.
-            x += 4 * metric->advance_width;
-            continue;
-        }
-                
-        const f32 gw = (f32)atlas->font_size;
-        const f32 gh = (f32)atlas->font_size;
-        const f32 gx = (f32)(x + metric->offset_x);
-        const f32 gy = y - (gh + metric->offset_y);
-        
-        mat4* transform = ctx->font_render_ctx->transforms + work_idx;
-        identity(transform);
-        translate(transform, vec3{gx, gy, 0.0f});
-        scale(transform, vec3{gw, gh, 0.0f});
+    first_row = max(first_row, first_visual_row(buffer, start_row));
+    last_row = min(last_row, first_visual_row(buffer, end_row + 1) - 1);
+    if (first_row > last_row) return;
+    
+    glUseProgram(render_ctx->program);
+    glBindVertexArray(render_ctx->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, render_ctx->vbo);
+    glUniform3f(render_ctx->u_text_color, ctx->selection_color.r, ctx->selection_color.g, ctx->selection_color.b);
 
-        ctx->font_render_ctx->charmap[work_idx] = ci;
+    const f32 descent = ctx->font->descent * atlas->px_h_scale;
+    
+    s32 segment;
+    s32 row = find_visual_row(buffer, first_row, &segment);
+    s32 line_pos = line_start_pos(buffer, row);
+    
+    for (s32 visual_row = first_row - segment; visual_row <= last_row && row <= buffer->last_line_idx;)
+    {
+        const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, row, line_pos);
+        const auto* offsets = lines.layout->offsets;
 
-        if (++work_idx >= FONT_RENDER_BATCH_SIZE)
+        // Selected bytes of line intersected with each of its visual lines.
+        const s32 col0 = row == start_row ? start_col : 0;
+        const s32 col1 = row == end_row ? end_col : lines.layout->size;
+        
+        for (s32 i = 0; i < lines.count; ++i, ++visual_row)
         {
-            render_batch_glyphs(ctx->font_render_ctx, work_idx);
-            work_idx = 0;
+            if (visual_row < first_row || visual_row > last_row) continue;
+
+            const s32 start = lines.starts[i];
+            const s32 end = lines.starts[i + 1];
+            const bool last_segment = i == lines.count - 1;
+            
+            const s32 x0 = offsets[max(col0, start)].x - offsets[start].x;
+            s32 x1 = offsets[min(col1, end)].x - offsets[start].x;
+            if (last_segment && row != end_row) x1 += atlas->line_height / 4;
+            if (col0 > end || col1 < start || x0 >= x1) continue;
+
+            mat4 transform;
+            identity(&transform);
+            translate(&transform, vec3{(f32)(buffer->x + x0), buffer->y + descent - visual_row * atlas->line_height, 0.0f});
+            scale(&transform, vec3{(f32)(x1 - x0), (f32)atlas->line_height, 0.0f});
+        
+            glUniformMatrix4fv(render_ctx->u_transform, 1, GL_FALSE, (f32*)&transform);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         }
 
-        x += metric->advance_width;
+        end_visual_lines(ctx, &lines);
+        next_visible_line(buffer, &row, &line_pos);
     }
-    
-    if (work_idx > 0) render_batch_glyphs(ctx->font_render_ctx, work_idx);
-    
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glUseProgram(0);
+}
 
-    // Render simple cursor.
-    const auto* cursor = &buffer->cursor;
+static void cursor_transform(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col, s32 line_pos, mat4* transform)
+{
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* atlas = active_atlas(ctx);
+    
+    const Visual_Lines lines = begin_visual_lines(ctx, buffer_idx, atlas, row, line_pos);
+    const s32 segment = find_segment(&lines, col);
+    const auto* offsets = lines.layout->offsets;
+    
+    const s32 visual_row = first_visual_row(buffer, row) + segment;
+    const f32 cursor_x = (f32)(buffer->x + offsets[col].x - offsets[lines.starts[segment]].x);
+    const f32 cursor_y = (f32)(buffer->y + ctx->font->descent * atlas->px_h_scale) - visual_row * atlas->line_height;
+    end_visual_lines(ctx, &lines);
+
+    identity(transform);
+    translate(transform, vec3{cursor_x, cursor_y, 0.0f});
+    scale(transform, vec3{2.0f, (f32)atlas->line_height, 0.0f});
+}
 
-    const s32 line_start_pos = line_start_pointer_pos(buffer);
-    const s32 width_px = line_width_px_till_pointer(atlas, display_buffer, line_start_pos);
+static void render_buffer(Ted_Context* ctx, s16 buffer_idx)
+{
+    assert(buffer_idx < ctx->buffer_count);
     
-    const f32 cursor_x = width_px + 4.0f;
-    const f32 cursor_y = (f32)(buffer->y + ctx->font->descent * atlas->px_h_scale) - cursor->row * atlas->line_height;
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* atlas = active_atlas(ctx);
 
-    identity(&buffer->cursor.transform);
-    translate(&buffer->cursor.transform, vec3{cursor_x, cursor_y, 0.0f});
-    scale(&buffer->cursor.transform, vec3{2.0f, (f32)atlas->line_height, 0.0f});
+    s32 first_row, last_row;
+    get_visible_rows(ctx, buffer, atlas, &first_row, &last_row);
+
+    render_selection(ctx, buffer_idx, first_row, last_row);
+    
+    if (is_monospace_layout(ctx, atlas))
+    {
+        const Monospace_Layout layout = make_monospace_layout(ctx, atlas);
+        render_buffer_text(ctx, buffer_idx, &layout, first_row, last_row);
+    }
+    else
+    {
+        const Shaped_Layout layout = make_shaped_layout(ctx, atlas);
+        render_buffer_text(ctx, buffer_idx, &layout, first_row, last_row);
+    }
 
     glUseProgram(ctx->cursor_render_ctx->program);
     glBindVertexArray(ctx->cursor_render_ctx->vao);
     glBindBuffer(GL_ARRAY_BUFFER, ctx->cursor_render_ctx->vbo);
-
     glUniform3f(ctx->cursor_render_ctx->u_text_color, ctx->text_color.r, ctx->text_color.g, ctx->text_color.b);
-    glUniformMatrix4fv(ctx->cursor_render_ctx->u_transform, 1, GL_FALSE, (f32*)&buffer->cursor.transform);
+
+    // Render simple cursor, pointer is at cursor, so its line start is known without walking lines.
+    const auto* cursor = &buffer->cursor;
+    const s32 line_pos = pointer_pos(&buffer->display_buffer) - cursor->col;
+    cursor_transform(ctx, buffer_idx, cursor->row, cursor->col, line_pos, &buffer->cursor.transform);
     
+    glUniformMatrix4fv(ctx->cursor_render_ctx->u_transform, 1, GL_FALSE, (f32*)&buffer->cursor.transform);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
+    // Extra cursors on visible lines are found by binary search of their positions.
+    s32 segment;
+    const s32 first_pos = line_start_pos(buffer, find_visual_row(buffer, first_row, &segment));
+    const s32 end_pos = line_start_pos(buffer, min(find_visual_row(buffer, last_row, &segment) + 1, buffer->last_line_idx + 1));
+    
+    for (s32 i = lower_bound_cursor(buffer, first_pos); i < buffer->extra_cursor_count && buffer->extra_cursors[i] < end_pos; ++i)
+    {
+        const s32 pos = buffer->extra_cursors[i];
+        const s32 row = row_at_pos(buffer, pos);
+        if (buffer->folded[row]) continue;
+        
+        const s32 extra_line_pos = line_start_pos(buffer, row);
+        
+        mat4 transform;
+        cursor_transform(ctx, buffer_idx, row, pos - extra_line_pos, extra_line_pos, &transform);
+        glUniformMatrix4fv(ctx->cursor_render_ctx->u_transform, 1, GL_FALSE, (f32*)&transform);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glUseProgram(0);
@@ -764,11 +3160,71 @@ static s32 vert_offset_from_baseline(const Font* font, const Font_Atlas* atlas)
     return (s32)((font->ascent + font->line_gap) * atlas->px_h_scale);
 }
 
-void update_frame(Ted_Context* ctx)
+void damage_window(Ted_Context* ctx)
+{
+    ctx->damage = Ted_Rect{0, 0, ctx->frame_w, ctx->frame_h};
+}
+
+void damage_rect(Ted_Context* ctx, s32 x0, s32 y0, s32 x1, s32 y1)
+{
+    x0 = max(x0, 0);
+    y0 = max(y0, 0);
+    x1 = min(x1, ctx->frame_w);
+    y1 = min(y1, ctx->frame_h);
+    
+    if (x0 >= x1 || y0 >= y1) return;
+
+    auto* damage = &ctx->damage;
+    if (!has_damage(ctx))
+    {
+        *damage = Ted_Rect{x0, y0, x1, y1};
+        return;
+    }
+
+    damage->x0 = min(damage->x0, x0);
+    damage->y0 = min(damage->y0, y0);
+    damage->x1 = max(damage->x1, x1);
+    damage->y1 = max(damage->y1, y1);
+}
+
+void damage_buffer_rows(Ted_Context* ctx, s16 buffer_idx, s32 first_row, s32 last_row)
+{
+    // Only active buffer is visible, others are redrawn on switch anyway.
+    if (buffer_idx != ctx->active_buffer_idx || ctx->atlas_count == 0) return;
+
+    auto* buffer = ctx->buffers + buffer_idx;
+    const auto* atlas = active_atlas(ctx);
+
+    // Lines were inserted, removed or folded, so rows below moved anyway. Skip rebuild of
+    // visual tree on each of many edits like file load, it is rebuilt from first of them on next frame.
+    if (has_visual_rows(buffer) && buffer->visual_tree_stale_row <= buffer->last_line_idx)
+    {
+        damage_window(ctx);
+        return;
+    }
+
+    // Buffer rows cover all their visual rows.
+    const s32 first_visual = first_visual_row(buffer, first_row);
+    const s32 last_visual = first_visual_row(buffer, last_row + 1) - 1;
+    
+    // Same row placement as cursor in render_buffer, padded by half a line for glyph overhang.
+    const s32 descent = (s32)(ctx->font->descent * atlas->px_h_scale);
+    const s32 pad = atlas->line_height / 2;
+    const s32 y0 = buffer->y + descent - last_visual * atlas->line_height - pad;
+    const s32 y1 = buffer->y + descent - first_visual * atlas->line_height + atlas->line_height + pad;
+    
+    damage_rect(ctx, 0, y0, ctx->frame_w, y1);
+}
+
+bool has_damage(const Ted_Context* ctx)
 {
-    // @Cleanup: move to context or smth.
-    static f32 prev_time = (f32)glfwGetTime();
+    return ctx->damage.x0 < ctx->damage.x1 && ctx->damage.y0 < ctx->damage.y1;
+}
 
+void update_frame(Ted_Context* ctx)
+{
+    use_active_atlas(ctx);
+    
     const auto* atlas = active_atlas(ctx);
     // @Cleanup: calculate only on window resize?
     ctx->buffer_min_y = ctx->window_h - vert_offset_from_baseline(ctx->font, atlas);
@@ -776,16 +3232,65 @@ void update_frame(Ted_Context* ctx)
     // @Todo: update all opened buffers (feature to come).
     auto* buffer = active_buffer(ctx);
     auto* display_buffer = &buffer->display_buffer;
+
+    const s32 prev_x = buffer->x;
+    const s32 prev_y = buffer->y;
+
+    // Wrapped lines above may change height and move visible text, so they are measured first.
+    if (ted_settings.soft_wrap)
+        while (measure_visible_lines(ctx, ctx->active_buffer_idx)) {}
     
-    buffer->min_x = -ctx->window_w; // @Todo: should be equal to longest line length
-    buffer->max_y = ctx->buffer_min_y + (buffer->last_line_idx * atlas->line_height);
+    // Edits are done at cursor, its line is measured right away and others in idle time.
+    if (!ted_settings.soft_wrap)
+    {
+        sync_width_index(ctx, buffer);
+        
+        const s32 line_pos = pointer_pos(display_buffer) - buffer->cursor.col;
+        if (buffer->line_widths[buffer->cursor.row] == INVALID_INDEX)
+            measure_line_width(ctx, ctx->active_buffer_idx, buffer->cursor.row, line_pos);
+    }
+
+    // End of longest line can be scrolled to right edge of window, lines are not wider with soft wrap.
+    const s32 longest_line = ted_settings.soft_wrap ? 0 : longest_line_width(buffer);
+    buffer->min_x = min(ctx->buffer_max_x, ctx->window_w - ctx->buffer_max_x - longest_line);
+    buffer->max_y = ctx->buffer_min_y + ((visual_row_count(buffer) - 1) * atlas->line_height);
     buffer->x = clamp(buffer->x, buffer->min_x, ctx->buffer_max_x);
     buffer->y = clamp(buffer->y, ctx->buffer_min_y, buffer->max_y);
+
+    if (buffer->x != prev_x || buffer->y != prev_y) damage_window(ctx);
+
+    // Lines till last visible one are highlighted before frame, lines below in idle time.
+    s32 first_row, last_row, segment;
+    get_visible_rows(ctx, buffer, atlas, &first_row, &last_row);
+    lex_lines(ctx, ctx->active_buffer_idx, find_visual_row(buffer, last_row, &segment), INT32_MAX);
+
+    // Nothing has changed since last frame, previous one is still on screen.
+    if (!has_damage(ctx)) return;
+    
+    const f32 start_time = (f32)glfwGetTime();
+    const Ted_Rect damage = ctx->damage;
+    ctx->frame_index++;
+    ctx->glyph_cache->frame = ctx->frame_index;
+    track_frame_stage(ctx->latency, LATENCY_STAGE_LAYOUT, glfwGetTime());
+    
+    // Redraw only damaged region of offscreen frame, then present it as a whole.
+    // Unlike back buffer, its contents are preserved between swaps on any platform.
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->frame_fbo);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(damage.x0, damage.y0, damage.x1 - damage.x0, damage.y1 - damage.y0);
     
     glClearColor(ctx->bg_color.r, ctx->bg_color.g, ctx->bg_color.b, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     render_buffer(ctx, ctx->active_buffer_idx);
+
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, ctx->frame_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, ctx->frame_w, ctx->frame_h, 0, 0, ctx->frame_w, ctx->frame_h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    ctx->damage = {0};
     
 #if TED_DEBUG
     static char debug_str[512];
@@ -793,25 +3298,59 @@ void update_frame(Ted_Context* ctx)
 
     f32 x = ctx->window_w - ctx->debug_atlas->line_height * debug_str_size * 0.5f;
     f32 y = (f32)(ctx->window_h - ctx->debug_atlas->line_height);
-    render_text(ctx->font_render_ctx, ctx->debug_atlas, debug_str, debug_str_size, 1.0f, x, y, 1.0f, 1.0f, 1.0f);
+    render_text(ctx->font_render_ctx, ctx->glyph_cache, ctx->debug_atlas, debug_str, debug_str_size, 1.0f, x, y, 1.0f, 1.0f, 1.0f);
 
-    debug_str_size = sprintf(debug_str, "pointer_pos=%d\ncursor=(%d, %d | %c)\nend=%d\ngap_start=%d\ngap_end=%d\nxy=(%d, %d)\nmin_xy=(%d, %d)\nmax_xy=(%d, %d)\nlast_line_idx=%d\nfont_size=%d",
+    const auto* present_latency = ctx->latency->histograms + LATENCY_STAGE_PRESENT;
+    debug_str_size = sprintf(debug_str, "pointer_pos=%d\ncursor=(%d, %d | %c)\nend=%d\ngap_start=%d\ngap_end=%d\nxy=(%d, %d)\nmin_xy=(%d, %d)\nmax_xy=(%d, %d)\nlast_line_idx=%d\nfont_size=%d\nlatency_ms=(%.2f, %.2f, %.2f)",
                              pointer_pos(&buffer->display_buffer),
                              buffer->cursor.row, buffer->cursor.col, char_at_pointer(display_buffer),
                              total_data_size(display_buffer),
                              prefix_data_size(display_buffer),
                              (s32)(buffer->display_buffer.gap_end - buffer->display_buffer.start),
-                             buffer->x, buffer->y, buffer->min_x, ctx->buffer_min_y, ctx->buffer_max_x, buffer->max_y, buffer->last_line_idx, atlas->font_size);
+                             buffer->x, buffer->y, buffer->min_x, ctx->buffer_min_y, ctx->buffer_max_x, buffer->max_y, buffer->last_line_idx, atlas->font_size,
+                             latency_percentile(present_latency, 0.5), latency_percentile(present_latency, 0.99), latency_percentile(present_latency, 0.999));
 
     x = ctx->window_w - ctx->debug_atlas->font_size * 12.0f;
     y -= ctx->debug_atlas->line_height;
-    render_text(ctx->font_render_ctx, ctx->debug_atlas, debug_str, debug_str_size, 1.0f, x, y, 1.0f, 1.0f, 1.0f);
+    render_text(ctx->font_render_ctx, ctx->glyph_cache, ctx->debug_atlas, debug_str, debug_str_size, 1.0f, x, y, 1.0f, 1.0f, 1.0f);
 #endif
     
+    track_frame_stage(ctx->latency, LATENCY_STAGE_SUBMIT, glfwGetTime());
     glfwSwapBuffers(ctx->window);
-    glfwPollEvents();
+    track_frame_stage(ctx->latency, LATENCY_STAGE_PRESENT, glfwGetTime());
+
+    ctx->dt = (f32)glfwGetTime() - start_time;
+}
+
+void wait_events(Ted_Context* ctx)
+{
+    // Block until input or background work damages the window, idle editor should not burn cpu.
+    if (has_damage(ctx))
+    {
+        glfwPollEvents();
+        return;
+    }
+
+    // Highlight lines below visible ones, so scrolling down finds them lexed.
+    if (lex_background(ctx))
+    {
+        glfwPollEvents();
+        return;
+    }
+
+    // Use idle time to bake neighbour font sizes, one atlas at a time to keep input responsive.
+    if (prefetch_atlas(ctx))
+    {
+        glfwPollEvents();
+        return;
+    }
+
+    // Measure lines out of view, so scroll bounds settle without stalling frames.
+    if (measure_wrap_index(ctx) || measure_width_index(ctx))
+    {
+        glfwPollEvents();
+        return;
+    }
 
-    const f32 time = (f32)glfwGetTime();
-    ctx->dt = time - prev_time;
-    prev_time = time;
+    glfwWaitEvents();
 }
@@ -4,26 +4,46 @@
 #include "vector.h"
 #include "matrix.h"
 #include "gap_buffer.h"
+#include "syntax.h"
+#include "depth_tree.h"
 
 struct Font;
 struct Font_Atlas;
 struct Font_Render_Context;
+struct Glyph_Cache;
+struct Shape_Cache;
 struct Gap_Buffer;
 struct GLFWwindow;
+struct Job_Queue;
+struct Latency_Tracker;
 
 #define TED_DEBUG 1
 
 inline constexpr s32 TED_MAX_BUFFERS = 64;
-inline constexpr s32 TED_MAX_ATLASES = 64;
-inline constexpr s32 TED_MAX_LINE_COUNT = 32 * 1024;
-inline constexpr s32 TED_MAX_FILE_SIZE = KB(256);
+inline constexpr s32 TED_MAX_ATLASES = 128;
+inline constexpr s32 TED_MAX_LINE_COUNT = 16 * 1024 * 1024; // per line info grows on demand up to it
+inline constexpr s32 TED_MIN_LINE_CAPACITY = 1024; // must be power of two, it is capacity of bracket tree
 inline constexpr s32 TED_MAX_FILE_NAME_SIZE = 256;
-inline constexpr s32 TED_MAX_BUFFER_SIZE = TED_MAX_FILE_NAME_SIZE + TED_MAX_FILE_SIZE + (TED_MAX_LINE_COUNT * sizeof(s32));
+inline constexpr s32 TED_MAX_CURSORS = 16 * 1024; // extra ones, besides main cursor
+inline constexpr s32 TED_MAX_BUFFER_SIZE = TED_MAX_FILE_NAME_SIZE + TED_MAX_CURSORS * sizeof(s32); // contents and per line info are on heap
+inline constexpr s32 TED_LINE_LAYOUT_CACHE_SIZE = 64; // lines, must be power of two
+inline constexpr s32 TED_LINE_LAYOUT_OFFSETS = 64 * 1024; // initial capacity, grows for longer line
+inline constexpr s32 TED_MEASURE_BATCH = 256; // lines laid out for wrap and width indices per idle step
+inline constexpr s32 TED_LEX_BATCH = 4096; // lines lexed for syntax highlight per idle step
+
+struct Ted_Rect
+{
+    s32 x0;
+    s32 y0;
+    s32 x1;
+    s32 y1;
+};
 
 struct Ted_Cursor
 {
     s32 row;
-    s32 col;
+    s32 col; // in bytes
+    s32 preferred_x; // pixel x kept by vertical moves, INVALID_INDEX if it is taken from col
     mat4 transform;
 };
 
@@ -36,17 +56,75 @@ struct Ted_Cursor_Render_Context
     u32 u_text_color;
 };
 
+// Position of one byte of line, continuation bytes of utf8 sequence share position of lead one.
+struct Ted_Line_Offset
+{
+    s32 x; // pen position from line start
+    s32 column; // tab takes tab_size columns, any other char takes one
+};
+
+// Byte, column and pixel mapping of one buffer line laid out with one atlas.
+struct Ted_Line_Layout
+{
+    const Font_Atlas* atlas; // null if slot is free
+    s32 row;
+    s32 size; // in bytes, offsets has one more entry for line end
+    s16 buffer_idx;
+    Ted_Line_Offset* offsets;
+};
+
+// Recently used line layouts, direct mapped by row. Offsets of all lines share one array,
+// whole cache is flushed when it is full and array is grown if line does not fit into it.
+// Lines are dropped when they are edited.
+struct Ted_Line_Layout_Cache
+{
+    Ted_Line_Layout lines[TED_LINE_LAYOUT_CACHE_SIZE];
+    Ted_Line_Offset* offsets; // heap allocated as lines are not bound by file size after edits
+    s32 offset_count;
+    s32 offset_capacity;
+};
+
 struct Ted_Buffer
 {
     Arena arena; // is meant for buffer metadata and contents
     Ted_Cursor cursor;
+    s32* extra_cursors; // sorted byte positions of cursors besides main one, edits are applied at all of them
+    s32 extra_cursor_count;
     Gap_Buffer display_buffer;
+    Gap_Buffer undo_buffer; // contents before last replace_all, start is null if there is none
     char* path; // path used to load file contents
+    s32 line_capacity; // per line arrays below have this many lines, power of two
     s32* line_lengths; // do not include '\n'
+    s32* line_tree; // fenwick tree of line sizes with '\n', its prefix sums are line start positions
+    s32 line_tree_stale_row; // lines were inserted or removed there, tree is rebuilt from it on next query
+    s32* wrap_counts; // visual lines of each line with soft wrap, 0 if not measured yet and taken as 1
+    s32* visual_tree; // fenwick tree of visual line counts, its prefix sums are first visual rows of lines
+    s32 visual_tree_stale_row;
+    const Font_Atlas* wrap_atlas; // atlas and width wrap counts were measured for
+    s32 wrap_width;
+    s32 wrap_next_row; // lines below are measured in idle time
+    s32* fold_sizes; // lines hidden below fold header, 0 for other lines
+    bool* folded; // line is hidden by fold, they are shifted with lines on edits
+    s32 fold_count;
+    s32* line_widths; // pixel width of each line for width_atlas, INVALID_INDEX if not measured yet
+    s32* width_tree; // max segment tree of line widths, line_capacity leaves, its root is longest line
+    s32 width_tree_stale_row; // leaves from it till width_tree_end or last line are set again on next query
+    s32 width_tree_end; // leaves past it are zero
+    const Font_Atlas* width_atlas;
+    s32 width_next_row; // lines below are measured in idle time
+    const Syntax_Grammar* grammar; // null for plain text
+    u8* lex_states; // lexer state at end of each line, LEX_STATE_DIRTY is set if line was edited after lexing
+    s32 lex_next_row; // lines above have valid lexer states
+    Depth_Summary* line_brackets; // bracket depth summary of each line, computed when line is lexed
+    Depth_Summary* bracket_tree; // depth tree of line summaries, line_capacity leaves
+    s32 bracket_tree_stale_row; // leaves from it till bracket_tree_end or last line are copied again on next query
+    s32 bracket_tree_end; // leaves past it are zero
+    s32 anchor_row; // selection is between anchor and cursor, INVALID_INDEX if nothing is selected
+    s32 anchor_col;
     s32 last_line_idx;
     s32 x;
     s32 y;
-    s32 min_x; // @Todo: depends on longest line size?
+    s32 min_x; // end of longest line is at right window edge
     s32 max_y;
 };
 
@@ -57,11 +135,25 @@ struct Ted_Context
     Font* font;
     Font_Render_Context* font_render_ctx;
     Ted_Cursor_Render_Context* cursor_render_ctx;
+    Latency_Tracker* latency;
+    Job_Queue* jobs;
+    Glyph_Cache* glyph_cache;
+    Shape_Cache* shape_cache;
+    Ted_Line_Layout_Cache* line_layouts;
     Font_Atlas* atlases;
     Ted_Buffer* buffers;
+    Ted_Rect damage; // window region to redraw, empty if x0 >= x1
+    u32 frame_fbo; // offscreen frame kept between redraws for partial updates
+    u32 frame_texture;
+    s32 frame_w;
+    s32 frame_h;
     vec3 bg_color;
     vec3 text_color;
+    vec3 selection_color;
+    vec3 token_colors[TOKEN_KIND_COUNT]; // text one is text_color
+    Syntax_Grammar* c_grammar;
     f32 dt;
+    u32 frame_index;
     s32 buffer_max_x;
     s32 buffer_min_y;
     s16 atlas_count;
@@ -70,6 +162,7 @@ struct Ted_Context
     s16 active_buffer_idx;
     s16 window_w;
     s16 window_h;
+    bool mouse_selecting; // left mouse button is held, cursor follows mouse
     
 #if TED_DEBUG
     Font_Atlas* debug_atlas;
@@ -84,6 +177,7 @@ void destroy(Ted_Context* ctx);
 bool alive(Ted_Context* ctx);
 void create_window(Ted_Context* ctx, s16 w, s16 h, s16 x, s16 y);
 void load_font(Ted_Context* ctx, const char* path);
+void add_fallback_font(Ted_Context* ctx, const char* path); // loaded only when primary font misses codepoint
 void init_render_context(Ted_Context* ctx);
 void bake_font(Ted_Context* ctx, u32 start_charcode, u32 end_charcode, s16 min_font_size, s16 max_font_size, s16 font_size_stride);
 s16 create_buffer(Ted_Context* ctx);
@@ -94,11 +188,35 @@ void open_next_buffer(Ted_Context* ctx);
 void open_prev_buffer(Ted_Context* ctx);
 void increase_font_size(Ted_Context* ctx);
 void decrease_font_size(Ted_Context* ctx);
+void toggle_soft_wrap(Ted_Context* ctx);
 void push_char(Ted_Context* ctx, s16 buffer_idx, char c);
 void push_str(Ted_Context* ctx, s16 buffer_idx, const char* str, s32 size);
 void delete_char(Ted_Context* ctx, s16 buffer_idx);
 void delete_char_overwrite(Ted_Context* ctx, s16 buffer_idx);
-void set_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col);
+void delete_range(Ted_Context* ctx, s16 buffer_idx, s32 start, s32 end); // byte positions, cursor goes to start
+s32 replace_all(Ted_Context* ctx, s16 buffer_idx, const char* pattern, const char* replacement, bool regex); // amount of replaced matches
+void undo_buffer_edit(Ted_Context* ctx, s16 buffer_idx); // of last replace_all, any other edit drops it
+void replace_range(Ted_Context* ctx, s16 buffer_idx, s32 start, s32 end, const char* str, s32 size); // cursor goes after string
+void set_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col); // extra cursors are dropped
+void add_cursor(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col); // extra one, main cursor stays
+void add_cursor_vertically(Ted_Context* ctx, s16 buffer_idx, s32 delta); // below or above outermost cursor
+void clear_extra_cursors(Ted_Context* ctx, s16 buffer_idx);
 void move_cursor_horizontally(Ted_Context* ctx, s16 buffer_idx, s32 delta);
 void move_cursor_vertically(Ted_Context* ctx, s16 buffer_idx, s32 delta);
+void toggle_fold(Ted_Context* ctx, s16 buffer_idx);
+s32 bracket_depth(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col); // brackets open before position
+bool find_matching_bracket(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col, s32* match_row, s32* match_col); // of bracket at col, else of one before it
+void jump_to_matching_bracket(Ted_Context* ctx, s16 buffer_idx);
+void select_to(Ted_Context* ctx, s16 buffer_idx, s32 row, s32 col); // move cursor and keep selection anchor
+void extend_selection(Ted_Context* ctx, s16 buffer_idx, s32 delta_col, s32 delta_row); // move cursor like arrow keys and keep selection anchor
+void select_all(Ted_Context* ctx, s16 buffer_idx);
+void copy_selection(Ted_Context* ctx, s16 buffer_idx); // to system clipboard
+void cut_selection(Ted_Context* ctx, s16 buffer_idx);
+void paste_clipboard(Ted_Context* ctx, s16 buffer_idx); // selection is replaced
+void hit_test(Ted_Context* ctx, s16 buffer_idx, f64 x, f64 y, s32* row, s32* col); // closest text position to window point
+void damage_window(Ted_Context* ctx);
+void damage_rect(Ted_Context* ctx, s32 x0, s32 y0, s32 x1, s32 y1);
+void damage_buffer_rows(Ted_Context* ctx, s16 buffer_idx, s32 first_row, s32 last_row);
+bool has_damage(const Ted_Context* ctx);
 void update_frame(Ted_Context* ctx);
+void wait_events(Ted_Context* ctx);
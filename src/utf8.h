@@ -0,0 +1,83 @@
+#pragma once
+
+inline constexpr u32 UTF8_REPLACEMENT_CHAR = 0xFFFD;
+
+inline bool is_utf8_continuation(u8 c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+// Size of sequence that starts with given byte, 1 for invalid lead bytes.
+inline s32 utf8_sequence_size(u8 lead)
+{
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 1;
+}
+
+// Decode sequence of given size, invalid ones decode as replacement char.
+inline u32 decode_utf8(const u8* bytes, s32 size)
+{
+    switch (size)
+    {
+        case 1: return bytes[0] < 0x80 ? bytes[0] : UTF8_REPLACEMENT_CHAR;
+        case 2: return ((bytes[0] & 0x1F) << 6) | (bytes[1] & 0x3F);
+        case 3: return ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) | (bytes[2] & 0x3F);
+        case 4: return ((bytes[0] & 0x07) << 18) | ((bytes[1] & 0x3F) << 12) | ((bytes[2] & 0x3F) << 6) | (bytes[3] & 0x3F);
+    }
+    
+    return UTF8_REPLACEMENT_CHAR;
+}
+
+// Decode sequence at start of text, broken or cut one decodes as replacement char of its lead byte alone.
+inline u32 next_codepoint(const char* text, s32 size, s32* sequence_size)
+{
+    const u8* bytes = (const u8*)text;
+    s32 count = utf8_sequence_size(bytes[0]);
+    if (count > size) count = 1;
+    
+    for (s32 i = 1; i < count; ++i)
+    {
+        if (!is_utf8_continuation(bytes[i]))
+        {
+            count = 1;
+            break;
+        }
+    }
+
+    *sequence_size = count;
+    return decode_utf8(bytes, count);
+}
+
+// Return amount of bytes written to out, which must have space for 4.
+inline s32 encode_utf8(u32 codepoint, char* out)
+{
+    if (codepoint < 0x80)
+    {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    
+    if (codepoint < 0x800)
+    {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    
+    if (codepoint < 0x10000)
+    {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}